@@ -20,22 +20,101 @@
 
 #include "Comm.h"
 
-using namespace ROS;
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QTimer>
+#include <QRandomGenerator>
 
-#include <QMessageBox>
+using namespace ROS;
 
 Comm::Comm(QObject *papi)
- : QObject(papi), m_loginState(NoLoged), incomingWordSize(-1), lastCommError(NoCommError)
+ : QObject(papi), m_sock(NULL), m_transport(TcpTransport), m_ignoreSslErrors(false), m_readPos(0), m_sentenceStart(0), m_loginState(NoLoged),
+   m_loginMethod(PlainLogin), m_challengeSent(false),
+   m_autoReconnect(false), m_replay(false), m_wantConnected(false), m_reconnectAttempt(0),
+   m_reconnectMin(1000), m_reconnectMax(60000), m_defaultTimeout(0), m_timeouts(0), m_statsOn(false),
+   m_rawMode(false), m_projecting(false), m_broadcastAll(false), m_pausedStreams(0), m_lastBatch(0),
+   m_decodePool(NULL), lastCommError(NoCommError)
 {
-	connect( &m_sock, SIGNAL(error(QAbstractSocket::SocketError)), SLOT(onSocketError(QAbstractSocket::SocketError)) );
-	connect( &m_sock, SIGNAL(readyRead()), this, SLOT(receiveSentence()) );
-	connect( &m_sock, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
-			 this, SLOT(onSocketStateChanges(QAbstractSocket::SocketState)) );
+	// Reserving capacity keeps the buffer allocated when it's emptied
+	// after every readyRead.
+	m_readBuf.reserve(0x4000);
+	m_writeBuf.reserve(0x1000);
+	incomingSentence.attributes().reserve(32, 0x400);
+	incomingSentence.setNameTable(m_names = QAttribNamesPtr(new QAttribNames));
+	m_pool.setNameTable(m_names);
+	createSocket();
+	m_clock.start();
+	m_timeoutTimer = new QTimer(this);
+	m_timeoutTimer->setSingleShot(true);
+	connect( m_timeoutTimer, SIGNAL(timeout()), this, SLOT(onTimeoutTimer()) );
+	m_statsTimer = new QTimer(this);
+	connect( m_statsTimer, SIGNAL(timeout()), this, SLOT(onStatsTimer()) );
+	m_reconnectTimer = new QTimer(this);
+	m_reconnectTimer->setSingleShot(true);
+	connect( m_reconnectTimer, SIGNAL(timeout()), this, SLOT(onReconnectTimer()) );
 }
 
 Comm::~Comm()
 {
-	m_sock.close();
+	// Waits for workers, as they post their results to this object.
+	delete m_decodePool;
+	m_sock->close();
+}
+
+/**
+ * @brief Comm::createSocket
+ * Creates the socket for current transport and connects his signals.
+ * Socket is a child, so it moves along when Comm is moved to another thread.
+ * Framing code just uses QTcpSocket functions, so it's the same for
+ * any transport.
+ */
+void Comm::createSocket()
+{
+	if( m_sock )
+	{
+		m_sock->disconnect(this);
+		m_sock->deleteLater();
+	}
+#ifndef QT_NO_SSL
+	if( m_transport == SslTransport )
+	{
+		QSslSocket *ssl = new QSslSocket(this);
+		connect( ssl, SIGNAL(encrypted()), this, SLOT(onEncrypted()) );
+		connect( ssl, SIGNAL(sslErrors(QList<QSslError>)), this, SLOT(onSslErrors(QList<QSslError>)) );
+		m_sock = ssl;
+	}
+	else
+#endif
+		m_sock = new QTcpSocket(this);
+
+	connect( m_sock, SIGNAL(error(QAbstractSocket::SocketError)), SLOT(onSocketError(QAbstractSocket::SocketError)) );
+	connect( m_sock, SIGNAL(readyRead()), this, SLOT(receiveSentence()) );
+	connect( m_sock, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
+			 this, SLOT(onSocketStateChanges(QAbstractSocket::SocketState)) );
+}
+
+/**
+ * @brief Comm::setTransport
+ * Sets the transport used to connect to router.
+ * SslTransport connects to api-ssl service (usually, port 8729).
+ * It can be changed only while unconnected.
+ * @param t The new transport.
+ * @return false if connected or TLS is not available on this Qt build.
+ */
+bool Comm::setTransport(Comm::Transport t)
+{
+	if( t == m_transport )
+		return true;
+	if( m_sock->state() != QAbstractSocket::UnconnectedState )
+		return false;
+#ifdef QT_NO_SSL
+	if( t == SslTransport )
+		return false;
+#endif
+	m_transport = t;
+	createSocket();
+	return true;
 }
 
 /**
@@ -51,8 +130,8 @@ QString Comm::errorString()
 	switch( lastCommError )
 	{
 	case NoCommError:
-		if( m_sock.error() != QAbstractSocket::UnknownSocketError )
-			return m_sock.errorString();
+		if( m_sock->error() != QAbstractSocket::UnknownSocketError )
+			return m_sock->errorString();
 		return tr("No error");
 	case SocketError:
 		return tr("A socket error.");
@@ -79,273 +158,1928 @@ QString Comm::errorString()
 	case ControlByteReceived:
 		return tr("Control byte received from router. Cannot continue as it's a undocumented situation.");
 	}
-	return tr("Unknown error");
+	return tr("Unknown error");
+}
+
+/**
+ * @brief Comm::resetSentence
+ * Resets incomingSentence and all variables used to receive
+ * the sentence from router.
+ * Call this function just after using the sentence to allow
+ * receiving a new one.
+ */
+void Comm::resetSentence()
+{
+	incomingSentence.clear();
+	m_incomingWords.clear();
+	m_sentenceStart = m_readPos;
+}
+
+/**
+ * @brief Comm::resetReadBuffer
+ * Discards all bytes pulled from socket and not decoded yet.
+ * Call this function when connection is closed or restarted, as
+ * remaining data belongs to the old connection.
+ */
+void Comm::resetReadBuffer()
+{
+	m_readBuf.resize(0);
+	m_readPos = 0;
+	m_sentenceStart = 0;
+	m_incomingWords.clear();
+}
+
+/**
+ * @brief Comm::readSocket
+ * Appends all data available on socket into m_readBuf.
+ * All bytes are pulled with a single read call, so decoding functions
+ * can walk m_readBuf instead of asking socket for every byte.
+ * Bytes of already processed sentences are discarded before appending
+ * the new ones. The incoming sentence ones are kept as m_incomingWords
+ * points to them.
+ * @return true if there is some byte on m_readBuf to be decoded.
+ */
+bool Comm::readSocket()
+{
+	if( m_sentenceStart )
+	{
+		if( m_sentenceStart >= m_readBuf.count() )
+			m_readBuf.resize(0);
+		else
+			m_readBuf.remove(0, m_sentenceStart);
+		m_readPos -= m_sentenceStart;
+		m_sentenceStart = 0;
+	}
+
+	qint64 avail = m_sock->bytesAvailable();
+	if( avail > 0 )
+	{
+		int old = m_readBuf.count();
+		m_readBuf.resize(old + int(avail));
+		qint64 got = m_sock->read(m_readBuf.data() + old, avail);
+		m_readBuf.resize(old + int(qMax<qint64>(got, 0)));
+		if( m_statsOn )
+		{
+			count(m_stats.socketReads);
+			count(m_stats.bytesIn, quint64(qMax<qint64>(got, 0)));
+		}
+	}
+	return m_readPos < m_readBuf.count();
+}
+
+/**
+ * @brief Comm::encodeSentence
+ * Encodes a full sentence into m_writeBuf.
+ * Every word is written with his length just before it and the
+ * sentence ends with the empty word. Nothing is written on socket. Call
+ * flushWriteBuffer to do it.
+ * @param sent Sentence class with the info to encode.
+ * @param tagID The numeric tag to use. If < 0, tag is used.
+ * @param tag The tag to use. If also empty, no tag is encoded.
+ * @return true if sentence is encoded. false if any word is too long
+ * to be sent. In that case, m_writeBuf is left as it was before calling.
+ */
+bool Comm::encodeSentence(const QSentence &sent, int tagID, const QString &tag)
+{
+	int start = m_writeBuf.count();
+	bool ok = appendWord(sent.command());
+
+	if( ok && !sent.getID().isEmpty() )
+		ok = appendWord('=', ".id", sent.getID());
+	if( ok )
+		ok = appendAttributes('=', sent.attributes());
+	if( ok && !sent.proplist().isEmpty() && !sent.attributes().contains(".proplist") )
+		ok = appendWord('=', ".proplist", sent.proplist().join(','));
+	if( ok )
+		ok = appendAttributes('.', sent.APIattributes());
+	for( int i = 0; ok && (i < sent.queries().count()); i++ )
+		ok = appendWord(sent.queries().at(i).toWord());
+	if( ok && (tagID >= 0) )
+		ok = appendTagWord(tagID);
+	else
+	if( ok && !tag.isEmpty() )
+		ok = appendWord('.', "tag", tag);
+	if( ok )
+		ok = appendWordCount(0);
+
+	if( !ok )
+		m_writeBuf.resize(start);
+	return ok;
+}
+
+/**
+ * @brief Comm::flushWriteBuffer
+ * Writes all encoded sentences on socket with a single call.
+ * The buffer is emptied but keeps its capacity for the next sentences.
+ */
+void Comm::flushWriteBuffer()
+{
+	if( m_writeBuf.count() )
+	{
+		m_sock->write(m_writeBuf);
+		if( m_statsOn )
+		{
+			count(m_stats.socketWrites);
+			count(m_stats.bytesOut, quint64(m_writeBuf.count()));
+			m_stats.bytesToWrite.storeRelease(m_sock->bytesToWrite());
+		}
+		m_writeBuf.resize(0);
+	}
+}
+
+/**
+ * @brief Comm::writeSentence
+ * Sends a full sentence.
+ * If there is no tag provided in sentence info, a unique one
+ * is created to send to and returned.
+ * All sentence is encoded into a single buffer and written on
+ * socket at once.
+ * @param sent Sentence class with the info to sent to Router.
+ * @param sendTag (Optional, default==true) Tells function to use (or,
+ * eventually create and use) a tag for sentence to sent.
+ * This function can be called from any thread. From a thread other
+ * than Comm one, sentence is queued and sent on Comm thread.
+ * @return tag used for sentence.
+ */
+QString Comm::sendSentence(const QSentence &sent, bool sendTag)
+{
+	int tagID = -1;
+	QString tag;
+
+	if( sendTag )
+		tagID = sentenceTag(sent, &tag);
+	if( isForeignThread() )
+		queueOutgoing(sent, tagID, tag, ReplyHandler());
+	else
+	if( !sendTagged(sent, tagID, tag) )
+		return QString();
+	return (tagID >= 0) ? QString::number(tagID) : tag;
+}
+
+/**
+ * @brief Comm::sentenceTag
+ * Gets the tag to use for sending a sentence.
+ * If sentence has no tag, a new numeric one is allocated.
+ * @param sent The sentence to send.
+ * @param tag Variable to store the sentence tag when is not numeric.
+ * @return The numeric tag or -1 if sentence tag is not numeric.
+ */
+int Comm::sentenceTag(const QSentence &sent, QString *tag)
+{
+	int tagID = sent.tagID();
+	if( tagID < 0 )
+	{
+		*tag = sent.tag();
+		if( tag->isEmpty() )
+			tagID = nextTagID();
+	}
+	return tagID;
+}
+
+/**
+ * @brief Comm::sendTagged
+ * Encodes and sends a sentence using the tag provided, ignoring
+ * the sentence one. Tagged sentences are tracked on in-flight table.
+ * If login is not finished yet, sentence is queued and sent just after it.
+ * @param sent Sentence class with the info to sent to Router.
+ * @param tagID The numeric tag to use. If < 0, tag is used.
+ * @param tag The tag to use. If also empty, sentence is sent without tag.
+ * @param replayable false to never replay it after reconnecting.
+ * @return false if sentence cannot be encoded. Connection is closed then.
+ */
+bool Comm::sendTagged(const QSentence &sent, int tagID, const QString &tag, bool replayable)
+{
+	bool queued = m_loginState != LogedIn;
+	if( queued )
+	{
+		Outgoing o;
+		o.sent = sent;
+		o.tagID = tagID;
+		o.tag = tag;
+		m_loginQueue.append(o);
+	}
+	else
+	if( !encodeSentence(sent, tagID, tag) )
+	{
+		setComError( WordToSendTooLong );
+		dropConnection(true);
+		return false;
+	}
+	else
+		flushWriteBuffer();
+	if( (tagID >= 0) || !tag.isEmpty() )
+		trackInFlight(tagID, tag, newInFlight(sent, 0, queued, replayable));
+	return true;
+}
+
+/**
+ * @brief Comm::newInFlight
+ * Creates the in-flight info of a sentence.
+ * Sentence is kept to be replayed after reconnecting only if replay
+ * is enabled and the sentence is idempotent.
+ * @param sent The sentence sent.
+ * @param batch The batch it belongs to. 0 if none.
+ * @param queued true if sentence is on login queue, not sent yet.
+ * @param replayable false to never replay it.
+ */
+Comm::InFlight Comm::newInFlight(const QSentence &sent, int batch, bool queued, bool replayable) const
+{
+	InFlight f(batch);
+	f.queued = queued;
+	f.path = sent.command();
+	f.sentAt = now();
+	if( replayable && m_replay && isIdempotent(sent) )
+		f.sent = sent;
+	for( int i = 0; i < sent.proplist().count(); i++ )
+		f.proplist.append(sent.proplist().at(i).toLatin1());
+	// Listen commands never finish by themselves.
+	if( (m_defaultTimeout > 0) && (f.path != "/cancel") && !f.path.endsWith("/listen") )
+		f.deadline = f.sentAt + qint64(m_defaultTimeout) * 1000;
+	return f;
+}
+
+/**
+ * @brief Comm::trackInFlight
+ * Adds a command to in-flight table and schedules his deadline, if any.
+ * @param tagID The numeric tag. If < 0, tag is used.
+ * @param tag The tag.
+ * @param f The in-flight info.
+ */
+void Comm::trackInFlight(int tagID, const QString &tag, const Comm::InFlight &f)
+{
+	m_inFlight.insert(tagID, tag, f);
+	if( !f.proplist.isEmpty() )
+		m_projecting = true;
+	if( f.deadline )
+		addDeadline(f.deadline, (tagID >= 0) ? QString::number(tagID) : tag);
+}
+
+/**
+ * @brief Comm::isIdempotent
+ * Tells if a sentence can be sent again without side effects.
+ * Just print, getall and listen commands are considered so.
+ * @param sent The sentence.
+ * @return true if sentence can be safely replayed.
+ */
+bool Comm::isIdempotent(const QSentence &sent)
+{
+	const QString &cmd = sent.command();
+	return cmd.endsWith("/print") || cmd.endsWith("/getall") || cmd.endsWith("/listen");
+}
+
+/**
+ * @brief Comm::sendWithHandler
+ * Sends a sentence and routes all his replies to handler.
+ * If sentence has no tag, a unique one is used.
+ * @param sent Sentence class with the info to sent to Router.
+ * @param handler The function that will receive replies. It's called
+ * on Comm thread, even if this function is called from another one.
+ * @return tag used for sentence.
+ * @see setTagHandler
+ */
+QString Comm::sendWithHandler(const QSentence &sent, const Comm::ReplyHandler &handler)
+{
+	QString tag;
+	int tagID = sentenceTag(sent, &tag);
+
+	if( isForeignThread() )
+	{
+		queueOutgoing(sent, tagID, tag, handler);
+		return (tagID >= 0) ? QString::number(tagID) : tag;
+	}
+
+	QSharedPointer<TagRoute> route(new TagRoute);
+	route->handler = handler;
+	m_routes.insert(tagID, tag, route);
+	if( !sendTagged(sent, tagID, tag) )
+	{
+		m_routes.remove(tagID, tag);
+		return QString();
+	}
+	return (tagID >= 0) ? QString::number(tagID) : tag;
+}
+
+/**
+ * @brief Comm::isForeignThread
+ * @return true if caller runs on a thread other than Comm one.
+ */
+bool Comm::isForeignThread() const
+{
+	return QThread::currentThread() != thread();
+}
+
+/**
+ * @brief Comm::queueOutgoing
+ * Queues a sentence sent from another thread.
+ * flushOutgoing is posted to Comm thread just once for all sentences
+ * queued before it runs.
+ * @param sent The sentence to send.
+ * @param tagID The numeric tag to use. If < 0, tag is used.
+ * @param tag The tag to use.
+ * @param handler Optional reply handler.
+ */
+void Comm::queueOutgoing(const QSentence &sent, int tagID, const QString &tag, const Comm::ReplyHandler &handler)
+{
+	Outgoing o;
+	o.sent = sent;
+	o.tagID = tagID;
+	o.tag = tag;
+	o.handler = handler;
+
+	m_outMutex.lock();
+	m_outgoing.append(o);
+	m_outMutex.unlock();
+	if( m_outPosted.testAndSetOrdered(0, 1) )
+		QMetaObject::invokeMethod(this, "flushOutgoing", Qt::QueuedConnection);
+}
+
+/**
+ * @brief Comm::queueForLogin
+ * Puts a sentence queued from another thread on login queue, with his
+ * route and in-flight entry.
+ */
+void Comm::queueForLogin(const Comm::Outgoing &o)
+{
+	m_loginQueue.append(o);
+	if( o.handler )
+	{
+		QSharedPointer<TagRoute> route(new TagRoute);
+		route->handler = o.handler;
+		m_routes.insert(o.tagID, o.tag, route);
+	}
+	if( (o.tagID >= 0) || !o.tag.isEmpty() )
+		trackInFlight(o.tagID, o.tag, newInFlight(o.sent, 0, true));
+}
+
+/**
+ * @brief Comm::flushOutgoing
+ * Encodes all sentences queued from other threads and writes them
+ * on socket at once.
+ * If one cannot be encoded, it finishes as Fatal, connection is dropped
+ * and the ones after it wait on login queue.
+ */
+void Comm::flushOutgoing()
+{
+	QList<Outgoing> out;
+	m_outPosted.storeRelease(0);
+	m_outMutex.lock();
+	out.swap(m_outgoing);
+	m_outMutex.unlock();
+
+	for( int i = 0; i < out.count(); i++ )
+	{
+		const Outgoing &o = out.at(i);
+		bool queued = m_loginState != LogedIn;
+		if( queued )
+			m_loginQueue.append(o);
+		else
+		if( !encodeSentence(o.sent, o.tagID, o.tag) )
+		{
+			flushWriteBuffer();
+			// Caller already has the tag, so it fails now. Sentences after
+			// it go to login queue, to be handled as any other one waiting
+			// for login when connection drops.
+			if( (o.tagID >= 0) || !o.tag.isEmpty() )
+			{
+				InFlight f = newInFlight(o.sent, 0, false, false);
+				f.result = QSentence::Fatal;
+				finishCommand((o.tagID >= 0) ? QString::number(o.tagID) : o.tag, f);
+			}
+			for( int j = i + 1; j < out.count(); j++ )
+				queueForLogin(out.at(j));
+			setComError( WordToSendTooLong );
+			dropConnection(true);
+			return;
+		}
+		if( o.handler )
+		{
+			QSharedPointer<TagRoute> route(new TagRoute);
+			route->handler = o.handler;
+			m_routes.insert(o.tagID, o.tag, route);
+		}
+		if( (o.tagID >= 0) || !o.tag.isEmpty() )
+			trackInFlight(o.tagID, o.tag, newInFlight(o.sent, 0, queued));
+	}
+	flushWriteBuffer();
+}
+
+/**
+ * @brief Comm::sendBatch
+ * Sends a list of sentences back-to-back, without waiting for replies.
+ * Every sentence is tagged (using his own tag or a new unique one) and
+ * tracked on the in-flight table until his !done is received.
+ * commandFinished is emited for every sentence and batchFinished once
+ * all of them are finished.
+ * Replies are still emited through comReceive (or comReceiveRaw).
+ * If login is not finished yet, sentences are sent just after it.
+ * Must be called from Comm thread.
+ * @param sents The sentences to send.
+ * @param tags (Optional) list to append the tags used, in the same
+ * order as sents.
+ * @return The batch identifier used on commandFinished and batchFinished
+ * signals. 0 if sents is empty (no signal will be emited) and -1 if a
+ * sentence cannot be encoded. In this last case, connection is closed.
+ */
+int Comm::sendBatch(const QList<QSentence> &sents, QStringList *tags)
+{
+	if( sents.isEmpty() )
+		return 0;
+
+	if( ++m_lastBatch <= 0 )
+		m_lastBatch = 1;
+	int batch = m_lastBatch;
+	m_batches.insert(batch, Batch());
+
+	for( int i = 0; i < sents.count(); i++ )
+	{
+		QString tag;
+		int tagID = sentenceTag(sents.at(i), &tag);
+		bool queued = m_loginState != LogedIn;
+		if( queued )
+		{
+			Outgoing o;
+			o.sent = sents.at(i);
+			o.tagID = tagID;
+			o.tag = tag;
+			m_loginQueue.append(o);
+		}
+		else
+		if( !encodeSentence(sents.at(i), tagID, tag) )
+		{
+			flushWriteBuffer();
+			setComError( WordToSendTooLong );
+			dropConnection(true);
+			return -1;
+		}
+		trackInFlight(tagID, tag, newInFlight(sents.at(i), batch, queued));
+		m_batches[batch].pending++;
+		if( tags )
+			tags->append((tagID >= 0) ? QString::number(tagID) : tag);
+
+		// Don't let buffer grow forever on huge batches.
+		if( m_writeBuf.count() >= 0x10000 )
+			flushWriteBuffer();
+	}
+	flushWriteBuffer();
+	return batch;
+}
+
+/**
+ * @brief Comm::sendBulk
+ * Sends a bulk command: every row of rows is a sentence, encoded
+ * straight from rows buffer into write buffer with no QSentence.
+ * Rows are pipelined: up to window rows are in flight and next one is
+ * sent as soon as one gets his !done. Every row failure is collected
+ * with his !trap message, and onDone gets them all once every row is
+ * finished.
+ * If connection is lost, rows on the fly fail with Fatal and the rest
+ * are skipped. If login is not done, rows wait for it.
+ * Must be called from Comm thread.
+ * @param rows The rows to send.
+ * @param onDone Function called with the result. It can be called
+ * before returning if no row can be encoded.
+ * @param abortOnError true to stop sending rows after the first one
+ * failing. Rows already in flight are not cancelled.
+ * @param window Max rows in flight at once.
+ * @return the batch id or 0 if rows is empty.
+ * @see QBulkRows
+ */
+int Comm::sendBulk(const QBulkRows &rows, const Comm::BulkHandler &onDone, bool abortOnError, int window)
+{
+	if( rows.isEmpty() )
+		return 0;
+
+	if( ++m_lastBatch <= 0 )
+		m_lastBatch = 1;
+	int batch = m_lastBatch;
+	Bulk &b = m_bulks[batch];
+	b.rows = rows;
+	b.onDone = onDone;
+	b.window = qMax(1, window);
+	b.abortOnError = abortOnError;
+	b.result.rows = rows.rowCount();
+	pumpBulk(batch);
+	return batch;
+}
+
+/**
+ * @brief Comm::encodeBulkRow
+ * Encodes a bulk row into m_writeBuf. Null values are not sent.
+ * @param rows The rows.
+ * @param row The row to encode.
+ * @param tagID The tag to use.
+ * @return false if any word is too long to be sent. m_writeBuf is left
+ * as it was before calling.
+ */
+bool Comm::encodeBulkRow(const QBulkRows &rows, int row, int tagID)
+{
+	int start = m_writeBuf.count();
+	QLatin1String cmd = rows.command();
+	bool ok = appendWordCount(cmd.size());
+
+	if( ok )
+		m_writeBuf.append(cmd.data(), cmd.size());
+	for( int c = 0; ok && (c < rows.columnCount()); c++ )
+	{
+		if( !rows.isNull(row, c) )
+			ok = appendWord('=', rows.columnName(c), rows.value(row, c));
+	}
+	if( ok )
+		ok = appendTagWord(tagID);
+	if( ok )
+		ok = appendWordCount(0);
+
+	if( !ok )
+		m_writeBuf.resize(start);
+	return ok;
+}
+
+/**
+ * @brief Comm::pumpBulk
+ * Sends rows of a bulk command while his window is not full. Once all
+ * rows are finished, or bulk is aborted and nothing is in flight,
+ * bulk is removed and his handler called.
+ * @param batch The bulk batch id.
+ */
+void Comm::pumpBulk(int batch)
+{
+	QHash<int, Bulk>::iterator it = m_bulks.find(batch);
+	if( it == m_bulks.end() )
+		return;
+
+	Bulk &b = it.value();
+	if( m_loginState == LogedIn )
+	{
+		while( !b.aborted && (b.next < b.rows.rowCount()) && (b.inFlight < b.window) )
+		{
+			int row = b.next++;
+			int tagID = nextTagID();
+			if( !encodeBulkRow(b.rows, row, tagID) )
+			{
+				BulkError e;
+				e.row = row;
+				e.result = QSentence::Trap;
+				e.message = tr("Word length to be send to router is too long to be handled by this API");
+				b.result.errors.append(e);
+				b.aborted = b.abortOnError;
+				continue;
+			}
+
+			InFlight f(batch);
+			f.bulkRow = row;
+			f.path = b.rows.command();
+			f.sentAt = now();
+			if( m_defaultTimeout > 0 )
+				f.deadline = f.sentAt + qint64(m_defaultTimeout) * 1000;
+			trackInFlight(tagID, QString(), f);
+			b.inFlight++;
+
+			if( m_writeBuf.count() >= 0x10000 )
+				flushWriteBuffer();
+		}
+		flushWriteBuffer();
+	}
+
+	if( !b.inFlight && (b.aborted || (b.next >= b.rows.rowCount())) )
+	{
+		Bulk done = b;
+		m_bulks.erase(it);
+		done.result.skipped = done.rows.rowCount() - done.next;
+		if( done.onDone )
+			done.onDone(done.result);
+	}
+}
+
+/**
+ * @brief Comm::finishBulkRow
+ * Records the result of a bulk row and sends next rows.
+ * @param f The in-flight info of the row.
+ */
+void Comm::finishBulkRow(const Comm::InFlight &f)
+{
+	QHash<int, Bulk>::iterator it = m_bulks.find(f.batch);
+	if( it == m_bulks.end() )
+		return;
+
+	Bulk &b = it.value();
+	b.inFlight--;
+	if( f.result == QSentence::Done )
+		b.result.applied++;
+	else
+	{
+		BulkError e;
+		e.row = f.bulkRow;
+		e.result = f.result;
+		e.message = f.message;
+		b.result.errors.append(e);
+		if( b.abortOnError || (f.result == QSentence::Fatal) )
+			b.aborted = true;
+	}
+	pumpBulk(f.batch);
+}
+
+/**
+ * @brief Comm::abortBulks
+ * Called when connection is lost, after in-flight rows are finished.
+ * @param keep true to keep bulks not started yet, to be sent after
+ * reconnecting. Otherwise, all their rows are skipped.
+ */
+void Comm::abortBulks(bool keep)
+{
+	QList<int> batches = m_bulks.keys();
+	for( int i = 0; i < batches.count(); i++ )
+	{
+		QHash<int, Bulk>::iterator it = m_bulks.find(batches.at(i));
+		if( it == m_bulks.end() )
+			continue;
+		if( !keep || it.value().next )
+			it.value().aborted = true;
+		pumpBulk(batches.at(i));
+	}
+}
+
+/**
+ * @brief Comm::nextTagID
+ * Allocates a new numeric tag.
+ * Every connection has his own counter. It's atomic, so it can be
+ * called from any thread.
+ * Values are kept into 1..999999999 range so they are always valid
+ * for QSentence::tagToID.
+ * @return a new unique tag to be used on a sentence.
+ */
+int Comm::nextTagID()
+{
+	return int(uint(m_tagSeq.fetchAndAddRelaxed(1)) % 999999999u) + 1;
+}
+
+/**
+ * @brief Comm::streamSentence
+ * Sends a sentence and delivers his !re rows one by one to onRow,
+ * without keeping all result in memory. Meant for huge /print results.
+ * If onRow returns false, next rows are queued until resumeStream is
+ * called. Once window rows are queued, socket is not read anymore, so
+ * TCP flow control stops the router until consumer catches up.
+ * Sentence passed to onRow can be kept with takeSentence.
+ * onDone is called once !done is received and all rows are delivered.
+ * @param sent Sentence class with the info to sent to Router.
+ * @param onRow The function that will receive rows.
+ * @param onDone The function called when command is finished.
+ * @param window Max rows to keep queued for a busy consumer.
+ * @return tag used for sentence. Empty if sentence cannot be sent.
+ * @see resumeStream
+ */
+QString Comm::streamSentence(const QSentence &sent, const Comm::RowHandler &onRow, const Comm::DoneHandler &onDone, int window)
+{
+	QSharedPointer<Stream> st(new Stream);
+	st->tagID = sentenceTag(sent, &st->tag);
+	st->onRow = onRow;
+	st->onDone = onDone;
+	st->window = qMax(1, window);
+
+	QSharedPointer<TagRoute> route(new TagRoute);
+	route->handler = [this, st](QSentence &s) { streamReply(st, s); };
+	m_streams.insert(st->tagID, st->tag, st);
+	m_routes.insert(st->tagID, st->tag, route);
+	// Rows already delivered would be delivered again if replayed.
+	if( !sendTagged(sent, st->tagID, st->tag, false) )
+	{
+		m_routes.remove(st->tagID, st->tag);
+		m_streams.remove(st->tagID, st->tag);
+		return QString();
+	}
+	return (st->tagID >= 0) ? QString::number(st->tagID) : st->tag;
+}
+
+/**
+ * @brief Comm::resumeStream
+ * Tells that consumer of a streamed command can take rows again.
+ * Queued rows are delivered right now until onRow returns false again.
+ * If the stream window is not full anymore, socket reading is resumed.
+ * @param tag The tag returned by streamSentence.
+ */
+void Comm::resumeStream(const QString &tag)
+{
+	int tagID = QSentence::tagToID(tag);
+	QSharedPointer<Stream> st = m_streams.value(tagID, tag);
+	if( st.isNull() )
+		return;
+
+	st->busy = false;
+	while( !st->busy && !st->pending.isEmpty() )
+	{
+		QSentence row = st->pending.dequeue();
+		st->busy = !st->onRow(row);
+		m_pool.release(row);
+	}
+	if( st->paused && (st->pending.count() < st->window) )
+	{
+		st->paused = false;
+		resumeReading();
+	}
+	if( st->finished && st->pending.isEmpty() )
+		finishStream(st);
+}
+
+/**
+ * @brief Comm::streamReply
+ * Route handler for streamed commands.
+ * Rows are delivered directly while consumer is not busy. Otherwise,
+ * they are taken (not copied) from incomingSentence and queued.
+ * @param st The stream.
+ * @param s The sentence received.
+ */
+void Comm::streamReply(const QSharedPointer<Comm::Stream> &st, QSentence &s)
+{
+	switch( s.getResultType() )
+	{
+	case QSentence::Reply:
+		if( !st->busy && st->pending.isEmpty() )
+			st->busy = !st->onRow(s);
+		else
+		{
+			st->pending.enqueue(takeSentence());
+			if( !st->paused && (st->pending.count() >= st->window) )
+			{
+				st->paused = true;
+				pauseReading();
+			}
+		}
+		break;
+	case QSentence::Trap:
+		st->result = QSentence::Trap;
+		st->message = s.attribute("message");
+		break;
+	case QSentence::Done:
+		st->finished = true;
+		if( st->pending.isEmpty() )
+			finishStream(st);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * @brief Comm::finishStream
+ * Forgets a stream fully delivered and calls his onDone.
+ * @param st The stream.
+ */
+void Comm::finishStream(const QSharedPointer<Comm::Stream> &st)
+{
+	if( m_streams.value(st->tagID, st->tag) == st )
+		m_streams.remove(st->tagID, st->tag);
+	if( st->paused )
+	{
+		st->paused = false;
+		resumeReading();
+	}
+	if( st->onDone )
+		st->onDone(st->result, st->message);
+}
+
+/**
+ * @brief Comm::abortStreams
+ * Finishes all streams as Fatal. Queued rows are discarded.
+ * Called when connection is lost as no more rows will come.
+ */
+void Comm::abortStreams()
+{
+	QList< QPair<QString, QSharedPointer<Stream> > > lost = m_streams.takeAll();
+
+	m_pausedStreams = 0;
+	m_sock->setReadBufferSize(0);
+	for( int i = 0; i < lost.count(); i++ )
+	{
+		Stream &st = *lost.at(i).second;
+		st.pending.clear();
+		st.paused = false;
+		if( st.onDone )
+			st.onDone(QSentence::Fatal, QString());
+	}
+}
+
+/**
+ * @brief Comm::pauseReading
+ * Stops decoding sentences and limits socket buffer, so router is
+ * stopped by TCP flow control.
+ */
+void Comm::pauseReading()
+{
+	if( m_pausedStreams++ == 0 )
+		m_sock->setReadBufferSize(0x4000);
+}
+
+/**
+ * @brief Comm::resumeReading
+ * Undoes a pauseReading. When no stream is full, socket buffer is
+ * unlimited again and decoding continues on the next event loop
+ * iteration, as bytes already buffered won't emit readyRead again.
+ */
+void Comm::resumeReading()
+{
+	if( (m_pausedStreams > 0) && (--m_pausedStreams == 0) )
+	{
+		m_sock->setReadBufferSize(0);
+		QMetaObject::invokeMethod(this, "receiveSentence", Qt::QueuedConnection);
+	}
+}
+
+/**
+ * @brief Comm::sendSentence
+ * Sends a new sentence.
+ * This is a convenient function. Internally, just calls sendSentence(const QSentence&, bool)
+ * @overload
+ * @see sendSentence(const QSentence&, bool);
+ */
+QString Comm::sendSentence(const QString &cmd, bool sendTag, const QStringList &attrib)
+{
+	return sendSentence( QSentence(cmd, QString(), attrib), sendTag );
+}
+
+/**
+ * @brief Comm::now
+ * @return microseconds since Comm was created.
+ */
+qint64 Comm::now() const
+{
+	return m_clock.nsecsElapsed() / 1000;
+}
+
+/**
+ * @brief Comm::setTimeout
+ * Sets a deadline for a command already sent. If his !done is not
+ * received within it, /cancel is sent and the command is finished as
+ * QSentence::Timeout: comReceive (or his tag route) receives a !trap
+ * with "=message=timeout" and a !done, and commandFinished is emited
+ * with Timeout result. Replies router sends later for it are emited
+ * through comReceive.
+ * @param tag The command tag.
+ * @param ms Time, from now, to wait for the !done.
+ * @return false if there is no such command in-flight.
+ * @see setDefaultTimeout
+ */
+bool Comm::setTimeout(const QString &tag, int ms)
+{
+	int tagID = QSentence::tagToID(tag);
+	InFlight *f = m_inFlight.find(tagID, tag);
+	if( !f )
+		return false;
+	f->deadline = now() + qint64(qMax(0, ms)) * 1000;
+	addDeadline(f->deadline, tag);
+	return true;
+}
+
+/**
+ * @brief Comm::addDeadline
+ * Schedules a deadline check. Timer is always set to earliest one.
+ * @param deadline The deadline, as returned by now().
+ * @param tag The command tag.
+ */
+void Comm::addDeadline(qint64 deadline, const QString &tag)
+{
+	m_deadlines.insert(deadline, tag);
+	if( m_deadlines.firstKey() == deadline )
+		m_timeoutTimer->start(int(qMax<qint64>(0, (deadline - now() + 999) / 1000)));
+}
+
+/**
+ * @brief Comm::onTimeoutTimer
+ * Slot connected to timeout timer. Times out every command whose
+ * deadline is reached and schedules next check.
+ */
+void Comm::onTimeoutTimer()
+{
+	qint64 t = now();
+	while( !m_deadlines.isEmpty() && (m_deadlines.firstKey() <= t) )
+	{
+		QMultiMap<qint64, QString>::iterator it = m_deadlines.begin();
+		qint64 deadline = it.key();
+		QString tag = it.value();
+		m_deadlines.erase(it);
+
+		int tagID = QSentence::tagToID(tag);
+		InFlight *f = m_inFlight.find(tagID, tag);
+		// Already finished, or deadline was changed.
+		if( !f || (f->deadline != deadline) || (f->result == QSentence::Timeout) )
+			continue;
+		// Waiting to be replayed. replayInFlight sets his deadline again.
+		if( !isLoged() && !f->queued && !f->sent.command().isEmpty() )
+			continue;
+		f->result = QSentence::Timeout;
+		m_timeouts++;
+		if( f->queued )
+		{
+			// Not sent yet. Just forget it.
+			for( int i = 0; i < m_loginQueue.count(); i++ )
+				if( (tagID >= 0) ? (m_loginQueue.at(i).tagID == tagID) : (m_loginQueue.at(i).tag == tag) )
+				{
+					m_loginQueue.removeAt(i);
+					break;
+				}
+		}
+		else
+		if( isLoged() )
+			sendCancel(tag);
+
+		QSentence trap;
+		trap.addWord("!trap");
+		trap.addAttribute("message", "timeout");
+		if( tagID >= 0 )
+			trap.setTag(tagID);
+		else
+			trap.setTag(tag);
+		QSentence done;
+		done.addWord("!done");
+		done.setTag(tag);
+		dispatchOther(trap);
+		dispatchOther(done);
+	}
+	if( !m_deadlines.isEmpty() )
+		m_timeoutTimer->start(int(qMax<qint64>(0, (m_deadlines.firstKey() - now() + 999) / 1000)));
+}
+
+/**
+ * @brief Comm::latency
+ * @param path The command path. For example "/interface/print"
+ * @return the latency histogram of commands with this path. Latency is
+ * measured from sending to !done. Timed out commands are not recorded.
+ */
+QLatencyHistogram Comm::latency(const QString &path) const
+{
+	return m_latency.value(path);
+}
+
+/**
+ * @brief Comm::sendCancel
+ * Asks router to stop a command. Router replies to the command with
+ * !trap and !done.
+ * @param tag The tag of command to cancel.
+ * @return tag used for /cancel sentence.
+ */
+QString Comm::sendCancel(const QString &tag)
+{
+	QSentence cancel("/cancel");
+	cancel.addAttribute("tag", tag);
+	return sendSentence(cancel);
+}
+
+QString Comm::sendSentence(const QString &cmd, const QString &tag, const QStringList &attrib)
+{
+	return sendSentence( QSentence(cmd, tag, attrib) );
+}
+
+/**
+ * @brief latin1Copy
+ * Copies a string as latin1 chars into dest.
+ * This avoids the temporary QByteArray created by QString::toLatin1()
+ * Chars out of latin1 range are replaced by '?', as toLatin1() does.
+ * This function is completly for internal use.
+ * @param dest Buffer to write to. Must have room for all string chars.
+ * @param s The string to copy.
+ * @return pointer to the byte just after last one written.
+ */
+static char *latin1Copy(char *dest, const QString &s)
+{
+	const QChar *src = s.constData();
+	for( int i = s.count(); i > 0; --i, ++src )
+		*dest++ = (src->unicode() > 0xFF) ? '?' : char(src->unicode());
+	return dest;
+}
+
+/**
+ * @brief Comm::appendWord
+ * Encodes a word into m_writeBuf.
+ * Word lenght is calculated and is encoded before word itself.
+ * @param word The word to encode.
+ * @return false if word is too long to be sent.
+ */
+bool Comm::appendWord(const QString &word)
+{
+	if( !appendWordCount(word.count()) )
+		return false;
+	int pos = m_writeBuf.count();
+	m_writeBuf.resize(pos + word.count());
+	latin1Copy(m_writeBuf.data() + pos, word);
+	return true;
+}
+
+/**
+ * @brief Comm::appendWord
+ * Encodes a "<prefix><name>=<value>" word into m_writeBuf without
+ * creating the full word string.
+ * As QBasicAttrib::toWord does, names starting by '!' and no value
+ * are encoded as "<prefix><name>".
+ * @param prefix The first character of the word. Usually '=' or '.'
+ * @param name The name part of the word.
+ * @param value The value part of the word. Can be empty.
+ * @return false if word is too long to be sent.
+ */
+bool Comm::appendWord(char prefix, const QString &name, const QString &value)
+{
+	bool noValue = value.isEmpty() && name.startsWith('!');
+	int len = 1 + name.count() + (noValue ? 0 : 1 + value.count());
+
+	if( !appendWordCount(len) )
+		return false;
+	int pos = m_writeBuf.count();
+	m_writeBuf.resize(pos + len);
+
+	char *p = m_writeBuf.data() + pos;
+	*p++ = prefix;
+	p = latin1Copy(p, name);
+	if( !noValue )
+	{
+		*p++ = '=';
+		latin1Copy(p, value);
+	}
+	return true;
+}
+
+/**
+ * @brief Comm::appendTagWord
+ * Encodes a ".tag=<tagID>" word into m_writeBuf directly from the
+ * numeric value, without creating any string.
+ * @param tagID The tag value. Must be >= 0.
+ * @return false if word cannot be encoded.
+ */
+bool Comm::appendTagWord(int tagID)
+{
+	char digits[12];
+	int n = 0;
+	do
+	{
+		digits[sizeof(digits) - ++n] = char('0' + (tagID % 10));
+		tagID /= 10;
+	}
+	while( tagID );
+
+	if( !appendWordCount(5 + n) )
+		return false;
+	m_writeBuf.append(".tag=", 5);
+	m_writeBuf.append(digits + sizeof(digits) - n, n);
+	return true;
+}
+
+/**
+ * @brief Comm::appendWord
+ * @overload
+ * Encodes a "<prefix><name>=<value>" word from latin1 chars.
+ * Bytes are copied as they are, with no conversion.
+ */
+bool Comm::appendWord(char prefix, QLatin1String name, QLatin1String value)
+{
+	bool noValue = !value.size() && name.size() && (name.data()[0] == '!');
+	int len = 1 + name.size() + (noValue ? 0 : 1 + value.size());
+
+	if( !appendWordCount(len) )
+		return false;
+	m_writeBuf.append(prefix);
+	m_writeBuf.append(name.data(), name.size());
+	if( !noValue )
+	{
+		m_writeBuf.append('=');
+		m_writeBuf.append(value.data(), value.size());
+	}
+	return true;
+}
+
+/**
+ * @brief Comm::appendAttributes
+ * Encodes all attributes into m_writeBuf.
+ * Names and values are copied directly from attributes arena.
+ * @param prefix The first character of every word. '=' for attributes
+ * and '.' for API attributes.
+ * @param attrib The attributes to encode.
+ * @return false if any word is too long to be sent.
+ */
+bool Comm::appendAttributes(char prefix, const QBasicAttrib &attrib)
+{
+	for( int i = 0; i < attrib.count(); i++ )
+		if( !appendWord(prefix, attrib.nameLatin1(i), attrib.valueLatin1(i)) )
+			return false;
+	return true;
+}
+
+/**
+ * @brief Comm::setComError
+ * sets lastCommError variable.
+ * If new error is not NoCommError and not the same as before,
+ * comError will be emited.
+ * @param ce The new error.
+ */
+void Comm::setComError(Comm::CommError ce)
+{
+	if( ce != NoCommError )
+	{
+		if( ce != lastCommError )
+			emit comError(lastCommError = ce, QAbstractSocket::UnknownSocketError);
+	}
+	else
+		lastCommError = ce;
+}
+
+/**
+ * @brief Comm::receiveWordCount
+ * Decodes the word length placed at m_readPos on m_readBuf.
+ * Only 4 bytes at most will be readed. In case of more bytes
+ * needed to read, connection will be closed.
+ * It a control byte is received, connection will be closed too.
+ * Nothing is consumed from m_readBuf. If length is incomplete, this
+ * function must be called again when socket receives more data.
+ * @param wordCount Variable to store the word length decoded.
+ * @return >0 the amount of bytes used by the length.
+ * <0 on protocol error. Socket is closed.
+ * == 0 no or incomplete data on m_readBuf.
+ */
+int Comm::receiveWordCount(int *wordCount)
+{
+	int avail = m_readBuf.count() - m_readPos;
+	if( avail <= 0 )
+		return 0;
+
+	const unsigned char *p = (const unsigned char*)m_readBuf.constData() + m_readPos;
+	unsigned char c = p[0];
+	int countSize;
+
+	// The first byte received from socket has allways coded with the
+	// amount of bytes used for word length.
+	if( (c & 0xF0) == 0xF0 )
+	{
+		setComError( ControlByteReceived );
+		dropConnection(true);
+		return -1;
+	}
+	if( (c & 0xE0) == 0xE0 )
+	{
+		countSize = 4;
+		c &= ~0xE0;
+	}
+	else
+	if( (c & 0xC0) == 0xC0 )
+	{
+		countSize = 3;
+		c &= ~0xC0;
+	}
+	else
+	if( (c & 0x80) == 0x80 )
+	{
+		countSize = 2;
+		c &= ~0x80;
+	}
+	else
+		countSize = 1;
+
+	if( avail < countSize )
+		return 0;
+
+	// Length is sent in network (big endian) order.
+	int count = c;
+	for( int i = 1; i < countSize; i++ )
+		count = (count << 8) | p[i];
+	*wordCount = count;
+	return countSize;
+}
+
+/**
+ * @brief Comm::receiveWord
+ * Takes the word placed at m_readPos on m_readBuf.
+ * Word bytes are not copied. Just his position is appended
+ * to m_incomingWords. Zero length words (end of sentence) are
+ * not appended.
+ * @param countSize The bytes used by word length (as returned by receiveWordCount)
+ * @param wordCount The word length.
+ * @return true if the full word is on m_readBuf. Otherwise, nothing is
+ * consumed and this function must be called again when socket receives
+ * more data.
+ */
+bool Comm::receiveWord(int countSize, int wordCount)
+{
+	int end = m_readPos + countSize + wordCount;
+	if( end > m_readBuf.count() )
+		return false;
+
+	if( wordCount )
+	{
+		m_incomingWords.append(QWordRef(m_readPos + countSize - m_sentenceStart, wordCount));
+		if( m_statsOn )
+			count(m_stats.wordsDecoded);
+	}
+	m_readPos = end;
+	return true;
+}
+
+/**
+ * @brief wantsAttribute
+ * @return true if name is on proplist.
+ */
+static bool wantsAttribute(const QList<QByteArray> &proplist, const char *name, int len)
+{
+	for( int i = 0; i < proplist.count(); i++ )
+	{
+		if( (proplist.at(i).count() == len) && !memcmp(proplist.at(i).constData(), name, len) )
+			return true;
+	}
+	return false;
+}
+
+/**
+ * @brief isRowKeyWord
+ * @return true if word is =.id= or =.dead=, never dropped from rows.
+ */
+static inline bool isRowKeyWord(const char *word, int len)
+{
+	return ((len >= 5) && !memcmp(word, "=.id=", 5)) || ((len >= 7) && !memcmp(word, "=.dead=", 7));
+}
+
+/**
+ * @brief Comm::projectWords
+ * Drops from m_incomingWords the attributes of a !re row not asked for
+ * on his command proplist (see QSentence::setProplist). Words are just
+ * unreferenced, so they are never decoded nor copied.
+ * Row .id and .dead are always kept, so listen deletions are still
+ * told apart from changes.
+ */
+void Comm::projectWords()
+{
+	if( m_inFlight.isEmpty() )
+	{
+		m_projecting = false;
+		return;
+	}
+	const char *base = m_readBuf.constData() + m_sentenceStart;
+	if( m_incomingWords.isEmpty() || (m_incomingWords.at(0).length != 3) || memcmp(base + m_incomingWords.at(0).offset, "!re", 3) )
+		return;
+
+	// Router sends tag as last word, so look for it backwards.
+	int i = m_incomingWords.count() - 1;
+	while( (i > 0) && !((m_incomingWords.at(i).length >= 5) && !memcmp(base + m_incomingWords.at(i).offset, ".tag=", 5)) )
+		i--;
+	if( i == 0 )
+		return;
+
+	const char *tagChars = base + m_incomingWords.at(i).offset + 5;
+	int tagLen = m_incomingWords.at(i).length - 5;
+	int tagID = QSentence::tagToID(tagChars, tagLen);
+	const InFlight *f = m_inFlight.find(tagID, (tagID < 0) ? QString::fromLatin1(tagChars, tagLen) : QString());
+	if( !f || f->proplist.isEmpty() )
+		return;
+
+	int kept = 1;
+	for( i = 1; i < m_incomingWords.count(); i++ )
+	{
+		const QWordRef &w = m_incomingWords.at(i);
+		const char *word = base + w.offset;
+		if( (w.length > 1) && (word[0] == '=') && !isRowKeyWord(word, w.length) )
+		{
+			const char *eq = (const char*)memchr(word + 1, '=', w.length - 1);
+			int nameLen = eq ? int(eq - word) - 1 : w.length - 1;
+			if( !wantsAttribute(f->proplist, word + 1, nameLen) )
+				continue;
+		}
+		m_incomingWords[kept++] = w;
+	}
+	m_incomingWords.resize(kept);
+}
+
+/**
+ * @brief Comm::decodeSentence
+ * Fills up incomingSentence with the words referenced by m_incomingWords.
+ */
+void Comm::decodeSentence()
+{
+	const char *base = m_readBuf.constData() + m_sentenceStart;
+	for( int i = 0; i < m_incomingWords.count(); i++ )
+	{
+		const QWordRef &w = m_incomingWords.at(i);
+		incomingSentence.addWord(base + w.offset, w.length);
+	}
+}
+
+/**
+ * @brief Comm::processSentence
+ * Called when a full sentence is received.
+ * If we are not loged into router, we'll try it.
+ * Otherwise, we emit comReceive (or comReceiveRaw on raw mode)
+ * to let app do his job. If decoding threads are enabled, sentence is
+ * just queued to be decoded by them.
+ */
+void Comm::processSentence()
+{
+	if( m_statsOn )
+		count(m_stats.sentencesDecoded);
+	if( m_loginState != LogedIn )
+	{
+		decodeSentence();
+		doLogin();
+		return;
+	}
+
+	if( m_projecting )
+		projectWords();
+	if( m_rawMode )
+	{
+		int tagID = -1;
+		QString tag;
+		QSharedPointer<TagRoute> route;
+		QRawSentence raw(m_readBuf, m_sentenceStart, m_incomingWords);
+		QSentence::Result result = raw.getResultType();
+		QString message = (result == QSentence::Trap) ? raw.attribute("message") : QString();
+
+		if( !m_routes.isEmpty() || ((result != QSentence::Reply) && !m_inFlight.isEmpty()) )
+		{
+			if( (tagID = raw.tagID()) < 0 )
+				tag = raw.tag();
+			if( !m_routes.isEmpty() )
+				route = m_routes.value(tagID, tag);
+		}
+
+		if( route.isNull() || m_broadcastAll )
+			emit comReceiveRaw(raw);
+		if( !route.isNull() )
+		{
+			decodeSentence();
+			deliver(*route, incomingSentence);
+		}
+		resetSentence();
+		finishReply(result, tagID, tag, route, message);
+	}
+	else
+	if( m_decodePool )
+	{
+		appendToChunk();
+		resetSentence();
+	}
+	else
+	{
+		decodeSentence();
+		dispatchSentence(incomingSentence);
+		resetSentence();
+	}
+}
+
+/**
+ * @brief Comm::dispatchSentence
+ * Emits comReceive or delivers to his tag route a decoded sentence.
+ * @param s The sentence. Must be incomingSentence, so takeSentence works.
+ */
+void Comm::dispatchSentence(QSentence &s)
+{
+	int tagID;
+	QString tag;
+	QSharedPointer<TagRoute> route;
+	QSentence::Result result = s.getResultType();
+
+	if( (tagID = s.tagID()) < 0 )
+		tag = s.tag();
+	if( !m_routes.isEmpty() )
+		route = m_routes.value(tagID, tag);
+
+	if( route.isNull() || m_broadcastAll )
+		emit comReceive(s);
+	if( !route.isNull() )
+		deliver(*route, s);
+	finishReply(result, tagID, tag, route, (result == QSentence::Trap) ? s.attribute("message") : QString());
+}
+
+/**
+ * @brief Comm::dispatchOther
+ * Delivers a sentence not decoded into incomingSentence.
+ * Sentence is swapped into incomingSentence to be delivered, so
+ * takeSentence works as usual. Must not be called while processing
+ * an incoming sentence.
+ * @param s The sentence.
+ */
+void Comm::dispatchOther(QSentence &s)
+{
+	incomingSentence.swap(s);
+	dispatchSentence(incomingSentence);
+	incomingSentence.swap(s);
+}
+
+/**
+ * @brief Comm::finishReply
+ * Updates routes and in-flight table once a reply is delivered.
+ * @param result The reply result type.
+ * @param tagID The reply numeric tag. If < 0, tag is used.
+ * @param tag The reply tag.
+ * @param route The route the reply was delivered to. Can be null.
+ * @param message The !trap message.
+ */
+void Comm::finishReply(QSentence::Result result, int tagID, const QString &tag, const QSharedPointer<TagRoute> &route, const QString &message)
+{
+	// Command is finished. No more replies will come with this tag.
+	if( (result == QSentence::Done) && !route.isNull() && (m_routes.value(tagID, tag) == route) )
+		m_routes.remove(tagID, tag);
+	if( (result != QSentence::Reply) && ((tagID >= 0) || !tag.isEmpty()) && !m_inFlight.isEmpty() )
+		trackReply(tagID, tag, result, message);
+}
+
+/**
+ * @brief The Comm::DecodeTask class
+ * Decodes a chunk of framed sentences on a worker thread.
+ * Sentences are decoded without name table, as it belongs to Comm
+ * thread. Names are interned later, when sentences are delivered.
+ */
+class Comm::DecodeTask : public QRunnable
+{
+	Comm *m_comm;
+	QSharedPointer<DecodeChunk> m_chunk;
+
+public:
+	DecodeTask(Comm *comm, const QSharedPointer<DecodeChunk> &chunk) : m_comm(comm), m_chunk(chunk) { }
+	void run()
+	{
+		const char *base = m_chunk->data.constData();
+		int w = 0;
+		for( int i = 0; i < m_chunk->ends.count(); i++ )
+		{
+			QSentence s;
+			for( ; w < m_chunk->ends.at(i); w++ )
+				s.addWord(base + m_chunk->words.at(w).offset, m_chunk->words.at(w).length);
+			m_chunk->sentences.append(s);
+		}
+		m_chunk->decoded.storeRelease(1);
+		m_comm->postCollect();
+	}
+};
+
+/**
+ * @brief Comm::setDecodeThreads
+ * Enables decoding received sentences on a pool of worker threads.
+ * Comm thread just frames sentences (that must be done in order) and
+ * sends them to workers in chunks. Decoded chunks are delivered back on
+ * Comm thread in the same order they were received.
+ * Raw mode and login don't use workers.
+ * Note that stream windows (see streamSentence) can be exceeded by the
+ * sentences already sent to workers when reading is paused.
+ * @param threads The amount of worker threads. 0 to decode on Comm thread.
+ */
+void Comm::setDecodeThreads(int threads)
+{
+	if( threads > 0 )
+	{
+		if( !m_decodePool )
+			m_decodePool = new QThreadPool;
+		m_decodePool->setMaxThreadCount(threads);
+	}
+	else
+	if( m_decodePool )
+	{
+		submitChunk();
+		m_decodePool->waitForDone();
+		collectDecoded();
+		delete m_decodePool;
+		m_decodePool = NULL;
+	}
+}
+
+/**
+ * @brief Comm::decodeThreads
+ * @return the amount of decoding worker threads. 0 if sentences are
+ * decoded on Comm thread.
+ */
+int Comm::decodeThreads() const
+{
+	return m_decodePool ? m_decodePool->maxThreadCount() : 0;
+}
+
+/**
+ * @brief Comm::appendToChunk
+ * Copies incoming sentence bytes and words positions to the chunk
+ * being framed. Chunk is sent to workers when it's big enough.
+ */
+void Comm::appendToChunk()
+{
+	if( m_chunk.isNull() )
+		m_chunk = QSharedPointer<DecodeChunk>(new DecodeChunk);
+
+	int base = m_chunk->data.count();
+	m_chunk->data.append(m_readBuf.constData() + m_sentenceStart, m_readPos - m_sentenceStart);
+	for( int i = 0; i < m_incomingWords.count(); i++ )
+	{
+		const QWordRef &w = m_incomingWords.at(i);
+		m_chunk->words.append(QWordRef(base + w.offset, w.length));
+	}
+	m_chunk->ends.append(m_chunk->words.count());
+
+	if( m_chunk->ends.count() >= 256 )
+		submitChunk();
 }
 
 /**
- * @brief Comm::resetWord
- * Resets incomingWord and all variables used to receive the words from
- * router.
- * Call this function just after using new word received to allow
- * reveiving a new one.
+ * @brief Comm::submitChunk
+ * Sends the chunk being framed to workers.
  */
-void Comm::resetWord()
+void Comm::submitChunk()
 {
-	incomingWord.clear();
-	incomingWordSize = -1;
-	incomingWordPos = 0;
-	incomingWordCount = -1;
-	int *i = (int*)wordCountBuf;
-	(*i) = 0;
+	if( m_chunk.isNull() || !m_decodePool )
+		return;
+	m_decodeQueue.enqueue(m_chunk);
+	m_decodePool->start(new DecodeTask(this, m_chunk));
+	m_chunk.clear();
 }
 
 /**
- * @brief Comm::resetSentence
- * Resets incomingSentence and all variables used to receive
- * the sentence from router.
- * Call this function just after using the sentence to allow
- * receiving a new one.
+ * @brief Comm::postCollect
+ * Called by workers. Posts a collectDecoded call to Comm thread,
+ * unless one is already pending.
  */
-void Comm::resetSentence()
+void Comm::postCollect()
 {
-	resetWord();
-	incomingSentence.clear();
+	if( m_collectPosted.testAndSetOrdered(0, 1) )
+		QMetaObject::invokeMethod(this, "collectDecoded", Qt::QueuedConnection);
 }
 
 /**
- * @brief Comm::writeSentence
- * Sends a full sentence.
- * If there is no tag provided in sentence info, a unique one
- * is created to send to and returned.
- * @param sent Sentence class with the info to sent to Router.
- * @param sendTag (Optional, default==true) Tells function to use (or,
- * eventually create and use) a tag for sentence to sent.
- * @return tag used for sentence.
+ * @brief Comm::collectDecoded
+ * Delivers decoded chunks in order. Stops at the first chunk not
+ * decoded yet, even if next ones are.
+ * @see dispatchOther
  */
-QString Comm::sendSentence(const QSentence &sent, bool sendTag)
+void Comm::collectDecoded()
 {
-	static int ID = 0;
-	QString word;
-
-	sendWord(sent.command());
-	if( !sent.getID().isEmpty() )
-		sendWord(QString("=.id=%1").arg(sent.getID()));
-	foreach( word, sent.attributes().toWords() )
-		sendWord(word);
-	foreach( word, sent.APIattributes().toWords() )
-		sendWord(word);
-	foreach( word, sent.queries().toWords() )
-		sendWord(word);
-
-	if( sendTag )
+	m_collectPosted.storeRelease(0);
+	while( !m_decodeQueue.isEmpty() && m_decodeQueue.head()->decoded.loadAcquire() )
 	{
-		word = sent.tag();
-		if( word.isEmpty() )
-			word = QString("%1").arg(++ID);
-		sendWord(QString(".tag=%1").arg(word));
+		QSharedPointer<DecodeChunk> chunk = m_decodeQueue.dequeue();
+		for( int i = 0; i < chunk->sentences.count(); i++ )
+		{
+			QSentence &s = chunk->sentences[i];
+			s.setNameTable(m_names);
+			s.internNames();
+			dispatchOther(s);
+		}
 	}
-	else
-		word.clear();
-	sendWord("");
-	return word;
 }
 
 /**
- * @brief Comm::sendSentence
- * Sends a new sentence.
- * This is a convenient function. Internally, just calls sendSentence(const QSentence&, bool)
- * @overload
- * @see sendSentence(const QSentence&, bool);
+ * @brief Comm::takeSentence
+ * Takes ownership of the sentence being delivered.
+ * Call this function from a comReceive slot (or a tag handler) to keep
+ * the sentence without copying it. Sentence data is moved out and
+ * Comm goes on with a recycled one from his pool. After this call,
+ * the sentence reference received on the slot is empty.
+ * @return the sentence received.
+ * @see recycleSentence
  */
-QString Comm::sendSentence(const QString &cmd, bool sendTag, const QStringList &attrib)
+QSentence Comm::takeSentence()
 {
-	return sendSentence( QSentence(cmd, QString(), attrib), sendTag );
+	if( m_statsOn && !m_pool.freeCount() )
+		count(m_stats.poolMisses);
+	QSentence s = m_pool.acquire();
+	s.swap(incomingSentence);
+	return s;
 }
 
-QString Comm::sendCancel(const QString &tag)
+/**
+ * @brief Comm::deliver
+ * Delivers a sentence to his tag handler or receiver.
+ * @param route Where to deliver the sentence.
+ * @param s The sentence received.
+ */
+void Comm::deliver(const Comm::TagRoute &route, QSentence &s)
 {
-	return sendSentence( QSentence("/cancel", tag) );
+	if( route.handler )
+		route.handler(s);
+	else
+	if( !route.receiver.isNull() )
+		QMetaObject::invokeMethod(route.receiver.data(), route.member.constData(),
+								  Qt::DirectConnection, Q_ARG(ROS::QSentence&, s));
 }
 
-QString Comm::sendSentence(const QString &cmd, const QString &tag, const QStringList &attrib)
+/**
+ * @brief Comm::setTagHandler
+ * Routes all sentences received with the tag to a function.
+ * These sentences are not emited through comReceive anymore (unless
+ * setBroadcastAll(true) is called). Routes are looked up by tag on a
+ * hash table, so having many routes doesn't slow down the others.
+ * Route is automatically removed when command !done is received.
+ * @param tag The tag to route.
+ * @param handler The function to call for every sentence with this tag.
+ */
+void Comm::setTagHandler(const QString &tag, const Comm::ReplyHandler &handler)
 {
-	return sendSentence( QSentence(cmd, tag, attrib) );
+	QSharedPointer<TagRoute> route(new TagRoute);
+	route->handler = handler;
+	m_routes.insert(tag, route);
 }
 
 /**
- * @brief Comm::sendWord
- * Sends a word to router.
- * Word lenght is calculated and is sended before word itself.
- * @param word
+ * @brief Comm::setTagReceiver
+ * Routes all sentences received with the tag to a receiver object slot.
+ * The slot is called directly and must have a "(ROS::QSentence &)" signature.
+ * If receiver is destroyed, sentences are discarded until route is removed.
+ * @param tag The tag to route.
+ * @param receiver The object that will receive sentences.
+ * @param member The slot name, without signature. For example "onReply"
+ * @see setTagHandler
  */
-void Comm::sendWord(const QString &word)
+void Comm::setTagReceiver(const QString &tag, QObject *receiver, const char *member)
 {
-	sendWordCount( word.count() );
-	m_sock.write( word.toLatin1() );
+	QSharedPointer<TagRoute> route(new TagRoute);
+	route->receiver = receiver;
+	route->member = member;
+	m_routes.insert(tag, route);
 }
 
 /**
- * @brief Comm::setComError
- * sets lastCommError variable.
- * If new error is not NoCommError and not the same as before,
- * comError will be emited.
- * @param ce The new error.
+ * @brief Comm::removeTagHandler
+ * Removes the route for a tag. Next sentences with this tag will
+ * be emited through comReceive.
+ * @param tag The tag to remove.
  */
-void Comm::setComError(Comm::CommError ce)
+void Comm::removeTagHandler(const QString &tag)
 {
-	if( ce != NoCommError )
+	m_routes.remove(tag);
+}
+
+/**
+ * @brief Comm::trackReply
+ * Updates in-flight table with a reply received from ROS.
+ * !trap marks the command as failed. !done finishes it.
+ * @param tagID The reply numeric tag. If < 0, tag is used.
+ * @param tag The reply tag.
+ * @param result The reply result type.
+ * @param message The !trap message. Only the first one is kept.
+ */
+void Comm::trackReply(int tagID, const QString &tag, QSentence::Result result, const QString &message)
+{
+	InFlight *f = m_inFlight.find(tagID, tag);
+	if( !f )
+		return;
+
+	switch( result )
 	{
-		if( ce != lastCommError )
-			emit comError(lastCommError = ce, QAbstractSocket::UnknownSocketError);
+	case QSentence::Trap:
+		if( f->result != QSentence::Timeout )
+			f->result = QSentence::Trap;
+		if( f->message.isEmpty() )
+			f->message = message;
+		break;
+	case QSentence::Done:
+	{
+		InFlight done = *f;
+		m_inFlight.remove(tagID, tag);
+		if( done.result != QSentence::Timeout )
+			m_latency[done.path].record(now() - done.sentAt);
+		finishCommand((tagID >= 0) ? QString::number(tagID) : tag, done);
+		break;
+	}
+	default:
+		break;
 	}
-	else
-		lastCommError = ce;
 }
 
 /**
- * @brief Comm::receiveWordCount
- * Reads the word length from socket.
- * Lenngth readed is stored on incomingWordCount variable.
- * Only 4 bytes at most will be readed from socket. In case of more bytes
- * needed to read, connection will be closed.
- * It a control byte is received, connection will be closed too.
- * @return >0 if length was readed succefully.
- * <0 on socket error. Socket shall be closed as soon as possible.
- * == 0 no or incomplete data readed from socket. In this case, this function must be
- * called again when socket receives more data.
+ * @brief Comm::finishCommand
+ * Emits commandFinished for a command no longer in-flight and,
+ * if it was the last one of his batch, batchFinished.
+ * @param tag The command tag.
+ * @param f The in-flight info of the command.
  */
-int Comm::receiveWordCount()
+void Comm::finishCommand(const QString &tag, const Comm::InFlight &f)
 {
-	unsigned char c;
-	int i = m_sock.read((char*)&c, 1);
-	if( i <= 0 )
-		return i;
+	emit commandFinished(f.batch, tag, f.result);
 
-	// The first byte received from socket has allways coded with the
-	// amount of bytes used for word length.
-	// So, if is the first byte, let's see how many bytes we need to read
-	// to know exactly the word length.
-	if( incomingWordPos == 0 )
+	if( f.bulkRow >= 0 )
+		finishBulkRow(f);
+	else
+	if( f.batch )
 	{
-		if( c >= 0xF8 )
-		{
-			setComError( ControlByteReceived );
-			closeCom(true);
-		}
-		if( (c & 0xF0) == 0xF0 )
-		{
-			setComError( ControlByteReceived );
-			closeCom(true);
-		}
-		if( (c & 0xE0) == 0xE0 )
-		{
-			incomingWordSize = 4;
-			c &= ~0xE0;
-		}
-		else
-		if( (c & 0xC0) == 0xC0 )
+		QHash<int, Batch>::iterator it = m_batches.find(f.batch);
+		if( it == m_batches.end() )
+			return;
+		if( f.result != QSentence::Done )
+			it.value().errors++;
+		if( --it.value().pending <= 0 )
 		{
-			incomingWordSize = 3;
-			c &= ~0xC0;
+			int errors = it.value().errors;
+			m_batches.erase(it);
+			emit batchFinished(f.batch, errors);
 		}
+	}
+}
+
+/**
+ * @brief Comm::abortInFlight
+ * Finishes all in-flight commands as Fatal.
+ * Called when connection is lost as no reply will come for them.
+ * @param keep true to keep the commands that will be sent after
+ * reconnecting: the ones on login queue and the replayable ones.
+ */
+void Comm::abortInFlight(bool keep)
+{
+	QList< QPair<QString, InFlight> > lost = m_inFlight.takeAll();
+
+	for( int i = 0; i < lost.count(); i++ )
+	{
+		const InFlight &f = lost.at(i).second;
+		if( keep && (f.queued || !f.sent.command().isEmpty()) )
+			m_inFlight.insert(lost.at(i).first, f);
 		else
-		if( (c & 0x80) == 0x80 )
 		{
-			incomingWordSize = 2;
-			c &= ~0x80;
+			lost[i].second.result = QSentence::Fatal;
+			finishCommand(lost.at(i).first, lost.at(i).second);
 		}
-		else
-			incomingWordSize = 1;
-	}
-	wordCountBuf[incomingWordPos] = c;
-	if( incomingWordSize == ++incomingWordPos )
-	{
-#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
-		incomingWordCount = 0;
-		for( int i = 0; i < incomingWordSize; i++ )
-			((char*)&incomingWordCount)[i] = wordCountBuf[(incomingWordSize-1)-i];
-#else
-		((char*)&incomingWordCount)[0] = wordCountBuf[3];
-		((char*)&incomingWordCount)[1] = wordCountBuf[2];
-		((char*)&incomingWordCount)[2] = wordCountBuf[1];
-		((char*)&incomingWordCount)[3] = wordCountBuf[0];
-#endif
 	}
-	return 1;
+	if( m_inFlight.isEmpty() )
+	{
+		m_deadlines.clear();
+		m_timeoutTimer->stop();
+	}
 }
 
 /**
- * @brief Comm::receiveWord
- * Reads word from socket.
- * This functions uses incomingWordCount (filled by receiveWordCount)
- * to know how many bytes needs to read from socket.
- * This functions mus be called until incomingWordCount == incomingWord.count()
- * Here there is no control if socket is closed. There is no problem with this.
- * But, we must check if socket is open before calling this function.
- * @return bytes readed from socket.
+ * @brief Comm::keepRoutes
+ * Removes the routes of commands no longer in-flight.
+ * Called when connection is lost.
  */
-int Comm::receiveWord()
+void Comm::keepRoutes()
 {
-	int remain = incomingWordCount-incomingWord.count();
+	QList< QPair<QString, QSharedPointer<TagRoute> > > all = m_routes.takeAll();
 
-	Q_ASSERT_X(remain > 0, "receiveWord()", "negative word count remain calculated!");
+	for( int i = 0; i < all.count(); i++ )
+		if( m_inFlight.contains(all.at(i).first) )
+			m_routes.insert(all.at(i).first, all.at(i).second);
+}
 
-	if( remain )
-	{
-		QByteArray tmp = m_sock.read(remain);
-		if( tmp.count() )
-			incomingWord.append(tmp);
-		return tmp.count();
-	}
-	return 0;
+/**
+ * @brief Comm::setAutoReconnect
+ * Reconnects automatically when connection is lost, unless closeCom
+ * was called or login was refused.
+ * Delay between attempts grows exponentially from minMs to maxMs and is
+ * randomized, so a fleet of connections lost at once doesn't reconnect
+ * at once.
+ * @param reconnect true to enable reconnecting.
+ * @param minMs Delay before first attempt.
+ * @param maxMs Max delay between attempts.
+ */
+void Comm::setAutoReconnect(bool reconnect, int minMs, int maxMs)
+{
+	m_autoReconnect = reconnect;
+	m_reconnectMin = qMax(1, minMs);
+	m_reconnectMax = qMax(m_reconnectMin, maxMs);
+	if( !reconnect )
+		m_reconnectTimer->stop();
+}
+
+/**
+ * @brief Comm::scheduleReconnect
+ * Starts reconnect timer. Delay is minMs * 2^attempt, up to maxMs,
+ * and a random value between its half and itself is used.
+ */
+void Comm::scheduleReconnect()
+{
+	qint64 delay = qint64(m_reconnectMin) << qMin(m_reconnectAttempt, 20);
+	if( delay > m_reconnectMax )
+		delay = m_reconnectMax;
+	int half = int(delay / 2);
+	int ms = half + QRandomGenerator::global()->bounded(int(delay) - half + 1);
+
+	m_reconnectAttempt++;
+	m_reconnectTimer->start(ms);
+	emit reconnectScheduled(m_reconnectAttempt, ms);
+}
+
+/**
+ * @brief Comm::onReconnectTimer
+ * Slot connected to reconnect timer.
+ */
+void Comm::onReconnectTimer()
+{
+	if( m_wantConnected && (m_sock->state() == QAbstractSocket::UnconnectedState) )
+		connectToROS();
 }
 
 /**
  * @brief Comm::receiveSentence
  * Slot called when data is ready to be read from socket connected to ROS.
- * This function fills up an internal QSentence struct. Once QSentence is
- * filled, at begining, this function is used to login. When login is done,
- * this function emits "comReceive(QSentence)" to allow application to
- * do his job with the sentence sended by ROS.
+ * All data available on socket is pulled at once into m_readBuf and then
+ * decoded word by word.
+ * Words are not copied while sentence is incomplete. Only his positions
+ * into m_readBuf are stored, and the bytes are kept there until all
+ * sentence is received.
+ * Nothing is read while a stream consumer is behind (see pauseReading).
  */
 void Comm::receiveSentence()
 {
-	while( m_sock.state() == QAbstractSocket::ConnectedState )
+	QElapsedTimer parse;
+	if( m_statsOn )
+		parse.start();
+	if( m_pausedStreams || !readSocket() )
+		return;
+
+	int wordCount;
+	int countSize;
+	while( !m_pausedStreams && (m_sock->state() == QAbstractSocket::ConnectedState) )
 	{
-		if( incomingWordCount == -1 )
-			if( receiveWordCount() <= 0 )
-				break;
+		if( (countSize = receiveWordCount(&wordCount)) <= 0 )
+			break;
 
-		if( incomingWordCount > incomingWord.count() )
-			if( !receiveWord() )
-				break;
+		if( !receiveWord(countSize, wordCount) )
+			break;
 
-		// Check if the word is all received.
-		if( incomingWordCount == incomingWord.count() )
-		{
-			// If == 0 means "end of sentence"
-			// So, we need to process it.
-			// If we are not loged into router, we'll try it.
-			// Otherwise, we emit comReceive to let app do his job.
-			if( incomingWordCount == 0 )
-			{
-				if( m_loginState != LogedIn )
-					doLogin();
-				else
-				{
-					emit comReceive(incomingSentence);
-					resetSentence();
-				}
-			}
-			else
-			{
-				incomingSentence.addWord(QString::fromLatin1(incomingWord));
-				resetWord();
-			}
-		}
+		// If == 0 means "end of sentence"
+		if( wordCount == 0 )
+			processSentence();
+	}
+	// Don't keep sentences framed waiting for more data.
+	submitChunk();
+
+	if( m_statsOn )
+	{
+		quint64 ns = quint64(parse.nsecsElapsed());
+		count(m_stats.readyReads);
+		count(m_stats.parseNsecs, ns);
+		if( ns > m_stats.maxParseNsecs.load() )
+			m_stats.maxParseNsecs.storeRelease(ns);
+		updatePending();
 	}
 }
 
+/**
+ * @brief Comm::setStatsEnabled
+ * Enables or disables the hot path counters. While disabled, counters
+ * are left as they are and cost just a flag check.
+ * Call it on Comm thread.
+ * @param enabled true to update counters.
+ * @param intervalMs If > 0, statsUpdated is emited periodically with
+ * this interval while enabled.
+ * @see stats
+ */
+void Comm::setStatsEnabled(bool enabled, int intervalMs)
+{
+	m_statsOn = enabled;
+	if( enabled && (intervalMs > 0) )
+		m_statsTimer->start(intervalMs);
+	else
+		m_statsTimer->stop();
+}
+
+/**
+ * @brief Comm::stats
+ * Takes a snapshot of counters. Can be called from any thread, but
+ * then counters may be taken in the middle of a readyRead.
+ * @return the counters.
+ */
+Comm::Stats Comm::stats() const
+{
+	Stats st;
+	st.bytesIn = m_stats.bytesIn.loadAcquire();
+	st.bytesOut = m_stats.bytesOut.loadAcquire();
+	st.wordsDecoded = m_stats.wordsDecoded.loadAcquire();
+	st.sentencesDecoded = m_stats.sentencesDecoded.loadAcquire();
+	st.socketReads = m_stats.socketReads.loadAcquire();
+	st.socketWrites = m_stats.socketWrites.loadAcquire();
+	st.readyReads = m_stats.readyReads.loadAcquire();
+	st.parseNsecs = m_stats.parseNsecs.loadAcquire();
+	st.maxParseNsecs = m_stats.maxParseNsecs.loadAcquire();
+	st.poolMisses = m_stats.poolMisses.loadAcquire();
+	st.bytesToRead = m_stats.bytesToRead.loadAcquire();
+	st.bytesToWrite = m_stats.bytesToWrite.loadAcquire();
+	return st;
+}
+
+/**
+ * @brief Comm::resetStats
+ * Sets all counters to zero. Call it on Comm thread.
+ */
+void Comm::resetStats()
+{
+	m_stats.bytesIn.storeRelease(0);
+	m_stats.bytesOut.storeRelease(0);
+	m_stats.wordsDecoded.storeRelease(0);
+	m_stats.sentencesDecoded.storeRelease(0);
+	m_stats.socketReads.storeRelease(0);
+	m_stats.socketWrites.storeRelease(0);
+	m_stats.readyReads.storeRelease(0);
+	m_stats.parseNsecs.storeRelease(0);
+	m_stats.maxParseNsecs.storeRelease(0);
+	m_stats.poolMisses.storeRelease(0);
+	updatePending();
+}
+
+/**
+ * @brief Comm::updatePending
+ * Updates the counters of bytes waiting on socket and read buffer.
+ * Socket can only be asked on Comm thread.
+ */
+void Comm::updatePending()
+{
+	m_stats.bytesToRead.storeRelease(m_sock->bytesAvailable() + (m_readBuf.count() - m_readPos));
+	m_stats.bytesToWrite.storeRelease(m_sock->bytesToWrite());
+}
+
+/**
+ * @brief Comm::onStatsTimer
+ * Slot connected to stats timer. Emits statsUpdated.
+ */
+void Comm::onStatsTimer()
+{
+	updatePending();
+	emit statsUpdated(stats());
+}
+
 /**
  * @brief ROS::Comm::connectTo
  * Starts connection to ROS at the addres addr and port.
@@ -355,8 +2089,9 @@ void Comm::receiveSentence()
  */
 void ROS::Comm::connectToROS()
 {
-	if( m_sock.state() == QAbstractSocket::UnconnectedState )
+	if( m_sock->state() == QAbstractSocket::UnconnectedState )
 	{
+		m_wantConnected = true;
 		if( m_addr.isEmpty() )
 			setComError( NoRemoteHostProvided );
 		else
@@ -368,7 +2103,21 @@ void ROS::Comm::connectToROS()
 		else
 		{
 			setComError( NoCommError );
-			m_sock.connectToHost(m_addr, m_port);
+#ifndef QT_NO_SSL
+			if( m_transport == SslTransport )
+			{
+				// Resumes last TLS session, if any, to skip the full handshake.
+				QSslSocket *ssl = static_cast<QSslSocket*>(m_sock);
+				QSslConfiguration conf = ssl->sslConfiguration();
+				conf.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+				if( !m_sslSession.isEmpty() )
+					conf.setSessionTicket(m_sslSession);
+				ssl->setSslConfiguration(conf);
+				ssl->connectToHostEncrypted(m_addr, m_port);
+			}
+			else
+#endif
+				m_sock->connectToHost(m_addr, m_port);
 		}
 	}
 }
@@ -384,23 +2133,49 @@ void ROS::Comm::connectToROS()
  * force the closing.
  */
 void Comm::closeCom(bool force)
+{
+	m_wantConnected = false;
+	m_reconnectTimer->stop();
+	if( m_sock->state() == QAbstractSocket::UnconnectedState )
+	{
+		// Waiting to reconnect. Nothing will be sent anymore.
+		m_loginQueue.clear();
+		abortInFlight(false);
+		abortBulks(false);
+		m_routes.clear();
+	}
+	dropConnection(force);
+}
+
+/**
+ * @brief Comm::dropConnection
+ * Closes connection as closeCom does, but connection is restored if
+ * auto reconnect is enabled. Used on protocol errors.
+ * @param force true to discard pending data.
+ */
+void Comm::dropConnection(bool force)
 {
 	if( isConnected() || isConnecting() )
 	{
 		if( force || isConnecting() )
 		{
-			m_sock.abort();
-			m_sock.close();
+			m_sock->abort();
+			m_sock->close();
 		}
 		else
-			m_sock.disconnectFromHost();
+			m_sock->disconnectFromHost();
 	}
 	resetSentence();
+	resetReadBuffer();
 }
+
 /**
  * @brief Comm::doLogin
  * Tries to log into ROS.
- * It uses a MD5 encoding process using the challenge reported by ROS.
+ * With PlainLogin, user and password were sent with the first /login
+ * sentence and a !done finishes the login. If router replies with a
+ * challenge (older than 6.43), MD5 response is sent as ChallengeLogin
+ * does.
  * If there is some error, lastError is set and connection is closed.
  * This function will be called when data is present into socket until
  * a succefull login is performed.
@@ -426,44 +2201,208 @@ void Comm::doLogin()
 			closeCom();
 			break;
 		}
-		if( !incomingSentence.attribute("ret").count() )
+		int ret = incomingSentence.attributes().indexOf("ret", 3);
+		if( (ret == -1) || !incomingSentence.attributes().valueLatin1(ret).size() )
 		{
 			setComError( LogingSentenceNoRet );
 			closeCom();
 			break;
 		}
-		if( incomingSentence.attribute("ret").count() != 32 )
+		if( incomingSentence.attributes().valueLatin1(ret).size() != 32 )
 		{
 			setComError( LogingSentenceRet32 );
 			closeCom();
 			break;
 		}
-
-		sendSentence("/login", false,
-							 QStringList() << QString("=name=%1").arg(m_Username)
-										<< QString("=response=00%1").arg(QMD5::encode(m_Password, incomingSentence.attribute("ret"))));
+		sendChallengeResponse(incomingSentence.attributes().valueLatin1(ret));
 		resetSentence();
 		setLoginState(UserPassSended);
 		break;
 	}
 	case UserPassSended:
-		if( incomingSentence.getResultType() == QSentence::Done )
-		{
-			resetSentence();
-			setLoginState(LogedIn);
-		}
-		else
+	{
+		if( incomingSentence.getResultType() != QSentence::Done )
 		{
 			setComError( LogingBadUsername );
 			closeCom();
+			break;
+		}
+		// Plain login on a router that just knows challenge one.
+		int ret = incomingSentence.attributes().indexOf("ret", 3);
+		if( ret != -1 )
+		{
+			if( m_challengeSent || (incomingSentence.attributes().valueLatin1(ret).size() != 32) )
+			{
+				setComError( LogingSentenceRet32 );
+				closeCom();
+				break;
+			}
+			sendChallengeResponse(incomingSentence.attributes().valueLatin1(ret));
+			resetSentence();
+			break;
 		}
+		resetSentence();
+		m_reconnectAttempt = 0;
+		replayInFlight();
+		flushLoginQueue();
+		setLoginState(LogedIn);
+		// Bulks waiting for login. Their rows need LogedIn state to be sent.
+		QList<int> bulks = m_bulks.keys();
+		for( int i = 0; i < bulks.count(); i++ )
+			pumpBulk(bulks.at(i));
 		break;
+	}
 	case LogedIn:
 		Q_ASSERT_X( 0, "doLogin()", "Trying to login when we are already loged" );
 		break;
 	}
 }
 
+/**
+ * @brief Comm::sendLogin
+ * Sends a login sentence right now, skipping the login queue.
+ * @param sent The login sentence.
+ */
+void Comm::sendLogin(const QSentence &sent)
+{
+	if( !encodeSentence(sent, -1, QString()) )
+	{
+		setComError( WordToSendTooLong );
+		closeCom(true);
+		return;
+	}
+	flushWriteBuffer();
+}
+
+/**
+ * @brief Comm::sendChallengeResponse
+ * Sends the MD5 response to the router login challenge.
+ * @param challenge The "ret" value sent by router.
+ */
+void Comm::sendChallengeResponse(QLatin1String challenge)
+{
+	QSentence login("/login");
+	login.addAttribute("name", m_Username);
+	login.addAttribute("response", QString::fromLatin1("00" + QMD5::encode(m_Password.toLatin1(), challenge.data(), challenge.size())));
+	m_challengeSent = true;
+	sendLogin(login);
+}
+
+/**
+ * @brief Comm::flushLoginQueue
+ * Sends all sentences queued while logging in with a single write.
+ * Called once login is done, just before emiting loginStateChanged, so
+ * they are sent before the ones app sends from there.
+ */
+void Comm::flushLoginQueue()
+{
+	QList<Outgoing> queue;
+	queue.swap(m_loginQueue);
+	for( int i = 0; i < queue.count(); i++ )
+	{
+		const Outgoing &o = queue.at(i);
+		if( !encodeSentence(o.sent, o.tagID, o.tag) )
+		{
+			flushWriteBuffer();
+			setComError( WordToSendTooLong );
+			dropConnection(true);
+			return;
+		}
+		if( InFlight *f = m_inFlight.find(o.tagID, o.tag) )
+		{
+			f->queued = false;
+			f->sentAt = now();
+		}
+		if( m_writeBuf.count() >= 0x10000 )
+			flushWriteBuffer();
+	}
+	flushWriteBuffer();
+}
+
+/**
+ * @brief Comm::replayInFlight
+ * Sends again, with the same tags, the sentences kept on in-flight
+ * table when connection was lost. Called once login is done again.
+ * Replies already delivered before connection was lost are delivered
+ * again for them.
+ * Commands with a deadline get it again, counted from the replay, as
+ * they don't time out while waiting to be replayed.
+ */
+void Comm::replayInFlight()
+{
+	QList< QPair<QString, InFlight> > all = m_inFlight.takeAll();
+
+	for( int i = 0; i < all.count(); i++ )
+	{
+		const QString &tag = all.at(i).first;
+		InFlight &f = all[i].second;
+		int tagID = QSentence::tagToID(tag);
+		if( !f.queued && !f.sent.command().isEmpty() )
+		{
+			qint64 timeout = f.deadline ? (f.deadline - f.sentAt) : 0;
+			f.result = QSentence::Done;
+			f.sentAt = now();
+			encodeSentence(f.sent, tagID, (tagID >= 0) ? QString() : tag);
+			if( timeout )
+			{
+				f.deadline = f.sentAt + timeout;
+				addDeadline(f.deadline, tag);
+			}
+		}
+		m_inFlight.insert(tagID, tag, f);
+	}
+	flushWriteBuffer();
+}
+
+/**
+ * @brief Comm::startLogin
+ * Sends the first login sentence once transport is ready.
+ */
+void Comm::startLogin()
+{
+	m_challengeSent = false;
+	if( m_loginMethod == PlainLogin )
+	{
+		QSentence login("/login");
+		login.addAttribute("name", m_Username);
+		login.addAttribute("password", m_Password);
+		sendLogin(login);
+		setLoginState(UserPassSended);
+	}
+	else
+	{
+		sendLogin( QSentence("/login") );
+		setLoginState(LoginRequested);
+	}
+}
+
+#ifndef QT_NO_SSL
+/**
+ * @brief Comm::onEncrypted
+ * Slot connected to QSslSocket::encrypted signal.
+ * Keeps the TLS session for next connections and starts login.
+ */
+void Comm::onEncrypted()
+{
+	QByteArray ticket = static_cast<QSslSocket*>(m_sock)->sslConfiguration().sessionTicket();
+	if( !ticket.isEmpty() )
+		m_sslSession = ticket;
+	startLogin();
+}
+
+/**
+ * @brief Comm::onSslErrors
+ * Slot connected to QSslSocket::sslErrors signal.
+ * Errors are ignored if setIgnoreSslErrors(true) was called. Otherwise,
+ * handshake fails and connection is closed.
+ */
+void Comm::onSslErrors(const QList<QSslError> &errors)
+{
+	if( m_ignoreSslErrors )
+		static_cast<QSslSocket*>(m_sock)->ignoreSslErrors(errors);
+}
+#endif
+
 /**
  * @brief Comm::setLoginState
  * Sets login state and emits loginStateChanged when it changes.
@@ -476,53 +2415,42 @@ void Comm::setLoginState(Comm::LoginState s)
 }
 
 /**
- * @brief Comm::sendWordCount
- * Writes a word length on socket.
- * This funcion must be called before sending a word.
- * @param wordCount The word length to write to socket.
+ * @brief Comm::appendWordCount
+ * Encodes a word length into m_writeBuf.
+ * This funcion must be called before encoding a word.
+ * Length is encoded in network (big endian) order using as less
+ * bytes as possible.
+ * @param wordCount The word length to encode.
+ * @return false if length is too big to be encoded.
  */
-void Comm::sendWordCount(int wordCount)
+bool Comm::appendWordCount(int wordCount)
 {
-	char countBuff[4];
-
-#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
-	countBuff[0] = ((char*)&wordCount)[0];
-	countBuff[1] = ((char*)&wordCount)[1];
-	countBuff[2] = ((char*)&wordCount)[2];
-	countBuff[3] = ((char*)&wordCount)[3];
-#else
-	countBuff[0] = ((char*)&wordCount)[3];
-	countBuff[1] = ((char*)&wordCount)[2];
-	countBuff[2] = ((char*)&wordCount)[1];
-	countBuff[3] = ((char*)&wordCount)[0];
-#endif
-
-	// write 1 byte
-	if( wordCount < 0x80 )
-		m_sock.write( countBuff, 1 );
+	if( wordCount < 0x80 )				// 1 byte
+		m_writeBuf.append(char(wordCount));
 	else
-	if( wordCount < 0x4000 )		// write 2 bytes
+	if( wordCount < 0x4000 )			// 2 bytes
 	{
-		countBuff[0] |= 0x80;
-		m_sock.write( countBuff, 2 );
+		m_writeBuf.append(char((wordCount >> 8) | 0x80));
+		m_writeBuf.append(char(wordCount));
 	}
 	else
-	if( wordCount < 0x200000)		// write 3 bytes
+	if( wordCount < 0x200000)			// 3 bytes
 	{
-		countBuff[0] |= 0xc0;
-		m_sock.write( countBuff, 3 );
+		m_writeBuf.append(char((wordCount >> 16) | 0xC0));
+		m_writeBuf.append(char(wordCount >> 8));
+		m_writeBuf.append(char(wordCount));
 	}
 	else
-	if( wordCount < 0x10000000 )	// write 4 bytes (untested)
+	if( wordCount < 0x10000000 )		// 4 bytes (untested)
 	{
-		countBuff[0] |= 0xe0;
-		m_sock.write( countBuff, 4 );
+		m_writeBuf.append(char((wordCount >> 24) | 0xE0));
+		m_writeBuf.append(char(wordCount >> 16));
+		m_writeBuf.append(char(wordCount >> 8));
+		m_writeBuf.append(char(wordCount));
 	}
 	else
-	{
-		setComError( WordToSendTooLong );
-		closeCom(true);
-	}
+		return false;
+	return true;
 }
 
 /**
@@ -547,9 +2475,33 @@ void Comm::onSocketStateChanges(QAbstractSocket::SocketState s)
 	switch( s )
 	{
 	case QAbstractSocket::UnconnectedState:
+	{
+#ifndef QT_NO_SSL
+		// TLS 1.3 tickets may arrive after handshake.
+		if( m_transport == SslTransport )
+		{
+			QByteArray ticket = static_cast<QSslSocket*>(m_sock)->sslConfiguration().sessionTicket();
+			if( !ticket.isEmpty() )
+				m_sslSession = ticket;
+		}
+#endif
+		bool retry = m_wantConnected && m_autoReconnect;
 		setLoginState(NoLoged);
+		if( !retry )
+			m_loginQueue.clear();
+		abortInFlight(retry);
+		abortStreams();
+		abortBulks(retry);
+		if( retry )
+			keepRoutes();
+		else
+			m_routes.clear();
 		emit comStateChanged(Unconnected);
+		// Slots may have called closeCom.
+		if( retry && m_wantConnected )
+			scheduleReconnect();
 		return;
+	}
 	case QAbstractSocket::HostLookupState:
 		emit comStateChanged(HostLookup);
 		return;
@@ -560,8 +2512,13 @@ void Comm::onSocketStateChanges(QAbstractSocket::SocketState s)
 		emit comStateChanged(Connected);
 		setLoginState(NoLoged);
 		resetSentence();
-		sendSentence( QSentence("/login"), false );
-		setLoginState(LoginRequested);
+		resetReadBuffer();
+		// Sentences still decoding belong to the old connection.
+		m_chunk.clear();
+		m_decodeQueue.clear();
+		// Over TLS, login waits for handshake.
+		if( m_transport == TcpTransport )
+			startLogin();
 		return;
 	case QAbstractSocket::BoundState: // Este estado sólo se da en caso de ser un servidor.
 		return;
@@ -22,11 +22,31 @@
 #define APICOM_H
 
 #include <QObject>
+#include <QHash>
+#include <QAtomicInt>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QQueue>
+#include <QMutex>
+#include <QTimer>
+#include <QMultiMap>
+#include <QElapsedTimer>
+#include <QAtomicInteger>
+#include <QMetaType>
+#include <functional>
 #include <QtNetwork/qtcpsocket.h>
 #include <QtNetwork/QHostAddress>
+#ifndef QT_NO_SSL
+#include <QtNetwork/QSslSocket>
+#endif
 
 #include "QMD5.h"
 #include "QSentences.h"
+#include "QTagHash.h"
+#include "QLatencyHistogram.h"
+#include "QBulkRows.h"
+
+class QThreadPool;
 
 namespace ROS
 {
@@ -52,6 +72,28 @@ public:
 		UserPassSended,
 		LogedIn
 	};
+	/**
+	 * @brief The LoginMethod enum
+	 * PlainLogin sends user and password on the first /login sentence
+	 * (RouterOS 6.43+), so login takes a single round-trip. If router
+	 * replies with a challenge, MD5 response is sent anyway.
+	 * ChallengeLogin always asks for the MD5 challenge first.
+	 */
+	enum LoginMethod
+	{
+		PlainLogin,
+		ChallengeLogin
+	};
+	/**
+	 * @brief The Transport enum
+	 * TcpTransport connects to api service (port 8728) and
+	 * SslTransport to api-ssl one (port 8729).
+	 */
+	enum Transport
+	{
+		TcpTransport,
+		SslTransport
+	};
 	enum CommError
 	{
 		NoCommError,
@@ -69,47 +111,358 @@ public:
 		ControlByteReceived
 	};
 
+	/**
+	 * @brief ReplyHandler
+	 * Function called for every sentence received with a given tag.
+	 * @see setTagHandler
+	 */
+	typedef std::function<void(ROS::QSentence &)> ReplyHandler;
+	/**
+	 * @brief RowHandler
+	 * Function called for every !re row of a streamed command.
+	 * Must return false when consumer cannot take more rows for now.
+	 * @see streamSentence
+	 */
+	typedef std::function<bool(ROS::QSentence &)> RowHandler;
+	/**
+	 * @brief DoneHandler
+	 * Function called once a streamed command is finished and all his
+	 * rows are delivered. Result is Trap (with the trap message) if any
+	 * !trap was received and Fatal if connection was lost.
+	 * @see streamSentence
+	 */
+	typedef std::function<void(ROS::QSentence::Result, const QString &)> DoneHandler;
+
+	/**
+	 * @brief The BulkError struct
+	 * A row of a bulk command that failed.
+	 */
+	struct BulkError
+	{
+		int row;
+		QSentence::Result result;	// Trap, Timeout or Fatal.
+		QString message;			// Trap message, if any.
+	};
+	/**
+	 * @brief The BulkResult struct
+	 * What happened to every row of a bulk command.
+	 * rows == applied + errors.count() + skipped.
+	 */
+	struct BulkResult
+	{
+		int rows;
+		int applied;				// Rows finished with !done and no !trap.
+		int skipped;				// Rows not sent because bulk was aborted.
+		QList<BulkError> errors;
+		BulkResult() : rows(0), applied(0), skipped(0) { }
+	};
+	/**
+	 * @brief BulkHandler
+	 * Function called once all rows of a bulk command are finished.
+	 * @see sendBulk
+	 */
+	typedef std::function<void(const ROS::Comm::BulkResult &)> BulkHandler;
+
+	/**
+	 * @brief The Stats struct
+	 * Snapshot of connection counters. Counters are totals since stats
+	 * were enabled or last reset. Pending bytes are the ones when
+	 * counters were last updated on Comm thread.
+	 * @see setStatsEnabled
+	 */
+	struct Stats
+	{
+		quint64 bytesIn;			// Bytes read from socket.
+		quint64 bytesOut;			// Bytes written on socket.
+		quint64 wordsDecoded;
+		quint64 sentencesDecoded;
+		quint64 socketReads;		// read calls on socket.
+		quint64 socketWrites;		// write calls on socket.
+		quint64 readyReads;			// Times incoming data was parsed.
+		quint64 parseNsecs;			// Time spent parsing incoming data.
+		quint64 maxParseNsecs;		// Longest time parsing a single readyRead.
+		quint64 poolMisses;			// Sentences taken while pool was empty.
+		qint64 bytesToRead;			// Bytes received but not parsed yet.
+		qint64 bytesToWrite;		// Bytes written but not sent yet.
+		Stats() : bytesIn(0), bytesOut(0), wordsDecoded(0), sentencesDecoded(0), socketReads(0), socketWrites(0),
+			readyReads(0), parseNsecs(0), maxParseNsecs(0), poolMisses(0), bytesToRead(0), bytesToWrite(0) { }
+		inline quint64 avgParseNsecs() const { return readyReads ? (parseNsecs / readyReads) : 0; }
+		inline double poolMissRate() const { return sentencesDecoded ? (double(poolMisses) / double(sentencesDecoded)) : 0.0; }
+	};
+
 private:
-	QTcpSocket m_sock;
+	/**
+	 * @brief The Counters struct
+	 * Counters behind Stats. They are written on Comm thread only, so
+	 * no read-modify-write atomic operation is needed, but can be read
+	 * from any one.
+	 */
+	struct Counters
+	{
+		QAtomicInteger<quint64> bytesIn;
+		QAtomicInteger<quint64> bytesOut;
+		QAtomicInteger<quint64> wordsDecoded;
+		QAtomicInteger<quint64> sentencesDecoded;
+		QAtomicInteger<quint64> socketReads;
+		QAtomicInteger<quint64> socketWrites;
+		QAtomicInteger<quint64> readyReads;
+		QAtomicInteger<quint64> parseNsecs;
+		QAtomicInteger<quint64> maxParseNsecs;
+		QAtomicInteger<quint64> poolMisses;
+		QAtomicInteger<qint64> bytesToRead;
+		QAtomicInteger<qint64> bytesToWrite;
+	};
+
+	/**
+	 * @brief The TagRoute struct
+	 * Where sentences with a given tag must be delivered.
+	 * Either a function or a receiver object slot.
+	 */
+	struct TagRoute
+	{
+		ReplyHandler handler;
+		QPointer<QObject> receiver;
+		QByteArray member;
+	};
+
+	/**
+	 * @brief The InFlight struct
+	 * A tagged sentence sent and waiting for his !done.
+	 */
+	struct InFlight
+	{
+		int batch;					// Batch it belongs to. 0 if none.
+		QSentence::Result result;	// Trap if a !trap was received.
+		bool queued;				// Still on login queue. Not sent yet.
+		QSentence sent;				// Sentence to replay after reconnecting. Empty if not replayable.
+		QString path;				// Command path, for latency histograms.
+		qint64 sentAt;				// When it was sent. See now().
+		qint64 deadline;			// When it times out. 0 if never.
+		QList<QByteArray> proplist;	// Attributes wanted on rows. Empty for all.
+		int bulkRow;				// Row on bulk batch or -1 if not a bulk row.
+		QString message;			// Message of first !trap, if any.
+		InFlight(int b = 0) : batch(b), result(QSentence::Done), queued(false), sentAt(0), deadline(0), bulkRow(-1) { }
+	};
+	/**
+	 * @brief The Batch struct
+	 * Counters of a batch of sentences sent with sendBatch.
+	 */
+	struct Batch
+	{
+		int pending;	// Sentences waiting for !done.
+		int errors;		// Sentences finished with !trap or lost.
+		Batch() : pending(0), errors(0) { }
+	};
+	/**
+	 * @brief The Bulk struct
+	 * Rows of a bulk command. Just window rows are in flight at once.
+	 */
+	struct Bulk
+	{
+		QBulkRows rows;
+		BulkHandler onDone;
+		int window;
+		bool abortOnError;
+		bool aborted;				// No more rows are sent.
+		int next;					// First row not sent.
+		int inFlight;
+		BulkResult result;
+		Bulk() : rows(QString(), QStringList()), window(0), abortOnError(false), aborted(false), next(0), inFlight(0) { }
+	};
+	/**
+	 * @brief The Stream struct
+	 * A command whose rows are delivered one by one to a RowHandler.
+	 * Rows received while consumer is busy are queued up to window.
+	 */
+	struct Stream
+	{
+		int tagID;
+		QString tag;
+		RowHandler onRow;
+		DoneHandler onDone;
+		int window;					// Max rows queued before stop reading socket.
+		QQueue<QSentence> pending;	// Rows waiting for consumer.
+		bool busy;					// Consumer returned false. Waiting for resumeStream.
+		bool paused;				// Reading is paused because of this stream.
+		bool finished;				// !done received.
+		QSentence::Result result;
+		QString message;			// Message of !trap, if any.
+		Stream() : tagID(-1), window(0), busy(false), paused(false), finished(false), result(QSentence::Done) { }
+	};
+
+	/**
+	 * @brief The Outgoing struct
+	 * A sentence sent from another thread, waiting to be encoded
+	 * on Comm thread.
+	 */
+	struct Outgoing
+	{
+		QSentence sent;
+		int tagID;
+		QString tag;
+		ReplyHandler handler;
+	};
+
+	/**
+	 * @brief The DecodeChunk struct
+	 * Consecutive sentences framed by Comm thread, to be decoded by
+	 * a worker thread. Chunks are delivered in the order they were framed.
+	 */
+	struct DecodeChunk
+	{
+		QByteArray data;			// Bytes of all sentences.
+		QVector<QWordRef> words;	// Words of all sentences. Offsets relative to data.
+		QVector<int> ends;			// Index on words after last word of every sentence.
+		QList<QSentence> sentences;	// Sentences decoded by worker.
+		QAtomicInt decoded;			// Worker has filled up sentences.
+	};
+	class DecodeTask;
+
+	QTcpSocket *m_sock;			// A QSslSocket on SslTransport.
+	Transport m_transport;
+	bool m_ignoreSslErrors;
+	QByteArray m_sslSession;	// Last TLS session ticket, to resume it.
 	QString m_addr;
 	quint16 m_port;
 	QString m_Username;
 	QString m_Password;
-	QByteArray incomingWord;
+	QByteArray m_readBuf;		// Bytes pulled from socket pending to be decoded.
+	int m_readPos;				// First byte on m_readBuf not decoded yet.
+	int m_sentenceStart;		// Position on m_readBuf of incoming sentence.
+	QVector<QWordRef> m_incomingWords;	// Incoming sentence words positions.
 	QSentence incomingSentence;
+	QAttribNamesPtr m_names;	// Attribute names interned on incoming sentences.
+	QSentencePool m_pool;		// Sentences to replace the ones taken by app.
+	QByteArray m_writeBuf;		// Sentences encoded pending to be written on socket.
 	LoginState m_loginState;
-	int incomingWordSize;
-	int incomingWordCount;
-	int incomingWordPos;
-	int wordCount;
-	char wordCountBuf[4];
+	LoginMethod m_loginMethod;
+	bool m_challengeSent;			// MD5 response sent on this login.
+	QList<Outgoing> m_loginQueue;	// Sentences sent before login finished.
+	bool m_autoReconnect;
+	bool m_replay;					// Replay idempotent in-flight sentences after reconnecting.
+	bool m_wantConnected;			// connectToROS called and not closeCom.
+	int m_reconnectAttempt;			// Attempts since last login.
+	int m_reconnectMin;
+	int m_reconnectMax;
+	QTimer *m_reconnectTimer;
+	QElapsedTimer m_clock;
+	int m_defaultTimeout;			// ms. 0 for no timeout.
+	QTimer *m_timeoutTimer;
+	QMultiMap<qint64, QString> m_deadlines;		// Deadlines of in-flight commands, by time.
+	QHash<QString, QLatencyHistogram> m_latency;	// Latencies per command path.
+	quint64 m_timeouts;
+	bool m_statsOn;					// Counters are updated.
+	Counters m_stats;
+	QTimer *m_statsTimer;
+	bool m_rawMode;
+	bool m_projecting;						// Some in-flight command may have a proplist.
+	QAtomicInt m_tagSeq;					// Last numeric tag allocated.
+	QTagHash<InFlight> m_inFlight;			// Tagged sentences waiting for !done.
+	QHash<int, Batch> m_batches;			// Batches not finished yet.
+	QTagHash< QSharedPointer<TagRoute> > m_routes;	// Per tag reply destination.
+	QTagHash< QSharedPointer<Stream> > m_streams;	// Streamed commands not delivered fully.
+	QHash<int, Bulk> m_bulks;				// Bulk commands not finished, by batch.
+	bool m_broadcastAll;
+	int m_pausedStreams;					// Streams with a full window. Socket is not read while > 0.
+	int m_lastBatch;
+	QMutex m_outMutex;				// Protects m_outgoing.
+	QList<Outgoing> m_outgoing;		// Sentences sent from other threads.
+	QAtomicInt m_outPosted;			// flushOutgoing call is pending.
+	QThreadPool *m_decodePool;		// Workers decoding sentences. NULL if decoding on Comm thread.
+	QSharedPointer<DecodeChunk> m_chunk;			// Chunk being framed.
+	QQueue< QSharedPointer<DecodeChunk> > m_decodeQueue;	// Chunks sent to workers, in framing order.
+	QAtomicInt m_collectPosted;		// collectDecoded call is pending.
 	CommError lastCommError;
 
+	void createSocket();
+	void startLogin();
 	void doLogin();
 	void tryLogin();
 	void sendUser();
 	void setLoginState(LoginState s);
-	void resetWord();
+	void sendLogin(const QSentence &sent);
+	void sendChallengeResponse(QLatin1String challenge);
+	void flushLoginQueue();
 	void resetSentence();
+	void resetReadBuffer();
+	bool readSocket();
 
-	int receiveWordCount();
-	int receiveWord();
+	int receiveWordCount(int *wordCount);
+	bool receiveWord(int countSize, int wordCount);
+	void processSentence();
+	void decodeSentence();
+	void projectWords();
+	void dispatchSentence(QSentence &s);
+	void dispatchOther(QSentence &s);
+	void finishReply(QSentence::Result result, int tagID, const QString &tag, const QSharedPointer<TagRoute> &route, const QString &message);
+	void appendToChunk();
+	void submitChunk();
+	void postCollect();
 
-	void sendWordCount(int wordCount);
-	void sendWord(const QString &strWord);
+	bool appendWordCount(int wordCount);
+	bool appendWord(const QString &word);
+	bool appendWord(char prefix, const QString &name, const QString &value);
+	bool appendWord(char prefix, QLatin1String name, QLatin1String value);
+	bool appendAttributes(char prefix, const QBasicAttrib &attrib);
+	bool appendTagWord(int tagID);
+	bool encodeSentence(const QSentence &sent, int tagID, const QString &tag);
+	bool encodeBulkRow(const QBulkRows &rows, int row, int tagID);
+	void flushWriteBuffer();
+	bool sendTagged(const QSentence &sent, int tagID, const QString &tag, bool replayable = true);
+	InFlight newInFlight(const QSentence &sent, int batch, bool queued, bool replayable = true) const;
+	void trackInFlight(int tagID, const QString &tag, const InFlight &f);
+	qint64 now() const;
+	void addDeadline(qint64 deadline, const QString &tag);
+	inline void count(QAtomicInteger<quint64> &counter, quint64 n = 1) { counter.storeRelease(counter.load() + n); }
+	void updatePending();
+	int sentenceTag(const QSentence &sent, QString *tag);
+	bool isForeignThread() const;
+	void queueOutgoing(const QSentence &sent, int tagID, const QString &tag, const ReplyHandler &handler);
+	void queueForLogin(const Outgoing &o);
+
+	void deliver(const TagRoute &route, QSentence &s);
+	void trackReply(int tagID, const QString &tag, QSentence::Result result, const QString &message);
+	void finishCommand(const QString &tag, const InFlight &f);
+	void finishBulkRow(const InFlight &f);
+	void pumpBulk(int batch);
+	void abortBulks(bool keep);
+	void abortInFlight(bool keep = false);
+	void keepRoutes();
+	void replayInFlight();
+	void scheduleReconnect();
+	void dropConnection(bool force);
+	void streamReply(const QSharedPointer<Stream> &st, QSentence &s);
+	void finishStream(const QSharedPointer<Stream> &st);
+	void abortStreams();
+	void pauseReading();
+	void resumeReading();
 
 	void setComError(CommError ce);
 
 private slots:
 	void onSocketError(QAbstractSocket::SocketError err);
 	void receiveSentence();
+	void flushOutgoing();
+	void onReconnectTimer();
+	void onTimeoutTimer();
+	void onStatsTimer();
+	void collectDecoded();
 	void onSocketStateChanges(QAbstractSocket::SocketState s);
+#ifndef QT_NO_SSL
+	void onEncrypted();
+	void onSslErrors(const QList<QSslError> &errors);
+#endif
 
 signals:
 	void comError(ROS::Comm::CommError ce, QAbstractSocket::SocketError se);
 	void comReceive(ROS::QSentence &s);
+	void comReceiveRaw(const ROS::QRawSentence &s);
 	void comStateChanged(ROS::Comm::CommState s);
 	void loginStateChanged(ROS::Comm::LoginState s);
+	void commandFinished(int batch, const QString &tag, ROS::QSentence::Result result);
+	void batchFinished(int batch, int errors);
+	void reconnectScheduled(int attempt, int delayMs);
+	void statsUpdated(const ROS::Comm::Stats &stats);
 
 public:
 	Comm(QObject *papi = NULL);
@@ -121,7 +474,7 @@ public:
 	 * doesn't takes care if logon was done.
 	 * @return true/false if socket is in "ConnectetState" or not.
 	 */
-	inline bool isConnected() const { return m_sock.state() == QAbstractSocket::ConnectedState;	}
+	inline bool isConnected() const { return m_sock->state() == QAbstractSocket::ConnectedState;	}
 	/**
 	 * @brief isLoged
 	 * This function checks if a succefull login was done.
@@ -135,20 +488,162 @@ public:
 	 * This state happens when a "gracefull" closeCom(false) function is called.
 	 * @return true if socket is closing.
 	 */
-	inline bool isClosing() const { return m_sock.state() == QAbstractSocket::ClosingState; }
+	inline bool isClosing() const { return m_sock->state() == QAbstractSocket::ClosingState; }
 	/**
 	 * @brief isConnecting
 	 * Checks if socket is in "connecting" state.
 	 * This state happens at handshake between this client and server.
 	 * @return
 	 */
-	inline bool isConnecting() const { return m_sock.state() == QAbstractSocket::ConnectingState; }
+	inline bool isConnecting() const { return m_sock->state() == QAbstractSocket::ConnectingState; }
+
+	bool setTransport(Transport t);
+	inline Transport transport() const { return m_transport; }
+	/**
+	 * @brief setIgnoreSslErrors
+	 * Lets TLS handshake go on even with certificate errors. Needed for
+	 * routers using self-signed certificates.
+	 * @param ignore true to ignore certificate errors.
+	 */
+	inline void setIgnoreSslErrors(bool ignore) { m_ignoreSslErrors = ignore; }
+	inline bool ignoreSslErrors() const { return m_ignoreSslErrors; }
+	/**
+	 * @brief sslSessionTicket
+	 * The TLS session ticket of last connection. It's used on next
+	 * connections to skip full handshake. It can be saved and restored
+	 * with setSslSessionTicket to resume sessions across Comm objects.
+	 */
+	inline const QByteArray &sslSessionTicket() const { return m_sslSession; }
+	inline void setSslSessionTicket(const QByteArray &ticket) { m_sslSession = ticket; }
+
+	/**
+	 * @brief setDefaultTimeout
+	 * Sets the timeout for every tagged sentence sent from now on,
+	 * except /listen and /cancel ones.
+	 * @param ms The timeout in milliseconds. 0 for no timeout.
+	 * @see setTimeout
+	 */
+	inline void setDefaultTimeout(int ms) { m_defaultTimeout = qMax(0, ms); }
+	inline int defaultTimeout() const { return m_defaultTimeout; }
+	bool setTimeout(const QString &tag, int ms);
+	inline quint64 timeoutCount() const { return m_timeouts; }
+
+	QLatencyHistogram latency(const QString &path) const;
+	inline const QHash<QString, QLatencyHistogram> &latencies() const { return m_latency; }
+	inline void clearLatencies() { m_latency.clear(); }
+
+	void setStatsEnabled(bool enabled, int intervalMs = 0);
+	inline bool statsEnabled() const { return m_statsOn; }
+	Stats stats() const;
+	void resetStats();
+
+	void setAutoReconnect(bool reconnect, int minMs = 1000, int maxMs = 60000);
+	inline bool isAutoReconnect() const { return m_autoReconnect; }
+	/**
+	 * @brief setReplayInFlight
+	 * When auto reconnect is enabled, idempotent sentences (see
+	 * isIdempotent) still in-flight when connection is lost are sent
+	 * again, with the same tag and route, once logged in again. The rest
+	 * are finished as Fatal. Sentences still on login queue are always
+	 * kept, as they were never sent.
+	 * Applies to sentences sent after calling this function.
+	 * @param replay true to replay.
+	 */
+	inline void setReplayInFlight(bool replay) { m_replay = replay; }
+	inline bool isReplayInFlight() const { return m_replay; }
+	static bool isIdempotent(const ROS::QSentence &sent);
+
+	/**
+	 * @brief setLoginMethod
+	 * Sets how to log into router on next connections.
+	 * @param m The login method. Defaults to PlainLogin.
+	 */
+	inline void setLoginMethod(LoginMethod m) { m_loginMethod = m; }
+	inline LoginMethod loginMethod() const { return m_loginMethod; }
+	/**
+	 * @brief loginQueueCount
+	 * @return the amount of sentences waiting for login to be sent.
+	 */
+	inline int loginQueueCount() const { return m_loginQueue.count(); }
+
+	/**
+	 * @brief setRawMode
+	 * In raw mode, sentences received once loged in are not decoded
+	 * into QSentence. comReceiveRaw is emited instead of comReceive, with
+	 * the words pointing into the connection read buffer. Applications
+	 * convert to QString just the values they need.
+	 * @param raw true to enable raw mode.
+	 */
+	inline void setRawMode(bool raw) { m_rawMode = raw; }
+	inline bool isRawMode() const { return m_rawMode; }
+
+	/**
+	 * @brief setBroadcastAll
+	 * By default, sentences delivered to a tag handler or receiver
+	 * are not emited through comReceive (or comReceiveRaw). Setting this
+	 * to true makes comReceive a catch-all signal emited for every sentence.
+	 * @param all true to emit comReceive for every sentence.
+	 */
+	inline void setBroadcastAll(bool all) { m_broadcastAll = all; }
+	inline bool isBroadcastAll() const { return m_broadcastAll; }
+
+	/**
+	 * @brief attributeNameID
+	 * Gets the interned id of an attribute name for this connection.
+	 * Sentences received by this connection can be looked up by this
+	 * id (QSentence::attribute(int)) without comparing strings.
+	 * @param name The attribute name.
+	 * @return the attribute name id. -1 if names table is full.
+	 */
+	inline int attributeNameID(const QString &name) { return m_names->intern(name); }
+	inline const QAttribNamesPtr &attributeNames() const { return m_names; }
+
+	QSentence takeSentence();
+	/**
+	 * @brief recycleSentence
+	 * Gives back a sentence taken with takeSentence once it's not needed
+	 * anymore, so his memory is reused for next incoming sentences.
+	 * Sentence is left empty.
+	 * @param s The sentence to recycle.
+	 */
+	inline void recycleSentence(QSentence &s) { m_pool.release(s); }
+	inline QSentencePool &sentencePool() { return m_pool; }
+
+	void setTagHandler(const QString &tag, const ReplyHandler &handler);
+	void setTagReceiver(const QString &tag, QObject *receiver, const char *member);
+	void removeTagHandler(const QString &tag);
+	inline bool hasTagHandler(const QString &tag) const { return m_routes.contains(tag); }
 
 	QString errorString();
 	QString sendSentence(const ROS::QSentence &sent, bool sendTag = true);
 	QString sendSentence(const QString &cmd, bool sendTag = true, const QStringList &attrib = QStringList());
 	QString sendCancel(const QString &tag);
 	QString sendSentence(const QString &cmd, const QString &tag, const QStringList &attrib = QStringList());
+	QString sendWithHandler(const ROS::QSentence &sent, const ReplyHandler &handler);
+	int sendBatch(const QList<ROS::QSentence> &sents, QStringList *tags = NULL);
+	int sendBulk(const ROS::QBulkRows &rows, const BulkHandler &onDone, bool abortOnError = false, int window = 64);
+	/**
+	 * @brief bulkCount
+	 * @return the amount of bulk commands not finished yet.
+	 */
+	inline int bulkCount() const { return m_bulks.count(); }
+	/**
+	 * @brief inFlightCount
+	 * @return the amount of tagged sentences sent and still waiting for !done.
+	 */
+	inline int inFlightCount() const { return m_inFlight.count(); }
+	QString streamSentence(const ROS::QSentence &sent, const RowHandler &onRow, const DoneHandler &onDone, int window = 256);
+	void resumeStream(const QString &tag);
+	/**
+	 * @brief isReadingPaused
+	 * @return true if socket is not being read because some stream
+	 * consumer is not taking his rows.
+	 */
+	inline bool isReadingPaused() const { return m_pausedStreams > 0; }
+	int nextTagID();
+
+	void setDecodeThreads(int threads);
+	int decodeThreads() const;
 
 public slots:
 	void setRemoteHost(const QString &addr, quint16 port) { m_addr = addr; m_port = port; }
@@ -157,4 +652,7 @@ public slots:
 	void closeCom(bool force = false);
 };
 }
+
+Q_DECLARE_METATYPE(ROS::Comm::Stats)
+
 #endif // APICOM_H
@@ -0,0 +1,525 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CommPool.h"
+
+#include <QTimer>
+
+using namespace ROS;
+
+/**
+ * @brief CommPool::CommPool
+ * Creates the pool and starts his worker threads.
+ * @param workers Amount of worker threads. If <= 0, one per CPU core.
+ * @param papi Parent object.
+ */
+CommPool::CommPool(int workers, QObject *papi)
+ : QObject(papi), m_nextWorker(0), m_connecting(0), m_maxConnecting(32),
+   m_defaultMaxInFlight(0), m_defaultRate(0), m_defaultBurst(1)
+{
+	qRegisterMetaType<ROS::Comm::LoginState>("ROS::Comm::LoginState");
+	qRegisterMetaType<ROS::Comm::CommState>("ROS::Comm::CommState");
+	qRegisterMetaType<ROS::Comm::CommError>("ROS::Comm::CommError");
+	qRegisterMetaType<QAbstractSocket::SocketError>("QAbstractSocket::SocketError");
+
+	if( workers <= 0 )
+		workers = qMax(1, QThread::idealThreadCount());
+	for( int i = 0; i < workers; i++ )
+	{
+		QThread *t = new QThread(this);
+		t->setObjectName(QString("CommPool worker %1").arg(i));
+		t->start();
+		m_workers.append(t);
+	}
+
+	m_clock.start();
+	m_rateTimer = new QTimer(this);
+	m_rateTimer->setSingleShot(true);
+	connect( m_rateTimer, SIGNAL(timeout()), this, SLOT(onRateTimer()) );
+}
+
+/**
+ * @brief CommPool::~CommPool
+ * Stops all worker threads. Connections are closed and their Comm
+ * objects destroyed from their own thread, as it finishes.
+ */
+CommPool::~CommPool()
+{
+	QHash<QString, Router>::iterator it;
+	for( it = m_routers.begin(); it != m_routers.end(); ++it )
+		it.value().comm->disconnect(this);
+
+	for( int i = 0; i < m_workers.count(); i++ )
+	{
+		m_workers.at(i)->quit();
+		m_workers.at(i)->wait();
+	}
+}
+
+/**
+ * @brief CommPool::addRouter
+ * Adds a router to the pool. Nothing is connected until a job is
+ * submitted for it or connectAll is called.
+ * Routers are assigned to worker threads in round robin.
+ * @param name A unique name used to refer to the router.
+ * @param addr The address where the router is.
+ * @param port The port where router API is listening.
+ * @param uname The login user name.
+ * @param upass The login password.
+ * @return false if name is already used or any connection data is missing.
+ */
+bool CommPool::addRouter(const QString &name, const QString &addr, quint16 port, const QString &uname, const QString &upass)
+{
+	if( m_routers.contains(name) || addr.isEmpty() || !port || uname.isEmpty() )
+		return false;
+
+	Router &r = m_routers[name];
+	r.comm = new Comm;
+	r.comm->setRemoteHost(addr, port);
+	r.comm->setUserNamePass(uname, upass);
+	setLimits(r, m_defaultMaxInFlight, m_defaultRate, m_defaultBurst);
+	m_names.insert(r.comm, name);
+
+	connect( r.comm, SIGNAL(loginStateChanged(ROS::Comm::LoginState)),
+			 this, SLOT(onLoginStateChanged(ROS::Comm::LoginState)) );
+	connect( r.comm, SIGNAL(comStateChanged(ROS::Comm::CommState)),
+			 this, SLOT(onCommStateChanged(ROS::Comm::CommState)) );
+	connect( r.comm, SIGNAL(comError(ROS::Comm::CommError,QAbstractSocket::SocketError)),
+			 this, SLOT(onCommError(ROS::Comm::CommError,QAbstractSocket::SocketError)) );
+
+	QThread *t = m_workers.at(m_nextWorker);
+	m_nextWorker = (m_nextWorker + 1) % m_workers.count();
+	connect( t, SIGNAL(finished()), r.comm, SLOT(deleteLater()) );
+	r.comm->moveToThread(t);
+	return true;
+}
+
+/**
+ * @brief CommPool::removeRouter
+ * Removes a router from the pool. His connection is closed and jobs
+ * not sent yet are discarded.
+ * @param name The router name.
+ */
+void CommPool::removeRouter(const QString &name)
+{
+	QHash<QString, Router>::iterator it = m_routers.find(name);
+	if( it == m_routers.end() )
+		return;
+
+	endConnect(it.value());
+	m_connectQueue.removeAll(name);
+	m_names.remove(it.value().comm);
+	it.value().comm->disconnect(this);
+	QMetaObject::invokeMethod(it.value().comm, "deleteLater", Qt::QueuedConnection);
+	m_routers.erase(it);
+	startConnects();
+}
+
+/**
+ * @brief CommPool::isLoged
+ * @param name The router name.
+ * @return true if router connection is logged in.
+ */
+bool CommPool::isLoged(const QString &name) const
+{
+	QHash<QString, Router>::const_iterator it = m_routers.constFind(name);
+	return (it != m_routers.constEnd()) && (it.value().login == Comm::LogedIn);
+}
+
+/**
+ * @brief CommPool::pendingJobs
+ * @param name The router name.
+ * @return the amount of jobs not sent yet, waiting for router login or
+ * for router limits.
+ */
+int CommPool::pendingJobs(const QString &name) const
+{
+	QHash<QString, Router>::const_iterator it = m_routers.constFind(name);
+	if( it == m_routers.constEnd() )
+		return 0;
+
+	int count = 0;
+	for( int p = 0; p < Priorities; p++ )
+		count += it.value().jobs[p].count();
+	return count;
+}
+
+/**
+ * @brief CommPool::inFlightJobs
+ * @param name The router name.
+ * @return the amount of jobs sent and waiting for his !done.
+ */
+int CommPool::inFlightJobs(const QString &name) const
+{
+	QHash<QString, Router>::const_iterator it = m_routers.constFind(name);
+	return (it != m_routers.constEnd()) ? it.value().inFlight : 0;
+}
+
+/**
+ * @brief CommPool::setLimits
+ * Sets router limits. Bucket is filled up.
+ */
+void CommPool::setLimits(CommPool::Router &r, int maxInFlight, double rate, int burst)
+{
+	r.maxInFlight = qMax(0, maxInFlight);
+	r.rate = qMax(0.0, rate);
+	r.burst = qMax(1, burst);
+	r.tokens = r.burst;
+	r.refilledAt = m_clock.elapsed();
+}
+
+/**
+ * @brief CommPool::setDefaultLimits
+ * Sets the limits of routers added from now on.
+ * @see setRouterLimits
+ */
+void CommPool::setDefaultLimits(int maxInFlight, double rate, int burst)
+{
+	m_defaultMaxInFlight = maxInFlight;
+	m_defaultRate = rate;
+	m_defaultBurst = burst;
+}
+
+/**
+ * @brief CommPool::setRouterLimits
+ * Sets how hard a router can be used. Small routers API process is
+ * easily overloaded by too many commands at once.
+ * Listen commands count as in flight until they are cancelled.
+ * @param name The router name.
+ * @param maxInFlight Max jobs sent and not finished. 0 for no limit.
+ * @param rate Max jobs sent per second, on average. 0 for no limit.
+ * @param burst Jobs that can be sent at once after being idle.
+ * @return false if there is no such router.
+ */
+bool CommPool::setRouterLimits(const QString &name, int maxInFlight, double rate, int burst)
+{
+	QHash<QString, Router>::iterator it = m_routers.find(name);
+	if( it == m_routers.end() )
+		return false;
+
+	setLimits(it.value(), maxInFlight, rate, burst);
+	dispatch(name);
+	return true;
+}
+
+/**
+ * @brief CommPool::submit
+ * Sends a sentence to a router and routes all his replies to handler.
+ * If router is not logged in, sentence waits for it and connection is
+ * requested. It also waits while router is over his limits.
+ * Handler is called from the router worker thread.
+ * @param name The router name.
+ * @param sent The sentence to send.
+ * @param handler The function that will receive replies.
+ * @param priority The job priority.
+ * @return false if there is no such router.
+ * @see Comm::sendWithHandler
+ */
+bool CommPool::submit(const QString &name, const QSentence &sent, const Comm::ReplyHandler &handler, CommPool::Priority priority)
+{
+	QHash<QString, Router>::iterator it = m_routers.find(name);
+	if( it == m_routers.end() )
+		return false;
+
+	Job job;
+	job.sent = sent;
+	job.handler = handler;
+	it.value().jobs[priority].enqueue(job);
+	if( it.value().login == Comm::LogedIn )
+		dispatch(name);
+	else
+		requestConnect(name);
+	return true;
+}
+
+/**
+ * @brief CommPool::submitAll
+ * Sends the same sentence to every router on pool.
+ * Handler is called from many worker threads at once, so it must be
+ * thread safe.
+ * @param sent The sentence to send.
+ * @param handler The function that will receive replies of all routers.
+ * @param priority The jobs priority.
+ * @return the amount of routers the sentence was submitted to.
+ */
+int CommPool::submitAll(const QSentence &sent, const CommPool::FleetHandler &handler, CommPool::Priority priority)
+{
+	QStringList names = m_routers.keys();
+	for( int i = 0; i < names.count(); i++ )
+	{
+		QString name = names.at(i);
+		submit(name, sent, [handler, name](QSentence &s) { handler(name, s); }, priority);
+	}
+	return names.count();
+}
+
+/**
+ * @brief CommPool::connectAll
+ * Requests connection to all routers not logged in yet.
+ * Useful to have all fleet ready before submitting jobs.
+ */
+void CommPool::connectAll()
+{
+	QHash<QString, Router>::const_iterator it;
+	for( it = m_routers.constBegin(); it != m_routers.constEnd(); ++it )
+		requestConnect(it.key());
+}
+
+/**
+ * @brief CommPool::requestConnect
+ * Queues a router to be connected when there is a free connect slot.
+ * Does nothing if it's already logged in, connecting or queued.
+ * @param name The router name.
+ */
+void CommPool::requestConnect(const QString &name)
+{
+	Router &r = m_routers[name];
+	if( (r.login == Comm::LogedIn) || r.connecting || r.queued )
+		return;
+	r.queued = true;
+	m_connectQueue.enqueue(name);
+	startConnects();
+}
+
+/**
+ * @brief CommPool::startConnects
+ * Starts queued connections while there are free connect slots.
+ * Comm::connectToROS is called on the router worker thread.
+ */
+void CommPool::startConnects()
+{
+	while( (m_connecting < m_maxConnecting) && !m_connectQueue.isEmpty() )
+	{
+		QHash<QString, Router>::iterator it = m_routers.find(m_connectQueue.dequeue());
+		if( it == m_routers.end() )
+			continue;
+
+		it.value().queued = false;
+		it.value().connecting = true;
+		m_connecting++;
+		QMetaObject::invokeMethod(it.value().comm, "connectToROS", Qt::QueuedConnection);
+	}
+}
+
+/**
+ * @brief CommPool::endConnect
+ * Frees the connect slot used by a router, if any.
+ * @param r The router.
+ */
+void CommPool::endConnect(CommPool::Router &r)
+{
+	if( r.connecting )
+	{
+		r.connecting = false;
+		m_connecting--;
+	}
+}
+
+/**
+ * @brief CommPool::takeToken
+ * Takes a token from router rate bucket, refilling it first.
+ * @param r The router.
+ * @param now Current time on m_clock.
+ * @param waitMs Set to ms until next token, if there is none now.
+ * @return true if job can be sent.
+ */
+bool CommPool::takeToken(CommPool::Router &r, qint64 now, int *waitMs)
+{
+	if( r.rate <= 0 )
+		return true;
+
+	r.tokens = qMin(r.burst, r.tokens + double(now - r.refilledAt) * r.rate / 1000.0);
+	r.refilledAt = now;
+	if( r.tokens >= 1.0 )
+	{
+		r.tokens -= 1.0;
+		return true;
+	}
+	*waitMs = int((1.0 - r.tokens) * 1000.0 / r.rate) + 1;
+	return false;
+}
+
+/**
+ * @brief CommPool::dispatch
+ * Sends the waiting jobs of a logged in router, highest priority
+ * first, while router is below his limits. If rate limit stops it,
+ * rate timer is started to continue later.
+ * @param name The router name.
+ */
+void CommPool::dispatch(const QString &name)
+{
+	QHash<QString, Router>::iterator it = m_routers.find(name);
+	if( (it == m_routers.end()) || (it.value().login != Comm::LogedIn) )
+		return;
+
+	Router &r = it.value();
+	qint64 now = m_clock.elapsed();
+	while( (r.maxInFlight <= 0) || (r.inFlight < r.maxInFlight) )
+	{
+		int p = 0;
+		while( (p < Priorities) && r.jobs[p].isEmpty() )
+			p++;
+		if( p == Priorities )
+			break;
+
+		int waitMs;
+		if( !takeToken(r, now, &waitMs) )
+		{
+			if( !m_rateTimer->isActive() || (m_rateTimer->remainingTime() > waitMs) )
+				m_rateTimer->start(waitMs);
+			break;
+		}
+		sendJob(name, r, r.jobs[p].dequeue());
+	}
+}
+
+/**
+ * @brief CommPool::sendJob
+ * Sends a job sentence from the Comm worker thread.
+ * Once his !done is received there, onJobDone is called on pool thread
+ * to free his in-flight slot.
+ * @param name The router name.
+ * @param r The router.
+ * @param job The job to send.
+ */
+void CommPool::sendJob(const QString &name, CommPool::Router &r, const CommPool::Job &job)
+{
+	Comm *comm = r.comm;
+	int generation = r.generation;
+	CommPool *pool = this;
+	Comm::ReplyHandler handler = job.handler;
+
+	r.inFlight++;
+	QSentence sent = job.sent;
+	QTimer::singleShot(0, comm, [comm, sent, handler, pool, name, generation]()
+	{
+		comm->sendWithHandler(sent, [handler, pool, name, generation](QSentence &s)
+		{
+			QSentence::Result result = s.getResultType();
+			if( handler )
+				handler(s);
+			if( (result == QSentence::Done) || (result == QSentence::Fatal) )
+				QMetaObject::invokeMethod(pool, "onJobDone", Qt::QueuedConnection, Q_ARG(QString, name), Q_ARG(int, generation));
+		});
+	});
+}
+
+/**
+ * @brief CommPool::onJobDone
+ * Called on pool thread when a job is finished. Frees his in-flight
+ * slot and sends next jobs.
+ * @param name The router name.
+ * @param generation Router generation when job was sent. Jobs of a
+ * lost connection were already discounted.
+ */
+void CommPool::onJobDone(const QString &name, int generation)
+{
+	QHash<QString, Router>::iterator it = m_routers.find(name);
+	if( (it == m_routers.end()) || (it.value().generation != generation) || (it.value().inFlight <= 0) )
+		return;
+
+	it.value().inFlight--;
+	dispatch(name);
+}
+
+/**
+ * @brief CommPool::onRateTimer
+ * Slot connected to rate timer. Sends jobs of routers that were
+ * waiting for tokens.
+ */
+void CommPool::onRateTimer()
+{
+	QStringList names = m_routers.keys();
+	for( int i = 0; i < names.count(); i++ )
+		dispatch(names.at(i));
+}
+
+/**
+ * @brief CommPool::onLoginStateChanged
+ * Slot connected to every Comm loginStateChanged signal.
+ * When router is logged in, his connect slot is freed and waiting
+ * jobs are sent.
+ * @param s The new login state.
+ */
+void CommPool::onLoginStateChanged(Comm::LoginState s)
+{
+	QString name = m_names.value(sender());
+	QHash<QString, Router>::iterator it = m_routers.find(name);
+	if( it == m_routers.end() )
+		return;
+
+	it.value().login = s;
+	if( s == Comm::LogedIn )
+	{
+		endConnect(it.value());
+		dispatch(name);
+		startConnects();
+	}
+	emit routerLoginStateChanged(name, s);
+}
+
+/**
+ * @brief CommPool::onCommStateChanged
+ * Slot connected to every Comm comStateChanged signal.
+ * If connection is lost while connecting, jobs waiting for it are
+ * discarded and routerFailed is emited. They will not be retried.
+ * If it's lost while logged in, jobs sent are lost and jobs not sent
+ * yet wait for a new connection.
+ * @param s The new connection state.
+ */
+void CommPool::onCommStateChanged(Comm::CommState s)
+{
+	if( s != Comm::Unconnected )
+		return;
+
+	QString name = m_names.value(sender());
+	QHash<QString, Router>::iterator it = m_routers.find(name);
+	if( it == m_routers.end() )
+		return;
+
+	Router &r = it.value();
+	r.login = Comm::NoLoged;
+	r.inFlight = 0;
+	r.generation++;
+	if( r.connecting )
+	{
+		int lost = pendingJobs(name);
+		for( int p = 0; p < Priorities; p++ )
+			r.jobs[p].clear();
+		endConnect(r);
+		emit routerFailed(name, lost);
+	}
+	else
+	if( pendingJobs(name) )
+		requestConnect(name);
+	startConnects();
+}
+
+/**
+ * @brief CommPool::onCommError
+ * Slot connected to every Comm comError signal.
+ * Just emits routerError with the router name.
+ */
+void CommPool::onCommError(Comm::CommError ce, QAbstractSocket::SocketError se)
+{
+	QString name = m_names.value(sender());
+	if( !name.isEmpty() )
+		emit routerError(name, ce, se);
+}
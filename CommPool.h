@@ -0,0 +1,175 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMPOOL_H
+#define COMMPOOL_H
+
+#include <QObject>
+#include <QHash>
+#include <QQueue>
+#include <QThread>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <functional>
+
+#include "Comm.h"
+
+namespace ROS
+{
+
+/**
+ * @brief The CommPool class
+ * Keeps one logged in Comm per router, spread over several worker
+ * threads. Every worker runs his own event loop, so routers don't
+ * wait for each other.
+ * Connections are opened on demand, at most maxConnecting at once, and
+ * kept open to be reused by next jobs.
+ * Every router has his own job queues, one per Priority, so a slow
+ * router never delays jobs of other ones. Jobs are sent while router
+ * is below his in-flight limit and has tokens left on his rate bucket
+ * (see setRouterLimits). A job is in flight until his !done.
+ * All CommPool functions must be called from the thread that created it.
+ * Reply handlers are called from the router worker thread.
+ */
+class CommPool : public QObject
+{
+	Q_OBJECT
+
+public:
+	/**
+	 * @brief FleetHandler
+	 * Function called for every sentence replied by any router.
+	 * @see submitAll
+	 */
+	typedef std::function<void(const QString &, ROS::QSentence &)> FleetHandler;
+
+	/**
+	 * @brief The Priority enum
+	 * Jobs of a higher priority are sent before any waiting job of
+	 * lower ones on the same router.
+	 */
+	enum Priority
+	{
+		Interactive,	// User is waiting for it.
+		Normal,
+		Bulk			// Syncs and other background jobs.
+	};
+
+private:
+	enum { Priorities = Bulk + 1 };
+
+	/**
+	 * @brief The Job struct
+	 * A sentence waiting to be sent.
+	 */
+	struct Job
+	{
+		QSentence sent;
+		Comm::ReplyHandler handler;
+	};
+	/**
+	 * @brief The Router struct
+	 * A router connection, his jobs not sent yet and his limits.
+	 */
+	struct Router
+	{
+		Comm *comm;
+		Comm::LoginState login;
+		bool connecting;		// Counted on m_connecting.
+		bool queued;			// Waiting on m_connectQueue.
+		QQueue<Job> jobs[Priorities];
+		int inFlight;			// Jobs sent and waiting for !done.
+		int generation;			// Incremented when connection is lost, to ignore late !done.
+		int maxInFlight;		// 0 for no limit.
+		double rate;			// Jobs per second. 0 for no limit.
+		double burst;			// Bucket size.
+		double tokens;
+		qint64 refilledAt;		// ms on m_clock.
+		Router() : comm(NULL), login(Comm::NoLoged), connecting(false), queued(false),
+			inFlight(0), generation(0), maxInFlight(0), rate(0), burst(1), tokens(1), refilledAt(0) { }
+	};
+
+	QList<QThread*> m_workers;
+	int m_nextWorker;
+	QHash<QString, Router> m_routers;
+	QHash<QObject*, QString> m_names;	// Router name of every Comm, to know signals sender.
+	QQueue<QString> m_connectQueue;		// Routers waiting for a connect slot.
+	int m_connecting;					// Routers connecting or logging in now.
+	int m_maxConnecting;
+	int m_defaultMaxInFlight;
+	double m_defaultRate;
+	int m_defaultBurst;
+	QElapsedTimer m_clock;
+	QTimer *m_rateTimer;				// Fires when a router rate bucket has tokens again.
+
+	void requestConnect(const QString &name);
+	void startConnects();
+	void endConnect(Router &r);
+	void dispatch(const QString &name);
+	void sendJob(const QString &name, Router &r, const Job &job);
+	bool takeToken(Router &r, qint64 now, int *waitMs);
+	void setLimits(Router &r, int maxInFlight, double rate, int burst);
+
+private slots:
+	void onJobDone(const QString &name, int generation);
+	void onRateTimer();
+	void onLoginStateChanged(ROS::Comm::LoginState s);
+	void onCommStateChanged(ROS::Comm::CommState s);
+	void onCommError(ROS::Comm::CommError ce, QAbstractSocket::SocketError se);
+
+signals:
+	void routerLoginStateChanged(const QString &name, ROS::Comm::LoginState s);
+	void routerError(const QString &name, ROS::Comm::CommError ce, QAbstractSocket::SocketError se);
+	void routerFailed(const QString &name, int lostJobs);
+
+public:
+	CommPool(int workers = 0, QObject *papi = NULL);
+	~CommPool();
+
+	/**
+	 * @brief setMaxConnecting
+	 * Sets how many routers can be connecting or logging in at once.
+	 * The rest wait for a free slot.
+	 * @param max The max concurrent connects. At least 1.
+	 */
+	inline void setMaxConnecting(int max) { m_maxConnecting = qMax(1, max); startConnects(); }
+	inline int maxConnecting() const { return m_maxConnecting; }
+	inline int connectingCount() const { return m_connecting; }
+	inline int workerCount() const { return m_workers.count(); }
+
+	bool addRouter(const QString &name, const QString &addr, quint16 port, const QString &uname, const QString &upass);
+	void removeRouter(const QString &name);
+	inline QStringList routers() const { return m_routers.keys(); }
+	inline bool contains(const QString &name) const { return m_routers.contains(name); }
+	bool isLoged(const QString &name) const;
+	int pendingJobs(const QString &name) const;
+	int inFlightJobs(const QString &name) const;
+
+	void setDefaultLimits(int maxInFlight, double rate = 0, int burst = 1);
+	bool setRouterLimits(const QString &name, int maxInFlight, double rate = 0, int burst = 1);
+
+	bool submit(const QString &name, const ROS::QSentence &sent, const Comm::ReplyHandler &handler, Priority priority = Normal);
+	int submitAll(const ROS::QSentence &sent, const FleetHandler &handler, Priority priority = Normal);
+
+public slots:
+	void connectAll();
+};
+}
+#endif // COMMPOOL_H
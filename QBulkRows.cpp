@@ -0,0 +1,129 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "QBulkRows.h"
+
+using namespace ROS;
+
+/**
+ * @brief QBulkRows::QBulkRows
+ * @param command The command of every row. For instance, "/ip/firewall/filter/add"
+ * @param columns The attribute names.
+ */
+QBulkRows::QBulkRows(const QString &command, const QStringList &columns)
+ : m_command(command.toLatin1())
+{
+	m_columns.reserve(columns.count());
+	for( int i = 0; i < columns.count(); i++ )
+		m_columns.append(columns.at(i).toLatin1());
+}
+
+/**
+ * @brief QBulkRows::clear
+ * Removes all rows. Command and columns are kept.
+ */
+void QBulkRows::clear()
+{
+	m_data.resize(0);
+	m_values.resize(0);
+}
+
+/**
+ * @brief QBulkRows::reserve
+ * Reserves memory for rows.
+ * @param rows The amount of rows.
+ * @param bytes The bytes of all values.
+ */
+void QBulkRows::reserve(int rows, int bytes)
+{
+	m_values.reserve(rows * m_columns.count());
+	m_data.reserve(bytes);
+}
+
+/**
+ * @brief QBulkRows::add
+ * Appends a value to the row being filled.
+ * @param value The value chars.
+ * @param len The value length or -1 for null.
+ */
+void QBulkRows::add(const char *value, int len)
+{
+	Value v;
+	v.offset = m_data.count();
+	v.len = len;
+	if( len > 0 )
+		m_data.append(value, len);
+	m_values.append(v);
+}
+
+/**
+ * @brief QBulkRows::addValue
+ * @overload
+ * Value is converted to latin1 directly into the buffer.
+ */
+void QBulkRows::addValue(const QString &value)
+{
+	Value v;
+	v.offset = m_data.count();
+	v.len = value.count();
+	m_data.resize(v.offset + v.len);
+	char *p = m_data.data() + v.offset;
+	for( int i = 0; i < v.len; i++ )
+		p[i] = value.at(i).toLatin1();
+	m_values.append(v);
+}
+
+/**
+ * @brief QBulkRows::addValue
+ * @overload
+ */
+void QBulkRows::addValue(qint64 value)
+{
+	char digits[24];
+	int n = 0;
+	quint64 u = (value < 0) ? quint64(0) - quint64(value) : quint64(value);
+	do
+	{
+		digits[sizeof(digits) - ++n] = char('0' + (u % 10));
+		u /= 10;
+	}
+	while( u );
+	if( value < 0 )
+		digits[sizeof(digits) - ++n] = '-';
+	add(digits + sizeof(digits) - n, n);
+}
+
+/**
+ * @brief QBulkRows::addRow
+ * Adds a full row. Missing values are null and extra ones ignored.
+ * Null strings are null values too.
+ * @param values The values, in columns order.
+ */
+void QBulkRows::addRow(const QStringList &values)
+{
+	for( int c = 0; c < m_columns.count(); c++ )
+	{
+		if( (c < values.count()) && !values.at(c).isNull() )
+			addValue(values.at(c));
+		else
+			addNull();
+	}
+}
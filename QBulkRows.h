@@ -0,0 +1,95 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QBULKROWS_H
+#define QBULKROWS_H
+
+#include <QByteArray>
+#include <QVector>
+#include <QStringList>
+
+namespace ROS
+{
+
+/**
+ * @brief The QBulkRows class
+ * Many sentences of the same command, as a table of values.
+ * Every row is a sentence: the command, an attribute per column not
+ * null and a tag. Column names and values are kept as latin1 bytes on
+ * a single buffer, so rows take no QSentence nor QString and Comm
+ * encodes them straight from here. A ".id" column sets the item id.
+ * Values are added one by one, row after row.
+ * @see Comm::sendBulk
+ */
+class QBulkRows
+{
+	/**
+	 * @brief The Value struct
+	 * Value position on m_data. len < 0 for a null value.
+	 */
+	struct Value
+	{
+		qint32 offset;
+		qint32 len;
+	};
+
+	QByteArray m_command;
+	QVector<QByteArray> m_columns;
+	QByteArray m_data;
+	QVector<Value> m_values;
+
+	void add(const char *value, int len);
+
+public:
+	QBulkRows(const QString &command, const QStringList &columns);
+
+	void clear();
+	void reserve(int rows, int bytes);
+
+	inline void addValue(const char *value, int len) { add(value, len); }
+	void addValue(const QString &value);
+	void addValue(qint64 value);
+	/**
+	 * @brief addNull
+	 * Adds a null value. Attribute is not sent for this row.
+	 */
+	inline void addNull() { add(NULL, -1); }
+	void addRow(const QStringList &values);
+
+	inline int columnCount() const { return m_columns.count(); }
+	/**
+	 * @brief rowCount
+	 * @return the amount of full rows. Values of a row not completed
+	 * yet are not counted.
+	 */
+	inline int rowCount() const { return m_columns.isEmpty() ? 0 : m_values.count() / m_columns.count(); }
+	inline bool isEmpty() const { return rowCount() == 0; }
+	inline QLatin1String command() const { return QLatin1String(m_command.constData(), m_command.count()); }
+	inline QLatin1String columnName(int c) const { return QLatin1String(m_columns.at(c).constData(), m_columns.at(c).count()); }
+	inline bool isNull(int row, int c) const { return m_values.at(row * m_columns.count() + c).len < 0; }
+	inline QLatin1String value(int row, int c) const
+	{
+		const Value &v = m_values.at(row * m_columns.count() + c);
+		return QLatin1String(m_data.constData() + v.offset, qMax(0, v.len));
+	}
+};
+}
+#endif // QBULKROWS_H
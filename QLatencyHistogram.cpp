@@ -0,0 +1,116 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+#include "QLatencyHistogram.h"
+
+using namespace ROS;
+
+/**
+ * @brief QLatencyHistogram::bucketOf
+ * Values below 16 have their own bucket. Bigger ones use 8 buckets
+ * per power of two.
+ * @param us The value.
+ * @return the bucket index.
+ */
+int QLatencyHistogram::bucketOf(qint64 us)
+{
+	if( us < SubBuckets * 2 )
+		return int(qMax<qint64>(us, 0));
+
+	int exp = 63;
+	while( !(quint64(us) & (Q_UINT64_C(1) << exp)) )
+		exp--;
+	int sub = int((quint64(us) >> (exp - SubBits)) & (SubBuckets - 1));
+	return SubBuckets * 2 + (exp - SubBits - 1) * SubBuckets + sub;
+}
+
+/**
+ * @brief QLatencyHistogram::bucketValue
+ * @param bucket The bucket index.
+ * @return the highest value that falls into bucket.
+ */
+qint64 QLatencyHistogram::bucketValue(int bucket)
+{
+	if( bucket < SubBuckets * 2 )
+		return bucket;
+
+	int exp = (bucket - SubBuckets * 2) / SubBuckets + SubBits + 1;
+	int sub = (bucket - SubBuckets * 2) % SubBuckets;
+	qint64 low = (qint64(SubBuckets + sub)) << (exp - SubBits);
+	return low + (Q_INT64_C(1) << (exp - SubBits)) - 1;
+}
+
+/**
+ * @brief QLatencyHistogram::record
+ * Adds a value to histogram.
+ * @param us The latency in microseconds.
+ */
+void QLatencyHistogram::record(qint64 us)
+{
+	if( m_buckets.isEmpty() )
+		m_buckets.fill(0, Buckets);
+	if( us < 0 )
+		us = 0;
+
+	m_buckets[bucketOf(us)]++;
+	if( !m_count || (us < m_min) )
+		m_min = us;
+	if( us > m_max )
+		m_max = us;
+	m_sum += us;
+	m_count++;
+}
+
+/**
+ * @brief QLatencyHistogram::clear
+ * Removes all values.
+ */
+void QLatencyHistogram::clear()
+{
+	m_buckets.clear();
+	m_count = 0;
+	m_sum = 0;
+	m_min = 0;
+	m_max = 0;
+}
+
+/**
+ * @brief QLatencyHistogram::percentile
+ * @param p The percentile, from 0 to 100.
+ * @return the value below which p percent of values fall. It's the
+ * upper limit of the bucket, but never more than max().
+ */
+qint64 QLatencyHistogram::percentile(double p) const
+{
+	if( !m_count )
+		return 0;
+
+	quint64 rank = quint64((p / 100.0) * double(m_count) + 0.5);
+	if( rank < 1 )
+		rank = 1;
+	quint64 seen = 0;
+	for( int i = 0; i < m_buckets.count(); i++ )
+	{
+		seen += m_buckets.at(i);
+		if( seen >= rank )
+			return qMin(bucketValue(i), m_max);
+	}
+	return m_max;
+}
@@ -0,0 +1,68 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QLATENCYHISTOGRAM_H
+#define QLATENCYHISTOGRAM_H
+
+#include <QVector>
+
+namespace ROS
+{
+
+/**
+ * @brief The QLatencyHistogram class
+ * Histogram of latencies, in microseconds, with log-linear buckets:
+ * every power of two is split in 8 buckets, so percentiles are accurate
+ * within 12.5% using a fixed, small amount of memory.
+ */
+class QLatencyHistogram
+{
+	enum
+	{
+		SubBits = 3,
+		SubBuckets = 1 << SubBits,
+		Buckets = SubBuckets * 2 + (64 - SubBits - 1) * SubBuckets
+	};
+
+	QVector<quint32> m_buckets;
+	quint64 m_count;
+	qint64 m_sum;
+	qint64 m_min;
+	qint64 m_max;
+
+	static int bucketOf(qint64 us);
+	static qint64 bucketValue(int bucket);
+
+public:
+	QLatencyHistogram() : m_count(0), m_sum(0), m_min(0), m_max(0) { }
+
+	void record(qint64 us);
+	void clear();
+
+	inline quint64 count() const { return m_count; }
+	inline qint64 min() const { return m_min; }
+	inline qint64 max() const { return m_max; }
+	inline qint64 mean() const { return m_count ? qint64(m_sum / qint64(m_count)) : 0; }
+	qint64 percentile(double p) const;
+	inline qint64 p50() const { return percentile(50.0); }
+	inline qint64 p99() const { return percentile(99.0); }
+};
+}
+#endif // QLATENCYHISTOGRAM_H
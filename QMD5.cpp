@@ -93,12 +93,44 @@ QString QMD5::charsToHex(const QByteArray &s)
 
 #include <QCryptographicHash>
 QString QMD5::encode(const QString &pass, const QString &seed)
+{
+	QByteArray s = seed.toLatin1();
+	return QString::fromLatin1(encode(pass.toLatin1(), s.constData(), s.count()));
+}
+
+/**
+ * @brief QMD5::encode
+ * @overload
+ * Encodes directly from latin1 bytes. The challenge is decoded on a
+ * stack buffer and the result is hex encoded in place, so just the
+ * returned array is allocated.
+ * @param pass The password as latin1 bytes.
+ * @param seed The challenge sent by ROS (the 32 hex chars "ret" value).
+ * @param seedLen The challenge length.
+ * @return The 32 hex chars of the response (without the "00" prefix).
+ */
+QByteArray QMD5::encode(const QByteArray &pass, const char *seed, int seedLen)
 {
 	QCryptographicHash encoder(QCryptographicHash::Md5);
 
 	encoder.addData("", 1);
-	encoder.addData(pass.toLatin1());
-	encoder.addData(QMD5::hexToChars(seed));
+	encoder.addData(pass);
+	if( seedLen == 32 )
+	{
+		char chars[16];
+		for( int i = 0; i < 32; i+=2 )
+			chars[i>>1] = hexToChar(seed[i+1], seed[i]);
+		encoder.addData(chars, 16);
+	}
+	else
+		encoder.addData(seed, seedLen);
 
-	return QMD5::charsToHex(encoder.result());
+	QByteArray hash = encoder.result();
+	QByteArray rtn(32, '0');
+	for( int i = 0; i < 16; ++i )
+	{
+		rtn[(i<<1)+1] = charToHex(hash[i] & 0xF);
+		rtn[i<<1] = charToHex((hash[i]>>4) & 0xF);
+	}
+	return rtn;
 }
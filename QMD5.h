@@ -33,6 +33,7 @@ class QMD5
 
 public:
 	static QString encode(const QString &pass, const QString &seed);
+	static QByteArray encode(const QByteArray &pass, const char *seed, int seedLen);
 };
 
 #endif // QMD5_H
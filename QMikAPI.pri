@@ -0,0 +1,19 @@
+#-------------------------------------------------
+#
+# Links the QMikAPI static library built by lib/QMikAPILib.pro.
+# Build QMikAPIAll.pro, so lib is built before the projects using it.
+#
+#-------------------------------------------------
+
+QT       += core network
+
+CONFIG += c++11
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+QMIKAPI_LIBDIR = $$shadowed($$PWD)/lib
+LIBS += -L$$QMIKAPI_LIBDIR -lQMikAPI
+
+win32-msvc*: PRE_TARGETDEPS += $$QMIKAPI_LIBDIR/QMikAPI.lib
+else: PRE_TARGETDEPS += $$QMIKAPI_LIBDIR/libQMikAPI.a
@@ -11,25 +11,25 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 TARGET = QMikAPI
 TEMPLATE = app
 
+CONFIG += c++11
+
+
+include(QMikAPI.pri)
 
 SOURCES += main.cpp\
-    QSentences.cpp \
-    QMD5.cpp \
     QIniFile.cpp \
-    Comm.cpp \
     QMikAPIExample.cpp
 
 HEADERS  += \
-    QSentences.h \
-    QMD5.h \
     QIniFile.h \
-    Comm.h \
     QMikAPIExample.h
 
 FORMS    += \
     QMikAPIExample.ui
 
 DISTFILES += \
+    QMikAPI.pri \
+    QMikAPILib.pri \
     README.md \
     COPYING.LESSER \
     COPYING \
@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# Builds library, example, CLI, benchmarks and mock server.
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS = \
+    lib \
+    example \
+    cli \
+    benchmarks \
+    mockserver
+
+lib.file = lib/QMikAPILib.pro
+example.file = QMikAPI.pro
+cli.file = cli/QMikCli.pro
+benchmarks.file = benchmarks/QMikAPIBench.pro
+mockserver.file = mockserver/QMikMockServer.pro
+
+example.depends = lib
+cli.depends = lib
+benchmarks.depends = lib
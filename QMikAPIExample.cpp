@@ -65,6 +65,8 @@ void QMikAPIExample::addLogText(const QString &txt)
 {
 	if( ui )
 	{
+		while( ui->lwResponses->count() >= MaxLogLines )
+			delete ui->lwResponses->takeItem(0);
 		ui->lwResponses->addItem(txt);
 		ui->lwResponses->scrollToBottom();
 	}
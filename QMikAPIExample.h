@@ -77,6 +77,9 @@ class QMikAPIExample : public QMainWindow
 	Ui::QMikAPIExample *ui;
 	ROS::Comm mktAPI;
 
+	// Oldest lines are dropped beyond this, so long listens don't grow the view forever.
+	enum { MaxLogLines = 5000 };
+
 	void addLogText(const QString &txt);
 public:
 	explicit QMikAPIExample(QWidget *parent = 0);
@@ -0,0 +1,41 @@
+#-------------------------------------------------
+#
+# QMikAPI library sources, with no widget dependency.
+# Built by lib/QMikAPILib.pro. Other projects include QMikAPI.pri.
+#
+#-------------------------------------------------
+
+QT       += core network
+
+CONFIG += c++11
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/QSentences.cpp \
+    $$PWD/QMD5.cpp \
+    $$PWD/Comm.cpp \
+    $$PWD/QLatencyHistogram.cpp \
+    $$PWD/CommPool.cpp \
+    $$PWD/ThreadedComm.cpp \
+    $$PWD/QTableMirror.cpp \
+    $$PWD/QQueryPredicate.cpp \
+    $$PWD/QBulkRows.cpp \
+    $$PWD/QResultSet.cpp \
+    $$PWD/QTableSnapshot.cpp
+
+HEADERS += \
+    $$PWD/QSentences.h \
+    $$PWD/QMD5.h \
+    $$PWD/Comm.h \
+    $$PWD/CommPool.h \
+    $$PWD/ThreadedComm.h \
+    $$PWD/QTableMirror.h \
+    $$PWD/QQueryPredicate.h \
+    $$PWD/QBulkRows.h \
+    $$PWD/QResultSet.h \
+    $$PWD/QTableSnapshot.h \
+    $$PWD/QSpscQueue.h \
+    $$PWD/QTagHash.h \
+    $$PWD/QLatencyHistogram.h
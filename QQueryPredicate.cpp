@@ -0,0 +1,241 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "QQueryPredicate.h"
+
+#include <QVarLengthArray>
+
+using namespace ROS;
+
+/**
+ * @brief QQueryPredicate::QQueryPredicate
+ * Compiles queries. If any is not valid, predicate matches no row and
+ * errorString tells why.
+ * @param queries The queries, in the order they would be sent.
+ */
+QQueryPredicate::QQueryPredicate(const QQueries &queries)
+{
+	for( int i = 0; i < queries.count(); i++ )
+		if( !compile(queries.at(i)) )
+			break;
+}
+
+/**
+ * @brief QQueryPredicate::QQueryPredicate
+ * @overload
+ * @param queryWords Query words, as "?type=ether" or "?#|".
+ */
+QQueryPredicate::QQueryPredicate(const QStringList &queryWords)
+{
+	QQueries queries(queryWords);
+	for( int i = 0; i < queries.count(); i++ )
+		if( !compile(queries.at(i)) )
+			break;
+}
+
+/**
+ * @brief QQueryPredicate::compile
+ * Appends the operations of a query.
+ * @return false if query is not valid.
+ */
+bool QQueryPredicate::compile(const QQuery &q)
+{
+	if( q.type != QQuery::Operation )
+	{
+		if( q.name.isEmpty() )
+		{
+			m_error = QString("Query without property name");
+			return false;
+		}
+		Op op;
+		switch( q.type )
+		{
+		case QQuery::HasProp:			op.code = PushHas;		break;
+		case QQuery::DontHasProp:		op.code = PushHasNot;	break;
+		case QQuery::EqualProp:			op.code = PushEqual;	break;
+		case QQuery::GreaterThanProp:	op.code = PushGreater;	break;
+		case QQuery::LessThanProp:		op.code = PushLess;		break;
+		default:						break;
+		}
+		op.name = q.name.toLatin1();
+		op.value = q.value;
+		op.number = q.value.toLongLong(&op.numeric);
+		m_ops.append(op);
+		return true;
+	}
+
+	const QString &ops = q.name;
+	for( int i = 0; i < ops.count(); i++ )
+	{
+		char c = ops.at(i).toLatin1();
+		switch( c )
+		{
+		case '|':	m_ops.append(Op(Or));	break;
+		case '&':	m_ops.append(Op(And));	break;
+		case '!':	m_ops.append(Op(Not));	break;
+		case '.':
+		{
+			Op op(Pick);
+			m_ops.append(op);
+			break;
+		}
+		default:
+			if( (c >= '0') && (c <= '9') )
+			{
+				Op op(Pick);
+				while( (i < ops.count()) && ops.at(i).isDigit() )
+					op.depth = op.depth * 10 + (ops.at(i++).toLatin1() - '0');
+				// An optional '.' just ends the number.
+				if( (i >= ops.count()) || (ops.at(i) != '.') )
+					i--;
+				m_ops.append(op);
+				break;
+			}
+			m_error = QString("Unknown query operation '%1'").arg(ops.at(i));
+			m_ops.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief QQueryPredicate::compare
+ * Compares a row value with query one.
+ * @return <0, 0 or >0 as row value is less, equal or greater.
+ */
+int QQueryPredicate::compare(const QQueryPredicate::Op &op, QLatin1String value)
+{
+	if( op.numeric )
+	{
+		bool ok;
+		qlonglong n = QString(value).toLongLong(&ok);
+		if( ok )
+			return (n < op.number) ? -1 : ((n > op.number) ? 1 : 0);
+	}
+	return -op.value.compare(value);
+}
+
+/**
+ * @brief pop
+ * Pops a value from stack.
+ * @return the value, or true if stack is empty.
+ */
+static inline bool pop(QVarLengthArray<bool, 32> &stack)
+{
+	if( stack.isEmpty() )
+		return true;
+	bool v = stack.last();
+	stack.removeLast();
+	return v;
+}
+
+/**
+ * @brief QQueryPredicate::matches
+ * Runs compiled queries against a row.
+ * @param row The row, as received from router. Its ID is the ".id"
+ * property.
+ * @return true if row matches.
+ */
+bool QQueryPredicate::matches(const QSentence &row) const
+{
+	if( !isValid() )
+		return false;
+
+	QVarLengthArray<bool, 32> stack;
+	const QBasicAttrib &attribs = row.attributes();
+	QByteArray id;
+
+	for( int i = 0; i < m_ops.count(); i++ )
+	{
+		const Op &op = m_ops.at(i);
+		switch( op.code )
+		{
+		case PushHas:
+		case PushHasNot:
+		case PushEqual:
+		case PushGreater:
+		case PushLess:
+		{
+			QLatin1String value;
+			bool has;
+			if( op.name == ".id" )
+			{
+				id = row.getID().toLatin1();
+				value = QLatin1String(id.constData(), id.count());
+				has = !id.isEmpty();
+			}
+			else
+			{
+				int a = attribs.indexOf(op.name.constData(), op.name.count());
+				has = a != -1;
+				if( has )
+					value = attribs.valueLatin1(a);
+			}
+			bool r;
+			switch( op.code )
+			{
+			case PushHas:		r = has;									break;
+			case PushHasNot:	r = !has;									break;
+			case PushEqual:		r = has && (value == op.value);				break;
+			case PushGreater:	r = has && (compare(op, value) > 0);		break;
+			default:			r = has && (compare(op, value) < 0);		break;
+			}
+			stack.append(r);
+			break;
+		}
+		case Or:
+		case And:
+		{
+			bool b = pop(stack);
+			bool a = pop(stack);
+			stack.append((op.code == Or) ? (a || b) : (a && b));
+			break;
+		}
+		case Not:
+			if( stack.isEmpty() )
+				stack.append(false);
+			else
+				stack.last() = !stack.last();
+			break;
+		case Pick:
+			stack.append((op.depth < stack.count()) ? stack.at(stack.count() - 1 - op.depth) : true);
+			break;
+		}
+	}
+	for( int i = 0; i < stack.count(); i++ )
+		if( !stack.at(i) )
+			return false;
+	return true;
+}
+
+/**
+ * @brief QQueryPredicate::filter
+ * @return the rows matching.
+ */
+QList<QSentence> QQueryPredicate::filter(const QList<QSentence> &rows) const
+{
+	QList<QSentence> found;
+	for( int i = 0; i < rows.count(); i++ )
+		if( matches(rows.at(i)) )
+			found.append(rows.at(i));
+	return found;
+}
@@ -0,0 +1,97 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QQUERYPREDICATE_H
+#define QQUERYPREDICATE_H
+
+#include <QVector>
+#include <QByteArray>
+
+#include "QSentences.h"
+
+namespace ROS
+{
+
+/**
+ * @brief The QQueryPredicate class
+ * QQueries compiled to run locally against rows, with the same stack
+ * semantics router uses:
+ * - Property queries push true or false.
+ * - Operation ones ("?#") apply their operations to the stack: '|' and
+ * '&' pop two values and push the result, '!' negates the top value,
+ * '.' pushes a copy of top value and a number pushes a copy of the
+ * value at that depth (0 is top). A '.' after a number just ends it.
+ * - A row matches if all values left on stack are true. An empty
+ * stack matches.
+ * Popping from an empty stack gives true.
+ * "<" and ">" compare numerically if both values are integers and as
+ * strings otherwise.
+ */
+class QQueryPredicate
+{
+	enum OpCode
+	{
+		PushHas,
+		PushHasNot,
+		PushEqual,
+		PushGreater,
+		PushLess,
+		Or,
+		And,
+		Not,
+		Pick
+	};
+	struct Op
+	{
+		OpCode code;
+		QByteArray name;	// Latin1 property name.
+		QString value;
+		qlonglong number;	// value as integer, if numeric.
+		bool numeric;
+		int depth;			// For Pick.
+		Op(OpCode c = Or) : code(c), number(0), numeric(false), depth(0) { }
+	};
+
+	QVector<Op> m_ops;
+	QString m_error;
+
+	bool compile(const QQuery &q);
+	static int compare(const Op &op, QLatin1String value);
+
+public:
+	/**
+	 * @brief QQueryPredicate
+	 * Creates a predicate matching any row.
+	 */
+	QQueryPredicate() { }
+	explicit QQueryPredicate(const QQueries &queries);
+	explicit QQueryPredicate(const QStringList &queryWords);
+
+	inline bool isValid() const { return m_error.isEmpty(); }
+	inline const QString &errorString() const { return m_error; }
+	inline bool isEmpty() const { return m_ops.isEmpty(); }
+
+	bool matches(const QSentence &row) const;
+	inline bool operator()(const QSentence &row) const { return matches(row); }
+	QList<QSentence> filter(const QList<QSentence> &rows) const;
+};
+}
+#endif // QQUERYPREDICATE_H
@@ -0,0 +1,501 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "QResultSet.h"
+
+#include <QIODevice>
+
+using namespace ROS;
+
+/**
+ * @brief QResultSet::clear
+ * Removes all rows and columns.
+ */
+void QResultSet::clear()
+{
+	m_columns.clear();
+	m_byName.clear();
+	m_byNameID.clear();
+	m_names.clear();
+	m_rows = 0;
+}
+
+/**
+ * @brief QResultSet::setBit
+ * Sets a bit on a bitmap, growing it if needed.
+ */
+void QResultSet::setBit(QByteArray &bits, int i, bool set)
+{
+	if( (i >> 3) >= bits.count() )
+		bits.append('\0');
+	if( set )
+		bits[i >> 3] = char(bits.at(i >> 3) | (1 << (i & 7)));
+	else
+		bits[i >> 3] = char(bits.at(i >> 3) & ~(1 << (i & 7)));
+}
+
+/**
+ * @brief QResultSet::parseInt
+ * Parses a canonical integer: optional '-' and up to 18 digits,
+ * without leading zeros. So, converting it back to text gives the
+ * same bytes.
+ * @return true if chars are a canonical integer.
+ */
+bool QResultSet::parseInt(const char *s, int len, qint64 *v)
+{
+	bool neg = (len > 1) && (s[0] == '-');
+	if( neg )
+	{
+		s++;
+		len--;
+	}
+	if( (len < 1) || (len > 18) || ((s[0] == '0') && ((len > 1) || neg)) )
+		return false;
+
+	qint64 n = 0;
+	for( int i = 0; i < len; i++ )
+	{
+		if( (s[i] < '0') || (s[i] > '9') )
+			return false;
+		n = n * 10 + (s[i] - '0');
+	}
+	*v = neg ? -n : n;
+	return true;
+}
+
+/**
+ * @brief QResultSet::column
+ * Finds or creates the column for a name. New columns have a null for
+ * every row already appended.
+ * @param name The name latin1 chars.
+ * @param len The name length.
+ * @return the column index.
+ */
+int QResultSet::column(const char *name, int len)
+{
+	QByteArray key = QByteArray::fromRawData(name, len);
+	QHash<QByteArray, int>::const_iterator it = m_byName.constFind(key);
+	if( it != m_byName.constEnd() )
+		return it.value();
+
+	Column c;
+	c.name = QByteArray(name, len);
+	c.count = m_rows;
+	c.validity = QByteArray((m_rows + 7) / 8, '\0');
+	m_columns.append(c);
+	m_byName.insert(c.name, m_columns.count() - 1);
+	return m_columns.count() - 1;
+}
+
+/**
+ * @brief QResultSet::column
+ * Finds or creates the column of attribute i. Names interned on the
+ * attribute name table are found by id, without hashing them.
+ */
+int QResultSet::column(const QBasicAttrib &attribs, int i)
+{
+	int id = attribs.nameID(i);
+	if( (id >= 0) && (id < m_byNameID.count()) && (m_byNameID.at(id) != -1) )
+		return m_byNameID.at(id);
+
+	QLatin1String name = attribs.nameLatin1(i);
+	int c = column(name.data(), name.size());
+	if( id >= 0 )
+	{
+		while( id >= m_byNameID.count() )
+			m_byNameID.append(-1);
+		m_byNameID[id] = c;
+	}
+	return c;
+}
+
+/**
+ * @brief QResultSet::toText
+ * Changes an IntColumn or BoolColumn to TextColumn. Values are
+ * converted back to the text received.
+ */
+void QResultSet::toText(Column &c)
+{
+	QVector<qint32> offsets;
+	QByteArray data;
+	offsets.reserve(c.count + 1);
+	offsets.append(0);
+	for( int r = 0; r < c.count; r++ )
+	{
+		if( bit(c.validity, r) )
+		{
+			if( c.kind == IntColumn )
+				data.append(QByteArray::number(c.ints.at(r)));
+			else
+				data.append(bit(c.bools, r) ? "true" : "false");
+		}
+		offsets.append(data.count());
+	}
+	c.ints.clear();
+	c.bools.clear();
+	c.offsets.swap(offsets);
+	c.data.swap(data);
+	c.kind = TextColumn;
+}
+
+/**
+ * @brief QResultSet::append
+ * Appends a value to a column. Column type is chosen by his first
+ * value and becomes TextColumn once a value doesn't fit his type.
+ */
+void QResultSet::append(Column &c, const char *value, int len)
+{
+	qint64 n = 0;
+	bool isInt = (c.kind == IntColumn || c.kind == NullColumn) && parseInt(value, len, &n);
+	bool isBool = !isInt && ((len == 4 && !memcmp(value, "true", 4)) || (len == 5 && !memcmp(value, "false", 5)));
+
+	if( c.kind == NullColumn )
+	{
+		if( isInt )
+		{
+			c.kind = IntColumn;
+			c.ints.fill(0, c.count);
+		}
+		else
+		if( isBool )
+		{
+			c.kind = BoolColumn;
+			c.bools = QByteArray((c.count + 7) / 8, '\0');
+		}
+		else
+		{
+			c.kind = TextColumn;
+			c.offsets.fill(0, c.count + 1);
+		}
+	}
+	else
+	if( ((c.kind == IntColumn) && !isInt) || ((c.kind == BoolColumn) && !isBool) )
+		toText(c);
+
+	switch( c.kind )
+	{
+	case IntColumn:
+		c.ints.append(n);
+		break;
+	case BoolColumn:
+		setBit(c.bools, c.count, len == 4);
+		break;
+	default:
+		c.data.append(value, len);
+		c.offsets.append(c.data.count());
+		break;
+	}
+	setBit(c.validity, c.count, true);
+	c.count++;
+}
+
+/**
+ * @brief QResultSet::appendNull
+ * Appends a null to a column.
+ */
+void QResultSet::appendNull(Column &c)
+{
+	switch( c.kind )
+	{
+	case IntColumn:
+		c.ints.append(0);
+		break;
+	case BoolColumn:
+		setBit(c.bools, c.count, false);
+		break;
+	case TextColumn:
+		c.offsets.append(c.offsets.last());
+		break;
+	default:
+		break;
+	}
+	setBit(c.validity, c.count, false);
+	c.count++;
+}
+
+/**
+ * @brief QResultSet::append
+ * Appends a row. Values are copied from the attribute arena, so the
+ * sentence can be reused after call.
+ * If a name is repeated on the row, first value is kept.
+ * @param row The sentence with the row attributes.
+ */
+void QResultSet::append(const QSentence &row)
+{
+	const QBasicAttrib &attribs = row.attributes();
+	if( m_names != attribs.nameTable() )
+	{
+		// Name ids are from another table.
+		m_byNameID.clear();
+		m_names = attribs.nameTable();
+	}
+
+	for( int i = 0; i < attribs.count(); i++ )
+	{
+		Column &c = m_columns[column(attribs, i)];
+		if( c.count == m_rows )
+		{
+			QLatin1String value = attribs.valueLatin1(i);
+			append(c, value.data(), value.size());
+		}
+	}
+	if( !row.getID().isEmpty() )
+	{
+		Column &c = m_columns[column(".id", 3)];
+		if( c.count == m_rows )
+		{
+			QByteArray id = row.getID().toLatin1();
+			append(c, id.constData(), id.count());
+		}
+	}
+
+	m_rows++;
+	for( int i = 0; i < m_columns.count(); i++ )
+	{
+		if( m_columns.at(i).count < m_rows )
+			appendNull(m_columns[i]);
+	}
+}
+
+/**
+ * @brief QResultSet::columnIndex
+ * @param name The attribute name. Row id column is ".id"
+ * @return the column index or -1 if no row has this attribute.
+ */
+int QResultSet::columnIndex(const QString &name) const
+{
+	return m_byName.value(name.toLatin1(), -1);
+}
+
+/**
+ * @brief QResultSet::value
+ * @return the value as text or null string if row has not it.
+ */
+QString QResultSet::value(int row, int c) const
+{
+	if( isNull(row, c) )
+		return QString();
+
+	const Column &col = m_columns.at(c);
+	switch( col.kind )
+	{
+	case IntColumn:
+		return QString::number(col.ints.at(row));
+	case BoolColumn:
+		return bit(col.bools, row) ? QString("true") : QString("false");
+	default:
+		return QString(text(row, c));
+	}
+}
+
+/**
+ * @brief QResultSet::text
+ * The value chars of a TextColumn, without copying them.
+ * @return the value or an empty string if row has not it or column is
+ * not a TextColumn.
+ */
+QLatin1String QResultSet::text(int row, int c) const
+{
+	const Column &col = m_columns.at(c);
+	if( col.kind != TextColumn )
+		return QLatin1String("");
+	int from = col.offsets.at(row);
+	return QLatin1String(col.data.constData() + from, col.offsets.at(row + 1) - from);
+}
+
+/**
+ * @brief QResultSet::intValue
+ * @param ok Set to false if row has no value or column is not an
+ * IntColumn. Can be NULL.
+ * @return the integer value or 0.
+ */
+qint64 QResultSet::intValue(int row, int c, bool *ok) const
+{
+	bool valid = (m_columns.at(c).kind == IntColumn) && !isNull(row, c);
+	if( ok )
+		*ok = valid;
+	return valid ? m_columns.at(c).ints.at(row) : 0;
+}
+
+/**
+ * @brief QResultSet::boolValue
+ * @param ok Set to false if row has no value or column is not a
+ * BoolColumn. Can be NULL.
+ * @return the boolean value or false.
+ */
+bool QResultSet::boolValue(int row, int c, bool *ok) const
+{
+	bool valid = (m_columns.at(c).kind == BoolColumn) && !isNull(row, c);
+	if( ok )
+		*ok = valid;
+	return valid && bit(m_columns.at(c).bools, row);
+}
+
+/**
+ * @brief QResultSet::sum
+ * @return the sum of all values of an IntColumn. 0 for other columns.
+ */
+qint64 QResultSet::sum(int c) const
+{
+	const qint64 *v = intData(c);
+	qint64 total = 0;
+	if( v )
+	{
+		// Null rows are stored as 0, so validity is not checked.
+		for( int r = 0; r < m_rows; r++ )
+			total += v[r];
+	}
+	return total;
+}
+
+/**
+ * @brief QResultSet::buffers
+ * Column memory with Arrow layout, to be exported without copying.
+ * values holds int64 values for IntColumn, a bitmap for BoolColumn and
+ * rowCount()+1 int32 offsets into data for TextColumn.
+ * @param c The column index.
+ */
+QResultSet::Buffers QResultSet::buffers(int c) const
+{
+	const Column &col = m_columns.at(c);
+	Buffers b;
+	b.kind = col.kind;
+	b.validity = col.validity;
+	switch( col.kind )
+	{
+	case IntColumn:
+		b.values = QByteArray::fromRawData(reinterpret_cast<const char*>(col.ints.constData()), col.ints.count() * int(sizeof(qint64)));
+		break;
+	case BoolColumn:
+		b.values = col.bools;
+		break;
+	case TextColumn:
+		b.values = QByteArray::fromRawData(reinterpret_cast<const char*>(col.offsets.constData()), col.offsets.count() * int(sizeof(qint32)));
+		b.data = col.data;
+		break;
+	default:
+		break;
+	}
+	return b;
+}
+
+/**
+ * @brief QResultSet::writeCsv
+ * Writes all rows as CSV (RFC 4180). First line has column names.
+ * Null values are empty fields. Fields are quoted only if needed.
+ * @param dev The device to write to.
+ * @param separator Field separator.
+ * @return false if device could not write all data.
+ */
+bool QResultSet::writeCsv(QIODevice *dev, char separator) const
+{
+	QByteArray out;
+	out.reserve(0x10000);
+
+	for( int r = -1; r < m_rows; r++ )
+	{
+		for( int c = 0; c < m_columns.count(); c++ )
+		{
+			if( c )
+				out.append(separator);
+
+			const Column &col = m_columns.at(c);
+			if( r == -1 )
+				out.append(col.name);
+			else
+			if( isNull(r, c) )
+				continue;
+			else
+			if( col.kind == IntColumn )
+				out.append(QByteArray::number(col.ints.at(r)));
+			else
+			if( col.kind == BoolColumn )
+				out.append(bit(col.bools, r) ? "true" : "false");
+			else
+			{
+				QLatin1String v = text(r, c);
+				bool quote = false;
+				for( int i = 0; !quote && (i < v.size()); i++ )
+					quote = (v.data()[i] == separator) || (v.data()[i] == '"') || (v.data()[i] == '\n') || (v.data()[i] == '\r');
+				if( !quote )
+					out.append(v.data(), v.size());
+				else
+				{
+					out.append('"');
+					for( int i = 0; i < v.size(); i++ )
+					{
+						if( v.data()[i] == '"' )
+							out.append('"');
+						out.append(v.data()[i]);
+					}
+					out.append('"');
+				}
+			}
+		}
+		out.append("\r\n");
+		if( out.count() >= 0x10000 )
+		{
+			if( dev->write(out) != out.count() )
+				return false;
+			out.resize(0);
+		}
+	}
+	return dev->write(out) == out.count();
+}
+
+/**
+ * @brief QResultSet::memoryUsage
+ * @return bytes used by column data.
+ */
+quint64 QResultSet::memoryUsage() const
+{
+	quint64 bytes = 0;
+	for( int c = 0; c < m_columns.count(); c++ )
+	{
+		const Column &col = m_columns.at(c);
+		bytes += quint64(col.name.capacity() + col.validity.capacity() + col.bools.capacity() + col.data.capacity());
+		bytes += quint64(col.ints.capacity()) * sizeof(qint64);
+		bytes += quint64(col.offsets.capacity()) * sizeof(qint32);
+	}
+	return bytes;
+}
+
+/**
+ * @brief QResultSet::fetch
+ * Sends sent with Comm::streamSentence and appends every row to rs.
+ * Rows go from the decoded sentence straight into columns; no sentence
+ * is kept per row.
+ * @param comm The connection.
+ * @param sent The command, usually a print.
+ * @param rs The result set receiving the rows.
+ * @param onDone Called once all rows are appended.
+ * @return the command tag.
+ */
+QString QResultSet::fetch(Comm &comm, const QSentence &sent, const QSharedPointer<QResultSet> &rs, const Comm::DoneHandler &onDone)
+{
+	QSharedPointer<QResultSet> set = rs;
+	return comm.streamSentence(sent,
+		[set](QSentence &s)
+		{
+			set->append(s);
+			return true;
+		}, onDone);
+}
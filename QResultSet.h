@@ -0,0 +1,139 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QRESULTSET_H
+#define QRESULTSET_H
+
+#include <QVector>
+#include <QByteArray>
+#include <QHash>
+
+#include "QSentences.h"
+#include "Comm.h"
+
+class QIODevice;
+
+namespace ROS
+{
+
+/**
+ * @brief The QResultSet class
+ * Rows of a command reply stored by column, for big print replies.
+ * Every attribute name is a column. Values are kept on contiguous
+ * arrays with an Arrow-like layout:
+ * - validity bitmap, one bit per row (LSB first), set if row has it;
+ * - IntColumn: an int64 per row;
+ * - BoolColumn: a bitmap of values;
+ * - TextColumn: int32 offsets (rows + 1) into latin1 data bytes.
+ * Columns are typed while all their values are canonical integers or
+ * "true"/"false", so no information is lost. Otherwise they fall back
+ * to text. Row .id is the ".id" column.
+ * Rows are appended straight from the decoded sentence, which is not
+ * kept, so no QSentence per row is allocated.
+ */
+class QResultSet
+{
+public:
+	enum ColumnKind
+	{
+		NullColumn,		// No row has a value yet.
+		IntColumn,
+		BoolColumn,
+		TextColumn
+	};
+
+	/**
+	 * @brief The Buffers struct
+	 * Column data for export, without copying it. validity and data
+	 * are shared with the column. values points into column memory, so
+	 * it's valid until result set is changed or destroyed.
+	 */
+	struct Buffers
+	{
+		ColumnKind kind;
+		QByteArray validity;
+		QByteArray values;		// int64 values, bool bitmap or int32 offsets.
+		QByteArray data;		// Text bytes.
+	};
+
+private:
+	struct Column
+	{
+		QByteArray name;
+		ColumnKind kind;
+		int count;				// Rows appended, including nulls.
+		QByteArray validity;
+		QVector<qint64> ints;
+		QByteArray bools;
+		QVector<qint32> offsets;
+		QByteArray data;
+		Column() : kind(NullColumn), count(0) { }
+	};
+
+	QVector<Column> m_columns;
+	QHash<QByteArray, int> m_byName;
+	QVector<int> m_byNameID;		// Column by name id of m_names.
+	QAttribNamesPtr m_names;
+	int m_rows;
+
+	int column(const QBasicAttrib &attribs, int i);
+	int column(const char *name, int len);
+	void append(Column &c, const char *value, int len);
+	void appendNull(Column &c);
+	void toText(Column &c);
+	static void setBit(QByteArray &bits, int i, bool set);
+	static inline bool bit(const QByteArray &bits, int i) { return (bits.constData()[i >> 3] >> (i & 7)) & 1; }
+	static bool parseInt(const char *s, int len, qint64 *v);
+
+public:
+	QResultSet() : m_rows(0) { }
+
+	void clear();
+	void append(const QSentence &row);
+
+	inline int rowCount() const { return m_rows; }
+	inline int columnCount() const { return m_columns.count(); }
+	inline const QByteArray &columnName(int c) const { return m_columns.at(c).name; }
+	int columnIndex(const QString &name) const;
+	inline ColumnKind columnKind(int c) const { return m_columns.at(c).kind; }
+
+	inline bool isNull(int row, int c) const { return (m_columns.at(c).kind == NullColumn) || !bit(m_columns.at(c).validity, row); }
+	QString value(int row, int c) const;
+	qint64 intValue(int row, int c, bool *ok = NULL) const;
+	bool boolValue(int row, int c, bool *ok = NULL) const;
+	QLatin1String text(int row, int c) const;
+	/**
+	 * @brief intData
+	 * Values of an IntColumn, to scan them without any call per row.
+	 * Null rows are 0.
+	 * @return the values or NULL if column is not an IntColumn.
+	 */
+	inline const qint64 *intData(int c) const { return (m_columns.at(c).kind == IntColumn) ? m_columns.at(c).ints.constData() : NULL; }
+	qint64 sum(int c) const;
+
+	Buffers buffers(int c) const;
+	bool writeCsv(QIODevice *dev, char separator = ',') const;
+	quint64 memoryUsage() const;
+
+	static QString fetch(Comm &comm, const QSentence &sent, const QSharedPointer<QResultSet> &rs, const Comm::DoneHandler &onDone);
+};
+}
+#endif // QRESULTSET_H
@@ -20,6 +20,8 @@
 
 #include "QSentences.h"
 
+#include <string.h>
+
 using namespace ROS;
 
 /**
@@ -50,24 +52,341 @@ bool splitWord(const QString &word, QString &name, QString &value, int from)
 	}
 	else
 	{
-		name = word.right(from);
+		name = word.mid(from);
 		return false;
 	}
 }
 
+/**
+ * @brief QAttribNames::hash
+ * FNV-1a hash of name bytes.
+ */
+uint QAttribNames::hash(const char *name, int len)
+{
+	uint h = 2166136261u;
+	for( int i = 0; i < len; i++ )
+		h = (h ^ uchar(name[i])) * 16777619u;
+	return h;
+}
+
+/**
+ * @brief QAttribNames::lookup
+ * Finds the bucket for a name.
+ * @return the bucket index where the name is or where it must be placed.
+ */
+int QAttribNames::lookup(const char *name, int len, uint h) const
+{
+	int mask = m_buckets.count() - 1;
+	int b = int(h & uint(mask));
+	for( ;; b = (b + 1) & mask )
+	{
+		int id = m_buckets.at(b);
+		if( id == -1 )
+			return b;
+		const QByteArray &n = m_latin1.at(id);
+		if( (n.count() == len) && !memcmp(n.constData(), name, len) )
+			return b;
+	}
+}
+
+/**
+ * @brief QAttribNames::rehash
+ * Rebuilds buckets with a new size. Size must be a power of 2.
+ */
+void QAttribNames::rehash(int size)
+{
+	m_buckets.fill(-1, size);
+	for( int id = 0; id < m_latin1.count(); id++ )
+	{
+		const QByteArray &n = m_latin1.at(id);
+		m_buckets[lookup(n.constData(), n.count(), hash(n.constData(), n.count()))] = id;
+	}
+}
+
+/**
+ * @brief QAttribNames::find
+ * Looks for a name without adding it.
+ * @param name The name latin1 chars.
+ * @param len The name length.
+ * @return the name id or -1 if it's not on table.
+ */
+int QAttribNames::find(const char *name, int len) const
+{
+	if( m_buckets.isEmpty() )
+		return -1;
+	return m_buckets.at(lookup(name, len, hash(name, len)));
+}
+
+/**
+ * @brief QAttribNames::find
+ * @overload
+ */
+int QAttribNames::find(const QString &name) const
+{
+	QByteArray n = name.toLatin1();
+	return find(n.constData(), n.count());
+}
+
+/**
+ * @brief QAttribNames::intern
+ * Gets the id of a name, adding it to table if it's not there yet.
+ * Table is limited to maxNames (as set on constructor) to avoid
+ * growing forever with unexpected data. Once full, new names are
+ * not added.
+ * @param name The name latin1 chars.
+ * @param len The name length.
+ * @return the name id or -1 if table is full.
+ */
+int QAttribNames::intern(const char *name, int len)
+{
+	if( m_buckets.isEmpty() )
+		rehash(64);
+
+	uint h = hash(name, len);
+	int b = lookup(name, len, h);
+	if( m_buckets.at(b) != -1 )
+		return m_buckets.at(b);
+
+	if( m_names.count() >= m_maxNames )
+		return -1;
+
+	int id = m_names.count();
+	m_latin1.append(QByteArray(name, len));
+	m_names.append(QString::fromLatin1(name, len));
+	m_buckets[b] = id;
+
+	// Keep at least half of buckets empty.
+	if( (m_names.count() * 2) > m_buckets.count() )
+		rehash(m_buckets.count() * 2);
+	return id;
+}
+
+/**
+ * @brief QAttribNames::intern
+ * @overload
+ */
+int QAttribNames::intern(const QString &name)
+{
+	QByteArray n = name.toLatin1();
+	return intern(n.constData(), n.count());
+}
+
+/**
+ * @brief QBasicAttrib::clear
+ * Removes all attributes.
+ */
+void QBasicAttrib::clear()
+{
+	m_entries.clear();
+	m_arena.resize(0);
+	m_typed.resize(0);
+}
+
+/**
+ * @brief QBasicAttrib::reserve
+ * Reserves memory for attributes to avoid reallocations while adding them.
+ * Reserved memory is kept even after clear() is called. So, reserving
+ * memory is a good idea on sentences that are reused over and over.
+ * @param attribs The amount of attributes.
+ * @param bytes The total bytes of names and values.
+ */
+void QBasicAttrib::reserve(int attribs, int bytes)
+{
+	m_entries.reserve(attribs);
+	m_arena.reserve(bytes);
+}
+
+/**
+ * @brief QBasicAttrib::swap
+ * Swaps all attributes with other ones. No attribute is copied.
+ */
+void QBasicAttrib::swap(QBasicAttrib &other)
+{
+	qSwap(firstCh, other.firstCh);
+	m_entries.swap(other.m_entries);
+	m_arena.swap(other.m_arena);
+	m_names.swap(other.m_names);
+	m_typed.swap(other.m_typed);
+}
+
+/**
+ * @brief QBasicAttrib::internNames
+ * Interns on name table all names added while it wasn't set.
+ * Name bytes are left on arena. It allows decoding sentences on any
+ * thread without a name table and interning names later, in the
+ * thread owning the table.
+ */
+void QBasicAttrib::internNames()
+{
+	if( m_names.isNull() )
+		return;
+	for( int i = 0; i < m_entries.count(); i++ )
+	{
+		Entry &e = m_entries[i];
+		if( e.nameID < 0 )
+			e.nameID = m_names->intern(m_arena.constData() + e.name, e.nameLen);
+	}
+}
+
+/**
+ * @brief QBasicAttrib::externNames
+ * Copies interned names into arena and drops the name table, so
+ * attributes can be read on another thread than the one owning the
+ * table. Lookups by name id fail afterwards.
+ */
+void QBasicAttrib::externNames()
+{
+	if( m_names.isNull() )
+		return;
+	for( int i = 0; i < m_entries.count(); i++ )
+	{
+		Entry &e = m_entries[i];
+		if( e.nameID >= 0 )
+		{
+			QLatin1String name = m_names->nameLatin1(e.nameID);
+			e.name = appendToArena(name.data(), name.size());
+			e.nameID = -1;
+		}
+	}
+	m_names.clear();
+}
+
+/**
+ * @brief QBasicAttrib::appendToArena
+ * Copies bytes at the end of arena.
+ * @return the position into the arena where bytes are copied.
+ */
+int QBasicAttrib::appendToArena(const char *data, int len)
+{
+	int pos = m_arena.count();
+	m_arena.append(data, len);
+	return pos;
+}
+
+/**
+ * @brief QBasicAttrib::appendToArena
+ * Copies a part of a string at the end of arena as latin1 chars.
+ * Chars out of latin1 range are replaced by '?', as toLatin1() does.
+ * @return the position into the arena where chars are copied.
+ */
+int QBasicAttrib::appendToArena(const QString &s, int from, int len)
+{
+	int pos = m_arena.count();
+	m_arena.resize(pos + len);
+
+	char *dest = m_arena.data() + pos;
+	const QChar *src = s.constData() + from;
+	for( int i = 0; i < len; i++ )
+		dest[i] = (src[i].unicode() > 0xFF) ? '?' : char(src[i].unicode());
+	return pos;
+}
+
+/**
+ * @brief QBasicAttrib::setValue
+ * Sets the value position of an existing attribute.
+ * Old value bytes are left on arena until clear() is called.
+ */
+void QBasicAttrib::setValue(int i, int value, int valueLen)
+{
+	Entry &e = m_entries[i];
+	e.value = value;
+	e.valueLen = valueLen;
+	if( i < m_typed.count() )
+		m_typed[i] = Typed();
+}
+
+/**
+ * @brief QBasicAttrib::indexOf
+ * Looks for an attribute by name.
+ * @param name The attribute name.
+ * @return the attribute index or -1 if not found.
+ */
+int QBasicAttrib::indexOf(const QString &name) const
+{
+	int len = name.count();
+	for( int i = 0; i < m_entries.count(); i++ )
+		if( (m_entries.at(i).nameLen == len) && (nameLatin1(i) == name) )
+			return i;
+	return -1;
+}
+
+/**
+ * @brief QBasicAttrib::indexOf
+ * @overload
+ * @param name The attribute name latin1 chars.
+ * @param len The name length.
+ */
+int QBasicAttrib::indexOf(const char *name, int len) const
+{
+	for( int i = 0; i < m_entries.count(); i++ )
+		if( (m_entries.at(i).nameLen == len) && !memcmp(nameLatin1(i).data(), name, len) )
+			return i;
+	return -1;
+}
+
+/**
+ * @brief QBasicAttrib::indexOf
+ * @overload
+ * @param nameID The interned name id.
+ */
+int QBasicAttrib::indexOf(int nameID) const
+{
+	for( int i = 0; i < m_entries.count(); i++ )
+		if( m_entries.at(i).nameID == nameID )
+			return i;
+	return -1;
+}
+
+/**
+ * @brief QBasicAttrib::value
+ * @param name The attribute name.
+ * @return The attribute value or empty string if there is no attribute
+ * with this name.
+ */
+QString QBasicAttrib::value(const QString &name) const
+{
+	int i = indexOf(name);
+	return (i == -1) ? QString() : value(i);
+}
+
+/**
+ * @brief QBasicAttrib::valueByID
+ * Looks up a value by his interned name id.
+ * @param nameID The interned name id.
+ * @return the value or empty string if there is no such attribute.
+ */
+QString QBasicAttrib::valueByID(int nameID) const
+{
+	int i = (nameID < 0) ? -1 : indexOf(nameID);
+	return (i == -1) ? QString() : value(i);
+}
+
+/**
+ * @brief QBasicAttrib::keys
+ * @return all attribute names in insertion order.
+ */
+QStringList QBasicAttrib::keys() const
+{
+	QStringList rtn;
+	for( int i = 0; i < m_entries.count(); i++ )
+		rtn.append(name(i));
+	return rtn;
+}
+
 /**
  * @brief QBasicAttrib::toWords
  * Creates a list of words.
  * This function uses the function "toWord" internally to make conversion.
  * It's used to create the correct word to be sent to ROS.
+ * Words are in the same order attributes were added.
  * @return A list of strings representing words.
  */
 QStringList QBasicAttrib::toWords() const
 {
 	QStringList rtn;
 
-	foreach( QString key, keys() )
-		rtn.append(toWord(key));
+	for( int i = 0; i < m_entries.count(); i++ )
+		rtn.append(toWord(i));
 
 	return rtn;
 }
@@ -91,18 +410,31 @@ QStringList QBasicAttrib::toWords() const
  */
 QString QBasicAttrib::toWord(const QString &name) const
 {
-	QString val = value(name);
-	if( !val.isEmpty() )
-		return QString("%1%2=%3").arg(firstCh).arg(name,val);
-	if( name.startsWith('!') )
-		return QString("%1%2").arg(firstCh).arg(name);
-	return QString();
+	int i = indexOf(name);
+	return (i == -1) ? QString() : toWord(i);
+}
+
+/**
+ * @brief QBasicAttrib::toWord
+ * @overload
+ * @param i The attribute index.
+ */
+QString QBasicAttrib::toWord(int i) const
+{
+	QString rtn(1, QChar(firstCh));
+	rtn.append(nameLatin1(i));
+	const Entry &e = m_entries.at(i);
+	if( (e.valueLen == 0) && (e.nameLen > 0) && (m_arena.at(e.name) == '!') )
+		return rtn;
+	rtn.append(QChar('='));
+	rtn.append(valueLatin1(i));
+	return rtn;
 }
 
 /**
  * @brief QBasicAttrib::addWord
- * Inserts a new par name-value into internal mapping.
- * Note that internal mapping doesn't allow duplicate names. Si
+ * Inserts a new par name-value.
+ * Note that duplicate names are not allowed. So
  * inserting a name that already exists, will replace value instead
  * of append a new one.
  * @param name The name of the attribute.
@@ -112,7 +444,69 @@ QString QBasicAttrib::toWord(const QString &name) const
  */
 void QBasicAttrib::addWord(const QString &name, const QString &value)
 {
-	insert(name, value);
+	int i = indexOf(name);
+	int v = appendToArena(value, 0, value.count());
+	if( i != -1 )
+		setValue(i, v, value.count());
+	else
+	{
+		Entry e;
+		e.nameID = -1;
+		e.value = v;
+		e.valueLen = value.count();
+		e.name = appendToArena(name, 0, name.count());
+		e.nameLen = name.count();
+		m_entries.append(e);
+	}
+}
+
+/**
+ * @brief QBasicAttrib::addWord
+ * Inserts a new par name-value from latin1 chars.
+ * This is the fastest way to add attributes as no string is
+ * created: bytes are copied directly into arena.
+ * If a name table is set, name is interned and only value is copied.
+ * @param name The name of the attribute.
+ * @param nameLen name length.
+ * @param value The value of attribute.
+ * @param valueLen value length. Can be 0.
+ */
+void QBasicAttrib::addWord(const char *name, int nameLen, const char *value, int valueLen)
+{
+	int id = m_names.isNull() ? -1 : m_names->intern(name, nameLen);
+	if( id >= 0 )
+	{
+		int i = indexOf(id);
+		int v = appendToArena(value, valueLen);
+		if( i != -1 )
+			setValue(i, v, valueLen);
+		else
+		{
+			Entry e;
+			e.nameID = id;
+			e.name = 0;
+			e.nameLen = nameLen;
+			e.value = v;
+			e.valueLen = valueLen;
+			m_entries.append(e);
+		}
+		return;
+	}
+
+	int i = indexOf(name, nameLen);
+	int v = appendToArena(value, valueLen);
+	if( i != -1 )
+		setValue(i, v, valueLen);
+	else
+	{
+		Entry e;
+		e.nameID = -1;
+		e.value = v;
+		e.valueLen = valueLen;
+		e.name = appendToArena(name, nameLen);
+		e.nameLen = nameLen;
+		m_entries.append(e);
+	}
 }
 
 /**
@@ -134,7 +528,8 @@ void QBasicAttrib::addWords(const QStringList &words)
 /**
  * @brief QBasicAttrib::addWord
  * Adds a word (a pair of name/value for attribute)
- * word parameter will be parsed by splitWord function.
+ * word parameter is splited at the first '=' character after name
+ * begining, with no temporary strings for name and value.
  * If firs char stored in class is the same as first
  * char in word parameter, it will be ignored.
  * For example. If first char in class is '='
@@ -150,10 +545,348 @@ void QBasicAttrib::addWord(const QString &word)
 		return;
 
 	int from = (word[0].toLatin1() == firstCh) ? 1 : 0;
-	QString name;
-	QString value;
-	splitWord(word, name, value, from);
-	addWord(name, value);
+	int p = word.indexOf('=', from);
+	int nameLen = (p == -1) ? word.count() - from : p - from;
+	int valueLen = (p == -1) ? 0 : word.count() - p - 1;
+
+	Entry e;
+	e.nameID = -1;
+	e.name = appendToArena(word, from, nameLen);
+	e.nameLen = nameLen;
+	e.value = appendToArena(word, word.count() - valueLen, valueLen);
+	e.valueLen = valueLen;
+
+	// If name already exists, keep the old position.
+	int i = indexOf(m_arena.constData() + e.name, nameLen);
+	if( i != -1 )
+		setValue(i, e.value, valueLen);
+	else
+		m_entries.append(e);
+}
+
+/**
+ * @brief QBasicAttrib::parseDuration
+ * Parses a RouterOS duration, as "1w2d3h4m5s", "1s500ms" or
+ * "1d02:03:04.500".
+ * @param s The duration chars.
+ * @param len The chars count.
+ * @param msecs Variable to store the duration in milliseconds.
+ * @return false if s is not a duration.
+ */
+bool QBasicAttrib::parseDuration(const char *s, int len, qint64 *msecs)
+{
+	qint64 total = 0;
+	int pos = 0;
+	if( len <= 0 )
+		return false;
+
+	while( pos < len )
+	{
+		if( (s[pos] < '0') || (s[pos] > '9') )
+			return false;
+		qint64 n = 0;
+		while( (pos < len) && (s[pos] >= '0') && (s[pos] <= '9') )
+			n = n * 10 + (s[pos++] - '0');
+		if( pos == len )
+			return false;
+
+		if( s[pos] == ':' )
+		{
+			// Clock part: hh:mm:ss[.fff] It's always the last one.
+			int mm, ss;
+			if( (pos + 6 > len) || (s[pos+3] != ':') )
+				return false;
+			for( int d = 1; d <= 5; d++ )
+				if( (d != 3) && ((s[pos+d] < '0') || (s[pos+d] > '9')) )
+					return false;
+			mm = (s[pos+1] - '0') * 10 + (s[pos+2] - '0');
+			ss = (s[pos+4] - '0') * 10 + (s[pos+5] - '0');
+			if( (mm > 59) || (ss > 59) )
+				return false;
+			total += ((n * 60 + mm) * 60 + ss) * 1000;
+			pos += 6;
+			if( (pos < len) && (s[pos] == '.') )
+			{
+				int scale = 100;
+				while( (++pos < len) && (s[pos] >= '0') && (s[pos] <= '9') )
+				{
+					total += (s[pos] - '0') * scale;
+					scale /= 10;
+				}
+			}
+			if( pos != len )
+				return false;
+			break;
+		}
+
+		switch( s[pos++] )
+		{
+		case 'w':	total += n * 604800000;	break;
+		case 'd':	total += n * 86400000;	break;
+		case 'h':	total += n * 3600000;	break;
+		case 'm':
+			if( (pos < len) && (s[pos] == 's') )
+			{
+				pos++;
+				total += n;
+			}
+			else
+				total += n * 60000;
+			break;
+		case 's':	total += n * 1000;		break;
+		case 'u':
+			if( (pos >= len) || (s[pos++] != 's') )
+				return false;
+			total += n / 1000;
+			break;
+		default:
+			return false;
+		}
+	}
+	*msecs = total;
+	return true;
+}
+
+/**
+ * @brief parseIPv4
+ * Parses a dotted IPv4 address with optional "/prefix".
+ */
+static bool parseIPv4(const char *s, int len, quint32 *ip, qint16 *prefix)
+{
+	quint32 addr = 0;
+	int pos = 0;
+	for( int octet = 0; octet < 4; octet++ )
+	{
+		if( octet && ((pos >= len) || (s[pos++] != '.')) )
+			return false;
+		int n = 0, digits = 0;
+		while( (pos < len) && (s[pos] >= '0') && (s[pos] <= '9') && (digits < 3) )
+		{
+			n = n * 10 + (s[pos++] - '0');
+			digits++;
+		}
+		if( !digits || (n > 255) )
+			return false;
+		addr = (addr << 8) | quint32(n);
+	}
+	*prefix = -1;
+	if( pos < len )
+	{
+		if( (s[pos++] != '/') || (pos == len) || (len - pos > 2) )
+			return false;
+		int p = 0;
+		for( ; pos < len; pos++ )
+		{
+			if( (s[pos] < '0') || (s[pos] > '9') )
+				return false;
+			p = p * 10 + (s[pos] - '0');
+		}
+		if( p > 32 )
+			return false;
+		*prefix = qint16(p);
+	}
+	*ip = addr;
+	return true;
+}
+
+/**
+ * @brief hexDigit
+ * @return the value of an hex digit or -1.
+ */
+static inline int hexDigit(char c)
+{
+	if( (c >= '0') && (c <= '9') )
+		return c - '0';
+	if( (c >= 'a') && (c <= 'f') )
+		return c - 'a' + 10;
+	if( (c >= 'A') && (c <= 'F') )
+		return c - 'A' + 10;
+	return -1;
+}
+
+/**
+ * @brief QBasicAttrib::typed
+ * Decodes an attribute value to a type, unless it's already decoded.
+ * Values are decoded straight from arena chars: no QString is created.
+ * As cache is filled on const functions, sentences must not be read
+ * from several threads at once.
+ * @param i The attribute index.
+ * @param kind The type wanted.
+ * @return the decoded value. Check ok field.
+ */
+const QBasicAttrib::Typed &QBasicAttrib::typed(int i, QBasicAttrib::TypedKind kind) const
+{
+	if( m_typed.count() < m_entries.count() )
+		m_typed.resize(m_entries.count());
+	Typed &t = m_typed[i];
+	if( t.asked == kind )
+		return t;
+
+	t = Typed();
+	t.asked = quint8(kind);
+	t.kind = quint8(kind);
+	QLatin1String val = valueLatin1(i);
+	const char *s = val.data();
+	int len = val.size();
+
+	switch( kind )
+	{
+	case IntKind:
+		t.v.i = QByteArray::fromRawData(s, len).toLongLong(&t.ok);
+		break;
+	case UIntKind:
+		t.v.u = QByteArray::fromRawData(s, len).toULongLong(&t.ok);
+		break;
+	case BoolKind:
+		if( (val == QLatin1String("true")) || (val == QLatin1String("yes")) )
+		{
+			t.v.u = 1;
+			t.ok = true;
+		}
+		else
+			t.ok = (val == QLatin1String("false")) || (val == QLatin1String("no"));
+		break;
+	case DurationKind:
+		t.ok = parseDuration(s, len, &t.v.i);
+		break;
+	case IPv4Kind:
+		if( memchr(s, ':', len) )
+		{
+			// IPv6 ones are rare enough to let QHostAddress parse them.
+			QString str(val);
+			int slash = str.indexOf('/');
+			if( slash != -1 )
+			{
+				t.prefix = qint16(str.mid(slash + 1).toInt(&t.ok));
+				if( !t.ok || (t.prefix < 0) || (t.prefix > 128) )
+				{
+					t.ok = false;
+					break;
+				}
+				str.truncate(slash);
+			}
+			QHostAddress addr;
+			t.ok = addr.setAddress(str) && (addr.protocol() == QAbstractSocket::IPv6Protocol);
+			if( t.ok )
+			{
+				Q_IPV6ADDR ip6 = addr.toIPv6Address();
+				memcpy(t.v.ip6, &ip6, 16);
+				t.kind = IPv6Kind;
+			}
+		}
+		else
+			t.ok = parseIPv4(s, len, &t.v.ip4, &t.prefix);
+		break;
+	case MacKind:
+		if( len != 17 )
+			break;
+		t.ok = true;
+		for( int b = 0; t.ok && (b < 6); b++ )
+		{
+			int hi = hexDigit(s[b*3]);
+			int lo = hexDigit(s[b*3+1]);
+			if( (hi < 0) || (lo < 0) || ((b < 5) && (s[b*3+2] != ':') && (s[b*3+2] != '-')) )
+				t.ok = false;
+			else
+				t.v.u = (t.v.u << 8) | quint64((hi << 4) | lo);
+		}
+		break;
+	default:
+		break;
+	}
+	if( !t.ok )
+		memset(&t.v, 0, sizeof(t.v));
+	return t;
+}
+
+/**
+ * @brief QBasicAttrib::toInt
+ * Decodes attribute value as integer. Decoded value is kept, so next
+ * calls don't parse it again.
+ * @param i The attribute index.
+ * @param ok If not NULL, it's set to false if value is not an integer.
+ * @return the value or 0.
+ */
+qint64 QBasicAttrib::toInt(int i, bool *ok) const
+{
+	const Typed &t = typed(i, IntKind);
+	if( ok )
+		*ok = t.ok;
+	return t.v.i;
+}
+
+/**
+ * @brief QBasicAttrib::toUInt
+ * Decodes attribute value as unsigned integer, as byte counters.
+ * @see toInt
+ */
+quint64 QBasicAttrib::toUInt(int i, bool *ok) const
+{
+	const Typed &t = typed(i, UIntKind);
+	if( ok )
+		*ok = t.ok;
+	return t.v.u;
+}
+
+/**
+ * @brief QBasicAttrib::toBool
+ * Decodes attribute value as boolean: "true"/"yes" or "false"/"no".
+ * @see toInt
+ */
+bool QBasicAttrib::toBool(int i, bool *ok) const
+{
+	const Typed &t = typed(i, BoolKind);
+	if( ok )
+		*ok = t.ok;
+	return t.v.u != 0;
+}
+
+/**
+ * @brief QBasicAttrib::toDuration
+ * Decodes attribute value as RouterOS duration.
+ * @return the duration in milliseconds.
+ * @see parseDuration
+ */
+qint64 QBasicAttrib::toDuration(int i, bool *ok) const
+{
+	const Typed &t = typed(i, DurationKind);
+	if( ok )
+		*ok = t.ok;
+	return t.v.i;
+}
+
+/**
+ * @brief QBasicAttrib::toAddress
+ * Decodes attribute value as IPv4 or IPv6 address, with optional
+ * prefix length ("10.0.0.0/8").
+ * @param prefix If not NULL, it's set to the prefix length or -1.
+ * @return the address. Null if value is not an address.
+ */
+QHostAddress QBasicAttrib::toAddress(int i, int *prefix, bool *ok) const
+{
+	const Typed &t = typed(i, IPv4Kind);
+	if( ok )
+		*ok = t.ok;
+	if( prefix )
+		*prefix = t.prefix;
+	if( !t.ok )
+		return QHostAddress();
+	if( t.kind == IPv6Kind )
+		return QHostAddress(t.v.ip6);
+	return QHostAddress(t.v.ip4);
+}
+
+/**
+ * @brief QBasicAttrib::toMac
+ * Decodes attribute value as MAC address ("4C:5E:0C:11:22:33").
+ * @return the address on the lower 48 bits.
+ */
+quint64 QBasicAttrib::toMac(int i, bool *ok) const
+{
+	const Typed &t = typed(i, MacKind);
+	if( ok )
+		*ok = t.ok;
+	return t.v.u;
 }
 
 /**
@@ -208,22 +941,22 @@ QQuery &QQuery::fromWord(const QString &word)
 		break;
 	case '-':
 		type = DontHasProp;
-		name = word.right(from);
+		name = word.mid(from + 1);
 		break;
 	case '=':
-		splitWord(word, name, value, from);
+		splitWord(word, name, value, from + 1);
 		type = EqualProp;
 		break;
 	case '>':
-		splitWord(word, name, value, from);
+		splitWord(word, name, value, from + 1);
 		type = GreaterThanProp;
 		break;
 	case '<':
-		splitWord(word, name, value, from);
+		splitWord(word, name, value, from + 1);
 		type = LessThanProp;
 		break;
 	case '#':
-		name = word.right(from);
+		name = word.mid(from + 1);
 		type = Operation;
 		break;
 	}
@@ -310,8 +1043,8 @@ QString QSentence::toString() const
 				APIattributes().toWords().join("") +
 				queries().toWords().join(""));
 
-	if( m_tag.count() )
-		rtn.append(QString(".tag=%1").arg(m_tag));
+	if( tag().count() )
+		rtn.append(QString(".tag=%1").arg(tag()));
 	return rtn;
 }
 
@@ -329,10 +1062,236 @@ QString QSentence::resultString() const
 	case Trap:	return "!trap";
 	case Fatal:	return "!fatal";
 	case Reply:	return "!re";
+	case Timeout:	return "<timeout>";
 	default:	return "<error>";
 	}
 }
 
+static inline ushort charCode(char c) { return uchar(c); }
+static inline ushort charCode(QChar c) { return c.unicode(); }
+
+/**
+ * @brief tagToIDChars
+ * Converts a tag to his numeric value.
+ * Only canonical decimal numbers (no sign, no leading zeros and up to
+ * 9 digits) are accepted, so converting the value back to string gives
+ * exactly the same tag.
+ * This function is completly for internal use.
+ * @param tag The tag chars. Can be char or QChar.
+ * @param len The tag length.
+ * @return The tag value or -1 if tag is not a number.
+ */
+template <class C>
+static int tagToIDChars(const C *tag, int len)
+{
+	if( (len <= 0) || (len > 9) || ((len > 1) && (charCode(tag[0]) == '0')) )
+		return -1;
+
+	int id = 0;
+	for( int i = 0; i < len; i++ )
+	{
+		int d = ushort(charCode(tag[i]) - '0');
+		if( d > 9 )
+			return -1;
+		id = id * 10 + d;
+	}
+	return id;
+}
+
+/**
+ * @brief QSentence::tagToID
+ * Converts a tag to his numeric value.
+ * @param tag The tag string.
+ * @return The tag value or -1 if tag is not a canonical decimal number.
+ */
+int QSentence::tagToID(const QString &tag)
+{
+	return tagToIDChars(tag.constData(), tag.count());
+}
+
+/**
+ * @brief QSentence::tagToID
+ * @overload
+ * @param tag The tag latin1 chars.
+ * @param len The tag length.
+ */
+int QSentence::tagToID(const char *tag, int len)
+{
+	return tagToIDChars(tag, len);
+}
+
+/**
+ * @brief wordKey
+ * Packs up to 7 chars and their count into an integer, so control
+ * words are compared with a single integer comparision. It's constexpr
+ * to build the keys of known words at compile time.
+ * @param w The chars.
+ * @param len The amount of chars. Must be <= 7.
+ */
+static constexpr quint64 wordKey(const char *w, int len, int i = 0)
+{
+	return (i >= len) ? (quint64(len) << 56) : ((quint64(uchar(w[i])) << (8 * i)) | wordKey(w, len, i + 1));
+}
+
+/**
+ * @brief charsKey
+ * Same as wordKey for received chars.
+ * @return the key or 0 if there are more than 7 chars or any of them
+ * is not latin1, so they are not any known word.
+ */
+template <class C>
+static inline quint64 charsKey(const C *w, int len)
+{
+	if( len > 7 )
+		return 0;
+	quint64 key = quint64(len) << 56;
+	for( int i = 0; i < len; i++ )
+	{
+		ushort c = charCode(w[i]);
+		if( c > 0xFF )
+			return 0;
+		key |= quint64(c) << (8 * i);
+	}
+	return key;
+}
+
+/**
+ * @brief classifyChars
+ * Tells what a word is by his first chars. No string is created.
+ * @param word The word chars. Can be char or QChar.
+ * @param len The word length.
+ * @param result If word is a reply, his result is stored here.
+ */
+template <class C>
+static QSentence::WordType classifyChars(const C *word, int len, QSentence::Result *result)
+{
+	if( len <= 0 )
+		return QSentence::InvalidWord;
+
+	switch( charCode(word[0]) )
+	{
+	case '=':
+		if( (len >= 4) && ((len == 4) || (charCode(word[4]) == '=')) && (charsKey(word, 4) == wordKey("=.id", 4)) )
+			return QSentence::IDWord;
+		return QSentence::AttributeWord;
+	case '.':
+		if( (len >= 5) && (charsKey(word, 5) == wordKey(".tag=", 5)) )
+			return QSentence::TagWord;
+		return QSentence::APIAttributeWord;
+	case '/':
+		return QSentence::CommandWord;
+	case '?':
+		return QSentence::QueryWord;
+	case '!':
+	{
+		QSentence::Result r;
+		switch( charsKey(word, len) )
+		{
+		case wordKey("!re", 3):		r = QSentence::Reply;	break;
+		case wordKey("!done", 5):	r = QSentence::Done;	break;
+		case wordKey("!trap", 5):	r = QSentence::Trap;	break;
+		case wordKey("!fatal", 6):	r = QSentence::Fatal;	break;
+		default:
+			return QSentence::UnknownReplyWord;
+		}
+		if( result )
+			*result = r;
+		return QSentence::ReplyWord;
+	}
+	default:
+		return QSentence::InvalidWord;
+	}
+}
+
+/**
+ * @brief QSentence::classifyWord
+ * Tells what a word is, working directly over his latin1 bytes.
+ * @param word The word chars.
+ * @param len The word length.
+ * @param result Optional. If word is a ReplyWord, his result is stored here.
+ * @return the word type.
+ */
+QSentence::WordType QSentence::classifyWord(const char *word, int len, QSentence::Result *result)
+{
+	return classifyChars(word, len, result);
+}
+
+/**
+ * @brief QSentence::classifyWord
+ * @overload
+ */
+QSentence::WordType QSentence::classifyWord(const QString &word, QSentence::Result *result)
+{
+	return classifyChars(word.constData(), word.count(), result);
+}
+
+/**
+ * @brief splitWord
+ * Finds name and value of a "<prefix><name>=<value>" word.
+ */
+static inline void splitWord(const char *word, int len, int *nameLen, int *valueLen)
+{
+	const char *eq = (const char*)memchr(word + 1, '=', len - 1);
+	*nameLen = eq ? int(eq - word) - 1 : len - 1;
+	*valueLen = eq ? len - *nameLen - 2 : 0;
+}
+
+/**
+ * @brief QSentence::addWord
+ * @overload
+ * Adds a word from latin1 chars.
+ * Attributes and API attributes are added directly from bytes, so
+ * neither the word nor the name or value strings are created. Numeric
+ * tags are not converted to string either.
+ * @param word The word chars.
+ * @param len The word length.
+ * @return the word type. If it's InvalidWord or UnknownReplyWord
+ * sentence is left untouched.
+ */
+QSentence::WordType QSentence::addWord(const char *word, int len)
+{
+	Result r = None;
+	WordType type = classifyChars(word, len, &r);
+	int nameLen;
+	int valueLen;
+
+	switch( type )
+	{
+	case AttributeWord:
+		splitWord(word, len, &nameLen, &valueLen);
+		m_Attributes.addWord(word + 1, nameLen, word + len - valueLen, valueLen);
+		break;
+	case APIAttributeWord:
+		splitWord(word, len, &nameLen, &valueLen);
+		m_APIAttributes.addWord(word + 1, nameLen, word + len - valueLen, valueLen);
+		break;
+	case IDWord:
+		setID((len > 5) ? QString::fromLatin1(word + 5, len - 5) : QString());
+		break;
+	case TagWord:
+	{
+		int id = tagToIDChars(word + 5, len - 5);
+		if( id >= 0 )
+			setTag(id);
+		else
+			setTag(QString::fromLatin1(word + 5, len - 5));
+		break;
+	}
+	case ReplyWord:
+		setResultType(r);
+		break;
+	case CommandWord:
+		setCommand(QString::fromLatin1(word, len));
+		break;
+	case QueryWord:
+		queries().append(QQuery(QString::fromLatin1(word, len)));
+		break;
+	default:
+		break;
+	}
+	return type;
+}
+
 /**
  * @brief QSentence::addWord
  * Adds a word to the sentence. This word can be any of the valid words
@@ -348,46 +1307,309 @@ QString QSentence::resultString() const
  * Result type word will set the resultType variable member class.
  * This function can be used to directly parse incoming word from ROS.
  * @param word The ROS-like word to parse.
+ * @return the word type. If it's InvalidWord or UnknownReplyWord
+ * sentence is left untouched.
+ * @see classifyWord
  */
-void QSentence::addWord(const QString &word)
+QSentence::WordType QSentence::addWord(const QString &word)
 {
-	if( word.count() )
+	Result r = None;
+	WordType type = classifyWord(word, &r);
+
+	switch( type )
 	{
-		switch(word[0].toLatin1())
-		{
-		case '=':
-			if( word.startsWith("=.id") )
-				setID(word.right(word.count()-5));
-			else
-				attributes().addWord(word);
-			break;
-		case '.':
-			if( word.startsWith(".tag") )
-				setTag(word.right(word.count()-5));
-			else
-				APIattributes().addWord(word);
-			break;
-		case '!':
-			if( word == "!done" )
-				setResultType(Done);
-			else
-			if( word == "!trap" )
-				setResultType(Trap);
-			else
-			if( word == "!fatal" )
-				setResultType(Fatal);
-			else
-			if( word == "!re" )
-				setResultType(Reply);
-			else
-				throw "Unknown response type";
-			break;
-		case '/':
-			setCommand(word);
-			break;
-		case '?':
-			queries().append(QQuery(word));
-			break;
-		}
+	case AttributeWord:
+		attributes().addWord(word);
+		break;
+	case APIAttributeWord:
+		APIattributes().addWord(word);
+		break;
+	case IDWord:
+		setID(word.mid(5));
+		break;
+	case TagWord:
+	{
+		// Numeric tags are kept as integers without creating the string.
+		int id = tagToIDChars(word.constData()+5, word.count()-5);
+		if( id >= 0 )
+			setTag(id);
+		else
+			setTag(word.mid(5));
+		break;
+	}
+	case ReplyWord:
+		setResultType(r);
+		break;
+	case CommandWord:
+		setCommand(word);
+		break;
+	case QueryWord:
+		queries().append(QQuery(word));
+		break;
+	default:
+		break;
+	}
+	return type;
+}
+
+/**
+ * @brief QSentence::swap
+ * Swaps all sentence data with other one. Nothing is copied.
+ * This is the cheapest way to take the data of a sentence that
+ * is going to be reused, like the ones emited by Comm.
+ */
+void QSentence::swap(QSentence &other)
+{
+	QStringList::swap(other);
+	qSwap(resultType, other.resultType);
+	m_cmd.swap(other.m_cmd);
+	m_tag.swap(other.m_tag);
+	qSwap(m_tagID, other.m_tagID);
+	m_id.swap(other.m_id);
+	m_Attributes.swap(other.m_Attributes);
+	m_APIAttributes.swap(other.m_APIAttributes);
+	m_Queries.swap(other.m_Queries);
+	m_proplist.swap(other.m_proplist);
+}
+
+/**
+ * @brief QSentencePool::acquire
+ * Gets an empty sentence.
+ * If pool is empty, a new one is created with attributes memory
+ * already reserved.
+ * @return a cleared sentence.
+ */
+QSentence QSentencePool::acquire()
+{
+	if( !m_free.isEmpty() )
+	{
+		QSentence s;
+		s.swap(m_free.last());
+		m_free.removeLast();
+		s.setNameTable(m_names);
+		return s;
+	}
+	QSentence s;
+	s.attributes().reserve(m_attribs, m_bytes);
+	s.setNameTable(m_names);
+	return s;
+}
+
+/**
+ * @brief QSentencePool::release
+ * Gives back a sentence no longer needed.
+ * Sentence data is moved into pool and the parameter is left empty.
+ * If pool is full, sentence is just destroyed.
+ * @param s The sentence to release.
+ */
+void QSentencePool::release(QSentence &s)
+{
+	if( m_free.count() >= m_maxFree )
+	{
+		QSentence().swap(s);
+		return;
+	}
+	m_free.append(QSentence());
+	m_free.last().swap(s);
+	m_free.last().clear();
+}
+
+/**
+ * @brief QRawSentence::findWord
+ * Looks for a word "<prefix><name>=<value>" into the sentence.
+ * Comparision is done directly over the raw bytes, so no word is
+ * converted to QString while searching.
+ * @param prefix The word prefix. Usually "=" or ".".
+ * @param prefixLen The prefix length.
+ * @param name The name to look for. Can be empty to find words
+ * formed just by prefix and value, as ".tag=".
+ * @return the word index or -1 if not found.
+ */
+int QRawSentence::findWord(const char *prefix, int prefixLen, const QString &name) const
+{
+	int nameLen = name.count();
+	for( int i = 0; i < m_words.count(); i++ )
+	{
+		const char *w = wordData(i);
+		int len = wordLength(i);
+
+		if( (len < prefixLen + nameLen + 1) ||
+			(w[prefixLen+nameLen] != '=') ||
+			memcmp(w, prefix, prefixLen) )
+			continue;
+		if( QLatin1String(w + prefixLen, nameLen) == name )
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * @brief QRawSentence::getResultType
+ * Looks for the result word into sentence.
+ * @return The sentence result type.
+ */
+QSentence::Result QRawSentence::getResultType() const
+{
+	QSentence::Result r = QSentence::None;
+	for( int i = 0; i < m_words.count(); i++ )
+	{
+		if( (*wordData(i) == '!') && (QSentence::classifyWord(wordData(i), wordLength(i), &r) == QSentence::ReplyWord) )
+			return r;
+	}
+	return QSentence::None;
+}
+
+/**
+ * @brief QRawSentence::tag
+ * @return The sentence tag or empty string if there is no tag.
+ */
+QString QRawSentence::tag() const
+{
+	int i = findWord(".tag", 4, QString());
+	return (i == -1) ? QString() : QString::fromLatin1(wordData(i)+5, wordLength(i)-5);
+}
+
+/**
+ * @brief QRawSentence::tagID
+ * Reads the numeric tag value directly from raw bytes.
+ * @return The tag value or -1 if there is no tag or is not a number.
+ * @see QSentence::tagToID
+ */
+int QRawSentence::tagID() const
+{
+	int i = findWord(".tag", 4, QString());
+	return (i == -1) ? -1 : QSentence::tagToID(wordData(i)+5, wordLength(i)-5);
+}
+
+/**
+ * @brief QRawSentence::getID
+ * @return The ROS item ID (the =.id= word) or empty string if there is not.
+ */
+QString QRawSentence::getID() const
+{
+	int i = findWord("=.id", 4, QString());
+	return (i == -1) ? QString() : QString::fromLatin1(wordData(i)+5, wordLength(i)-5);
+}
+
+/**
+ * @brief QRawSentence::attribute
+ * Finds an attribute and converts just his value to QString.
+ * @param name The attribute name.
+ * @return The attribute value or empty string if not found.
+ */
+QString QRawSentence::attribute(const QString &name) const
+{
+	int i = findWord("=", 1, name);
+	if( i == -1 )
+		return QString();
+	int from = name.count() + 2;
+	return QString::fromLatin1(wordData(i)+from, wordLength(i)-from);
+}
+
+/**
+ * @brief QRawSentence::APIAttribute
+ * Finds an API attribute and converts just his value to QString.
+ * @param name The API attribute name.
+ * @return The API attribute value or empty string if not found.
+ */
+QString QRawSentence::APIAttribute(const QString &name) const
+{
+	int i = findWord(".", 1, name);
+	if( i == -1 )
+		return QString();
+	int from = name.count() + 2;
+	return QString::fromLatin1(wordData(i)+from, wordLength(i)-from);
+}
+
+/**
+ * @brief QRawSentence::toSentence
+ * Fills up a QSentence with all words of this raw sentence.
+ * @param s The sentence to fill. Is not cleared before adding words.
+ */
+void QRawSentence::toSentence(QSentence &s) const
+{
+	for( int i = 0; i < m_words.count(); i++ )
+		s.addWord(word(i));
+}
+
+/**
+ * @brief QRawSentence::toSentence
+ * @overload
+ * @return a new QSentence with all words of this raw sentence.
+ */
+QSentence QRawSentence::toSentence() const
+{
+	QSentence s;
+	toSentence(s);
+	return s;
+}
+
+/**
+ * @brief QSentence::intAttribute
+ * Typed attribute access. Value is decoded once and kept.
+ * @param name The attribute name.
+ * @param defaultValue Returned if there is no such attribute or it's
+ * not an integer.
+ * @see QBasicAttrib::toInt
+ */
+qint64 QSentence::intAttribute(const QString &name, qint64 defaultValue) const
+{
+	bool ok;
+	int i = m_Attributes.indexOf(name);
+	qint64 v = (i == -1) ? 0 : m_Attributes.toInt(i, &ok);
+	return ((i == -1) || !ok) ? defaultValue : v;
+}
+
+quint64 QSentence::uintAttribute(const QString &name, quint64 defaultValue) const
+{
+	bool ok;
+	int i = m_Attributes.indexOf(name);
+	quint64 v = (i == -1) ? 0 : m_Attributes.toUInt(i, &ok);
+	return ((i == -1) || !ok) ? defaultValue : v;
+}
+
+bool QSentence::boolAttribute(const QString &name, bool defaultValue) const
+{
+	bool ok;
+	int i = m_Attributes.indexOf(name);
+	bool v = (i == -1) ? false : m_Attributes.toBool(i, &ok);
+	return ((i == -1) || !ok) ? defaultValue : v;
+}
+
+/**
+ * @brief QSentence::durationAttribute
+ * @return the duration in milliseconds.
+ * @see QBasicAttrib::toDuration
+ */
+qint64 QSentence::durationAttribute(const QString &name, qint64 defaultValue) const
+{
+	bool ok;
+	int i = m_Attributes.indexOf(name);
+	qint64 v = (i == -1) ? 0 : m_Attributes.toDuration(i, &ok);
+	return ((i == -1) || !ok) ? defaultValue : v;
+}
+
+/**
+ * @brief QSentence::addressAttribute
+ * @return the address, or a null one if there is no such attribute.
+ * @see QBasicAttrib::toAddress
+ */
+QHostAddress QSentence::addressAttribute(const QString &name, int *prefix) const
+{
+	int i = m_Attributes.indexOf(name);
+	if( i == -1 )
+	{
+		if( prefix )
+			*prefix = -1;
+		return QHostAddress();
 	}
+	return m_Attributes.toAddress(i, prefix);
+}
+
+quint64 QSentence::macAttribute(const QString &name, quint64 defaultValue) const
+{
+	bool ok;
+	int i = m_Attributes.indexOf(name);
+	quint64 v = (i == -1) ? 0 : m_Attributes.toMac(i, &ok);
+	return ((i == -1) || !ok) ? defaultValue : v;
 }
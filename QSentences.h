@@ -21,27 +21,187 @@
 #ifndef QSENTENCES_H
 #define QSENTENCES_H
 
-#include <QMap>
+#include <QVector>
+#include <QByteArray>
 #include <QStringList>
+#include <QSharedPointer>
+#include <QtNetwork/QHostAddress>
 
 namespace ROS
 {
 
-class QBasicAttrib : public QMap<QString, QString>
+/**
+ * @brief The QAttribNames class
+ * Intern table of attribute names.
+ * Replies to the same command repeat the same attribute names on every
+ * sentence. Sharing a table between all those sentences makes every name
+ * to be stored (and converted to QString) just once, and gives it a small
+ * integer id that can be used to look up attributes without comparing
+ * strings.
+ * Comm keeps one table per connection.
+ * This class is not thread-safe.
+ */
+class QAttribNames
 {
+	QVector<QByteArray> m_latin1;	// Names as latin1 bytes.
+	QVector<QString> m_names;		// Names as strings.
+	QVector<int> m_buckets;			// Open addressing hash of ids. -1 means empty.
+	int m_maxNames;
+
+	static uint hash(const char *name, int len);
+	int lookup(const char *name, int len, uint h) const;
+	void rehash(int size);
+
+public:
+	explicit QAttribNames(int maxNames = 4096) : m_maxNames(maxNames) { }
+
+	inline int count() const { return m_names.count(); }
+	int find(const char *name, int len) const;
+	int find(const QString &name) const;
+	int intern(const char *name, int len);
+	int intern(const QString &name);
+	inline const QString &name(int id) const { return m_names.at(id); }
+	inline QLatin1String nameLatin1(int id) const { return QLatin1String(m_latin1.at(id).constData(), m_latin1.at(id).count()); }
+};
+typedef QSharedPointer<QAttribNames> QAttribNamesPtr;
+
+/**
+ * @brief The QBasicAttrib class
+ * Attributes (name-value pairs) of a sentence.
+ * Names and values are stored as latin1 bytes into a single buffer
+ * (arena) and pairs are kept in insertion order into a flat vector of
+ * positions. This avoids allocating any string per attribute and keeps
+ * all of them contiguous in memory. Strings are created only when
+ * asked for by attribute(), name() or value().
+ * Lookups are linear. Sentences rarely have more than a few tens of
+ * attributes, so it's faster than hashing the name.
+ * If a QAttribNames table is set, names added from latin1 bytes are
+ * interned and not copied into arena.
+ */
+class QBasicAttrib
+{
+	/**
+	 * @brief The Entry struct
+	 * Name and value positions into arena.
+	 */
+	struct Entry
+	{
+		int nameID;		// Name id on m_names or -1 if name is on arena.
+		int name;
+		int nameLen;
+		int value;
+		int valueLen;
+	};
+
+	enum TypedKind
+	{
+		NotDecoded,
+		IntKind,
+		UIntKind,
+		BoolKind,
+		DurationKind,
+		IPv4Kind,
+		IPv6Kind,
+		MacKind
+	};
+	/**
+	 * @brief The Typed struct
+	 * An attribute value decoded to a type. Kept until value changes.
+	 */
+	struct Typed
+	{
+		quint8 kind;		// What v holds. See TypedKind.
+		quint8 asked;		// Kind asked for. IPv4 and IPv6 are both asked as IPv4Kind.
+		bool ok;
+		qint16 prefix;		// Address prefix length or -1.
+		union
+		{
+			qint64 i;
+			quint64 u;
+			quint32 ip4;
+			quint8 ip6[16];
+		} v;
+		Typed() : kind(NotDecoded), asked(NotDecoded), ok(false), prefix(-1) { memset(&v, 0, sizeof(v)); }
+	};
+
 	char firstCh;
+	QVector<Entry> m_entries;
+	QByteArray m_arena;
+	QAttribNamesPtr m_names;
+	mutable QVector<Typed> m_typed;		// Decoded values. Allocated on first typed access.
+
+	int appendToArena(const char *data, int len);
+	int appendToArena(const QString &s, int from, int len);
+	void setValue(int i, int value, int valueLen);
+	const Typed &typed(int i, TypedKind kind) const;
+
 public:
 	QBasicAttrib(char c, const QStringList &words = QStringList()) : firstCh(c)
 	{
 		addWords(words);
 	}
-	inline void addAttribute(const QString &name, const QString &value)  { (*this)[name] = value; }
-	inline QString attribute(const QString &name) const { return (*this)[name]; }
+	inline int count() const { return m_entries.count(); }
+	inline bool isEmpty() const { return m_entries.isEmpty(); }
+	void clear();
+	void reserve(int attribs, int bytes);
+	void swap(QBasicAttrib &other);
+
+	int indexOf(const QString &name) const;
+	int indexOf(const char *name, int len) const;
+	inline bool contains(const QString &name) const { return indexOf(name) != -1; }
+
+	int indexOf(int nameID) const;
+
+	inline void setNameTable(const QAttribNamesPtr &names) { m_names = names; }
+	inline const QAttribNamesPtr &nameTable() const { return m_names; }
+	inline int nameID(int i) const { return m_entries.at(i).nameID; }
+	void internNames();
+	void externNames();
+
+	inline QLatin1String nameLatin1(int i) const
+	{
+		const Entry &e = m_entries.at(i);
+		if( e.nameID >= 0 )
+			return m_names->nameLatin1(e.nameID);
+		return QLatin1String(m_arena.constData() + e.name, e.nameLen);
+	}
+	inline QLatin1String valueLatin1(int i) const { return QLatin1String(m_arena.constData() + m_entries.at(i).value, m_entries.at(i).valueLen); }
+	inline QString name(int i) const
+	{
+		if( m_entries.at(i).nameID >= 0 )
+			return m_names->name(m_entries.at(i).nameID);
+		return QString(nameLatin1(i));
+	}
+	inline QString value(int i) const { return QString(valueLatin1(i)); }
+	QString value(const QString &name) const;
+	QString valueByID(int nameID) const;
+	QStringList keys() const;
+
+	inline void addAttribute(const QString &name, const QString &value) { addWord(name, value); }
+	inline QString attribute(const QString &name) const { return value(name); }
+	/**
+	 * @brief attribute
+	 * Looks up an attribute by his interned name id. No string is compared.
+	 * Only works for attributes added while the name table was set.
+	 * @param nameID The name id as returned by QAttribNames::intern()
+	 */
+	inline QString attribute(int nameID) const { return valueByID(nameID); }
 	QStringList toWords() const;
-	QString toWord(const QString &name)const;
+	QString toWord(const QString &name) const;
+	QString toWord(int i) const;
 	void addWord(const QString &word);
 	void addWord(const QString &name, const QString &value);
+	void addWord(const char *name, int nameLen, const char *value, int valueLen);
 	void addWords(const QStringList &words);
+
+	qint64 toInt(int i, bool *ok = NULL) const;
+	quint64 toUInt(int i, bool *ok = NULL) const;
+	bool toBool(int i, bool *ok = NULL) const;
+	qint64 toDuration(int i, bool *ok = NULL) const;
+	QHostAddress toAddress(int i, int *prefix = NULL, bool *ok = NULL) const;
+	quint64 toMac(int i, bool *ok = NULL) const;
+
+	static bool parseDuration(const char *s, int len, qint64 *msecs);
 };
 
 struct QQuery
@@ -101,24 +261,44 @@ public:
         Done = 1,
         Trap = 2,
 		Fatal = 3,
-		Reply = 4
+		Reply = 4,
+		Timeout = 5		// Never received. Used by Comm for commands timed out.
+	};
+	/**
+	 * @brief The WordType enum
+	 * What a word is, as told by his first bytes.
+	 * @see classifyWord
+	 */
+	enum WordType
+	{
+		InvalidWord,		// Empty or with an unknown prefix.
+		UnknownReplyWord,	// Starts by '!' but it's not a known reply.
+		ReplyWord,			// !re, !done, !trap or !fatal.
+		IDWord,				// =.id=<id>
+		AttributeWord,		// =<name>=<value>
+		TagWord,			// .tag=<tag>
+		APIAttributeWord,	// .<name>=<value>
+		CommandWord,		// /<command>
+		QueryWord			// ?<query>
 	};
 
 private:
 	Result resultType;		// Sentence return type.
 	QString m_cmd;				// Sentence command.
-	QString m_tag;				// Sentence tag (if any)
+	mutable QString m_tag;		// Sentence tag (if any)
+	int m_tagID;				// Numeric tag value or -1.
 	QString m_id;				// ID.
 	QBasicAttrib m_Attributes;	// Attributes mapping.
 	QBasicAttrib m_APIAttributes;//API Attributes mapping.
 	QQueries m_Queries;			// Queries list.
+	QStringList m_proplist;		// Attributes wanted on replies. Empty for all.
 
 public:
 	QSentence(const QString &cmd = QString(), const QString &tag = QString(),
 			  const QStringList &attribs = QStringList(),
 			  const QStringList &APIAtts = QStringList(),
 			  const QStringList &Queries = QStringList() )
-		: m_cmd(cmd), m_tag(tag),
+		: resultType(None), m_cmd(cmd), m_tag(tag), m_tagID(tagToID(tag)),
 		  m_Attributes('=', attribs),
 		  m_APIAttributes('.', APIAtts),
 		  m_Queries(Queries)
@@ -135,9 +315,12 @@ public:
 		QStringList::clear();
 		m_cmd.clear();
 		m_tag.clear();
+		m_tagID = -1;
+		m_id.clear();
 		m_Attributes.clear();
 		m_APIAttributes.clear();
 		m_Queries.clear();
+		m_proplist.clear();
 		resultType = None;
 	}
 	inline void setCommand(const QString &cmd) { m_cmd = cmd; }
@@ -146,17 +329,50 @@ public:
 	inline const QBasicAttrib &attributes() const { return m_Attributes; }
 	inline QBasicAttrib &attributes() { return m_Attributes; }
 	inline QString attribute(const QString &name) const { return m_Attributes.attribute(name); }
+	inline QString attribute(int nameID) const { return m_Attributes.attribute(nameID); }
+	inline void setNameTable(const QAttribNamesPtr &names) { m_Attributes.setNameTable(names); }
+	inline void internNames() { m_Attributes.internNames(); }
+	inline void externNames() { m_Attributes.externNames(); }
+	void swap(QSentence &other);
 	inline void addAttribute(const QString &name, const QString &value) { m_Attributes.addWord(name, value); }
 	inline void addAttribute(const QString &word) { m_Attributes.addWord(word); }
 
+	qint64 intAttribute(const QString &name, qint64 defaultValue = 0) const;
+	quint64 uintAttribute(const QString &name, quint64 defaultValue = 0) const;
+	bool boolAttribute(const QString &name, bool defaultValue = false) const;
+	qint64 durationAttribute(const QString &name, qint64 defaultValue = 0) const;
+	QHostAddress addressAttribute(const QString &name, int *prefix = NULL) const;
+	quint64 macAttribute(const QString &name, quint64 defaultValue = 0) const;
+
 	inline const QBasicAttrib &APIattributes() const { return m_APIAttributes; }
 	inline QBasicAttrib &APIattributes() { return m_APIAttributes; }
 	inline QString APIAttribute(const QString &name) const { return m_APIAttributes.attribute(name); }
 	inline void addAPIAttribute(const QString &name, const QString &value) { m_APIAttributes.addWord(name, value); }
 	inline void addAPIAttribute(const QString &word) { m_APIAttributes.addWord(word); }
 
-	inline void setTag(const QString &tagname) { m_tag = tagname; }
-	inline const QString &tag() const { return m_tag; }
+	inline void setTag(const QString &tagname) { m_tag = tagname; m_tagID = tagToID(tagname); }
+	/**
+	 * @brief setTag
+	 * Sets a numeric tag. String representation is not created
+	 * until tag() is called.
+	 * @param id The tag value. Must be >= 0.
+	 */
+	inline void setTag(int id) { m_tag.clear(); m_tagID = id; }
+	inline const QString &tag() const
+	{
+		if( m_tag.isEmpty() && (m_tagID >= 0) )
+			m_tag = QString::number(m_tagID);
+		return m_tag;
+	}
+	/**
+	 * @brief tagID
+	 * @return the numeric tag value or -1 if tag is not a number.
+	 * @see tagToID
+	 */
+	inline int tagID() const { return m_tagID; }
+
+	static int tagToID(const QString &tag);
+	static int tagToID(const char *tag, int len);
 
 	inline void setID(const QString &id) { m_id = id; }
 	inline const QString &getID() const { return m_id; }
@@ -167,7 +383,101 @@ public:
 	inline void addQuery(const QString &name, const QString &value, QQuery::Type t) { m_Queries.addQuery(name, value, t); }
 	inline void addQueries(const QStringList &queries) { m_Queries.addQueries(queries); }
 
-	void addWord(const QString &word);
+	/**
+	 * @brief setProplist
+	 * Declares the attributes wanted on replies. Comm sends them as
+	 * =.proplist= and drops any other attribute from the rows received.
+	 * Row .id is only sent by router if ".id" is on the list.
+	 * @param names The attribute names. Empty to receive all.
+	 */
+	inline void setProplist(const QStringList &names) { m_proplist = names; }
+	inline void addProplist(const QString &name) { m_proplist.append(name); }
+	inline const QStringList &proplist() const { return m_proplist; }
+
+	static WordType classifyWord(const char *word, int len, Result *result = NULL);
+	static WordType classifyWord(const QString &word, Result *result = NULL);
+	WordType addWord(const QString &word);
+	WordType addWord(const char *word, int len);
+};
+
+/**
+ * @brief The QSentencePool class
+ * Recycles QSentence objects.
+ * A sentence released into pool keeps the memory reserved for his
+ * attributes. Acquiring sentences from pool instead of creating new ones
+ * avoids allocating that memory again for every sentence.
+ * This class is not thread-safe.
+ */
+class QSentencePool
+{
+	QVector<QSentence> m_free;
+	QAttribNamesPtr m_names;
+	int m_maxFree;
+	int m_attribs;
+	int m_bytes;
+
+public:
+	QSentencePool(int maxFree = 64, int attribs = 32, int bytes = 0x400)
+		: m_maxFree(maxFree), m_attribs(attribs), m_bytes(bytes)
+	{ }
+	inline void setNameTable(const QAttribNamesPtr &names) { m_names = names; }
+	inline int freeCount() const { return m_free.count(); }
+	QSentence acquire();
+	void release(QSentence &s);
+	void release(QSentence &&s) { release(s); }
+};
+
+/**
+ * @brief The QWordRef struct
+ * Position and length of a word into a raw sentence buffer.
+ * Offset is relative to the sentence begining.
+ */
+struct QWordRef
+{
+	int offset;
+	int length;
+	QWordRef(int o = 0, int l = 0) : offset(o), length(l) { }
+};
+
+/**
+ * @brief The QRawSentence class
+ * A sentence as it comes from ROS: a buffer and the position of every
+ * word inside it. Words are not converted to QString until asked for,
+ * so reading just a few attributes from a big reply doesn't need to
+ * allocate the others.
+ * Buffer is implicitly shared with the connection one. Keeping a copy
+ * of this class is cheap, but makes connection to detach his buffer on
+ * the next read.
+ */
+class QRawSentence
+{
+	QByteArray m_data;			// Buffer holding words.
+	int m_start;				// Sentence position into m_data.
+	QVector<QWordRef> m_words;	// Words positions.
+
+	int findWord(const char *prefix, int prefixLen, const QString &name) const;
+
+public:
+	QRawSentence() : m_start(0) { }
+	QRawSentence(const QByteArray &data, int start, const QVector<QWordRef> &words)
+		: m_data(data), m_start(start), m_words(words)
+	{ }
+
+	inline int count() const { return m_words.count(); }
+	inline bool isEmpty() const { return m_words.isEmpty(); }
+	inline const char *wordData(int i) const { return m_data.constData() + m_start + m_words.at(i).offset; }
+	inline int wordLength(int i) const { return m_words.at(i).length; }
+	inline QLatin1String wordLatin1(int i) const { return QLatin1String(wordData(i), wordLength(i)); }
+	inline QString word(int i) const { return QString::fromLatin1(wordData(i), wordLength(i)); }
+
+	QSentence::Result getResultType() const;
+	QString tag() const;
+	int tagID() const;
+	QString getID() const;
+	QString attribute(const QString &name) const;
+	QString APIAttribute(const QString &name) const;
+	void toSentence(QSentence &s) const;
+	QSentence toSentence() const;
 };
 }
 #endif // QSENTENCES_H
@@ -0,0 +1,110 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QSPSCQUEUE_H
+#define QSPSCQUEUE_H
+
+#include <QAtomicInt>
+#include <utility>
+
+namespace ROS
+{
+
+/**
+ * @brief The QSpscQueue class
+ * Fixed size, lock-free queue for exactly one producer thread and one
+ * consumer thread.
+ * Producer only writes m_tail and consumer only writes m_head, so no
+ * lock is needed. Slots are published with release/acquire ordering.
+ * Values are moved in and out, so implicitly shared classes (as
+ * QSentence) are passed between threads without copying their data.
+ */
+template<class T>
+class QSpscQueue
+{
+	T *m_buf;
+	uint m_mask;
+	char m_pad0[64];
+	QAtomicInt m_head;		// Next slot to pop. Written by consumer.
+	char m_pad1[64];
+	QAtomicInt m_tail;		// Next slot to push. Written by producer.
+	char m_pad2[64];
+
+	Q_DISABLE_COPY(QSpscQueue)
+
+public:
+	/**
+	 * @brief QSpscQueue
+	 * @param capacity Max values on queue. Rounded up to a power of two.
+	 */
+	explicit QSpscQueue(int capacity = 1024) : m_head(0), m_tail(0)
+	{
+		uint size = 2;
+		while( size < uint(capacity) )
+			size <<= 1;
+		m_buf = new T[size];
+		m_mask = size - 1;
+	}
+	~QSpscQueue() { delete [] m_buf; }
+
+	inline int capacity() const { return int(m_mask + 1); }
+	/**
+	 * @brief count
+	 * @return values on queue. From any other thread than producer or
+	 * consumer ones it's just an approximation.
+	 */
+	inline int count() const { return int(uint(m_tail.loadAcquire()) - uint(m_head.loadAcquire())); }
+	inline bool isEmpty() const { return count() == 0; }
+
+	/**
+	 * @brief push
+	 * Appends a value. Call it just from producer thread.
+	 * @param v The value to append. It's left empty (moved).
+	 * @return false if queue is full. v is left untouched then.
+	 */
+	bool push(T &v)
+	{
+		uint tail = uint(m_tail.load());
+		if( tail - uint(m_head.loadAcquire()) > m_mask )
+			return false;
+		m_buf[tail & m_mask] = std::move(v);
+		m_tail.storeRelease(int(tail + 1));
+		return true;
+	}
+
+	/**
+	 * @brief pop
+	 * Takes the oldest value. Call it just from consumer thread.
+	 * @param v Variable to store the value.
+	 * @return false if queue is empty.
+	 */
+	bool pop(T &v)
+	{
+		uint head = uint(m_head.load());
+		if( head == uint(m_tail.loadAcquire()) )
+			return false;
+		v = std::move(m_buf[head & m_mask]);
+		m_buf[head & m_mask] = T();
+		m_head.storeRelease(int(head + 1));
+		return true;
+	}
+};
+}
+#endif // QSPSCQUEUE_H
@@ -0,0 +1,359 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "QTableMirror.h"
+#include "QTableSnapshot.h"
+
+using namespace ROS;
+
+/**
+ * @brief QTableMirror::QTableMirror
+ * @param comm The Comm used to talk to router.
+ * @param path The menu path, without command. For example "/interface"
+ * @param papi Parent object.
+ */
+QTableMirror::QTableMirror(Comm *comm, const QString &path, QObject *papi)
+ : QObject(papi), m_comm(comm), m_path(path), m_state(Stopped), m_generation(0)
+{
+	connect( comm, SIGNAL(loginStateChanged(ROS::Comm::LoginState)),
+			 this, SLOT(onLoginStateChanged(ROS::Comm::LoginState)) );
+}
+
+QTableMirror::~QTableMirror()
+{
+	stop();
+}
+
+/**
+ * @brief QTableMirror::start
+ * Starts mirroring. If Comm is not loged in, it starts once it is.
+ */
+void QTableMirror::start()
+{
+	if( m_state != Stopped )
+		return;
+	if( m_comm && m_comm->isLoged() )
+		sync();
+	else
+		setState(Disconnected);
+}
+
+/**
+ * @brief QTableMirror::stop
+ * Stops listening for changes. Rows are kept.
+ */
+void QTableMirror::stop()
+{
+	cancel();
+	setState(Stopped);
+}
+
+/**
+ * @brief QTableMirror::saveSnapshot
+ * Saves all rows to a snapshot file.
+ * @param fileName The file. See QTableSnapshot::fileName
+ * @param router The router name, stored on snapshot.
+ * @param error Optional. Set to the error on failure.
+ * @return false if file cannot be written.
+ */
+bool QTableMirror::saveSnapshot(const QString &fileName, const QString &router, QString *error) const
+{
+	return QTableSnapshot::save(fileName, router, m_path, m_rows.values(), error);
+}
+
+/**
+ * @brief QTableMirror::loadSnapshot
+ * Replaces rows with the ones of a snapshot file and emits rowAdded
+ * for all of them. Can only be done before mirror is syncing.
+ * @param fileName The file.
+ * @param error Optional. Set to the error on failure.
+ * @return false if mirror is syncing or live, or file is not a valid
+ * snapshot of this menu path.
+ */
+bool QTableMirror::loadSnapshot(const QString &fileName, QString *error)
+{
+	QString e;
+	QTableSnapshot snap;
+	if( (m_state == Syncing) || (m_state == Live) )
+		e = QString("Mirror is already synced");
+	else
+	if( !snap.open(fileName) )
+		e = snap.errorString();
+	else
+	if( snap.path() != m_path )
+		e = QString("Snapshot is for %1").arg(snap.path());
+	if( !e.isEmpty() )
+	{
+		if( error )
+			*error = e;
+		return false;
+	}
+
+	m_rows.clear();
+	m_rows.reserve(snap.rowCount());
+	for( int i = 0; i < snap.rowCount(); i++ )
+	{
+		QSentence s = snap.row(i);
+		m_rows.insert(s.getID(), s);
+	}
+	QList<QString> ids = m_rows.keys();
+	for( int i = 0; i < ids.count(); i++ )
+		emit rowAdded(ids.at(i));
+	return true;
+}
+
+/**
+ * @brief QTableMirror::cancel
+ * Cancels the commands of current sync, if any. Their replies are
+ * ignored from now on.
+ */
+void QTableMirror::cancel()
+{
+	m_generation++;
+	if( m_comm && m_comm->isLoged() )
+	{
+		if( !m_listenTag.isEmpty() )
+			m_comm->sendCancel(m_listenTag);
+		if( (m_state == Syncing) && !m_printTag.isEmpty() )
+			m_comm->sendCancel(m_printTag);
+	}
+	m_listenTag.clear();
+	m_printTag.clear();
+	m_early.clear();
+	m_printed.clear();
+}
+
+void QTableMirror::setState(QTableMirror::State s)
+{
+	if( m_state != s )
+		emit stateChanged(m_state = s);
+}
+
+/**
+ * @brief QTableMirror::sync
+ * Sends listen and print commands. Both are streamed, so rows are
+ * applied as they come and they are not replayed on reconnection.
+ */
+void QTableMirror::sync()
+{
+	cancel();
+	setState(Syncing);
+
+	int gen = m_generation;
+	QPointer<QTableMirror> self(this);
+
+	QSentence listen(m_path + "/listen");
+	listen.addQueries(m_queries);
+	m_listenTag = m_comm->streamSentence(listen,
+		[self, gen](QSentence &s)
+		{
+			if( self && (self->m_generation == gen) )
+			{
+				if( self->m_state == Syncing )
+					self->m_early.append(s);
+				else
+					self->apply(s, false);
+			}
+			return true;
+		},
+		[self, gen](QSentence::Result result, const QString &message)
+		{
+			if( self && (self->m_generation == gen) )
+				self->onListenDone(result, message);
+		});
+
+	QSentence print(m_path + "/print");
+	print.addQueries(m_queries);
+	m_printTag = m_comm->streamSentence(print,
+		[self, gen](QSentence &s)
+		{
+			if( self && (self->m_generation == gen) )
+			{
+				self->m_printed.insert(s.getID());
+				self->apply(s, true);
+			}
+			return true;
+		},
+		[self, gen](QSentence::Result result, const QString &message)
+		{
+			if( self && (self->m_generation == gen) )
+				self->onPrintDone(result, message);
+		});
+}
+
+/**
+ * @brief QTableMirror::onPrintDone
+ * Removes rows not printed, applies changes received meanwhile and
+ * emits synced.
+ */
+void QTableMirror::onPrintDone(QSentence::Result result, const QString &message)
+{
+	if( result == QSentence::Fatal )
+		return;
+	if( result != QSentence::Done )
+	{
+		cancel();
+		setState(Stopped);
+		emit mirrorError(message);
+		return;
+	}
+
+	QList<QString> ids = m_rows.keys();
+	for( int i = 0; i < ids.count(); i++ )
+		if( !m_printed.contains(ids.at(i)) )
+		{
+			m_rows.remove(ids.at(i));
+			emit rowRemoved(ids.at(i));
+		}
+	m_printed.clear();
+	m_printTag.clear();
+
+	QList<QSentence> early;
+	early.swap(m_early);
+	for( int i = 0; i < early.count(); i++ )
+		apply(early.at(i), false);
+
+	setState(Live);
+	emit synced();
+}
+
+/**
+ * @brief QTableMirror::onListenDone
+ * Listen only ends if connection is lost or router refuses it.
+ */
+void QTableMirror::onListenDone(QSentence::Result result, const QString &message)
+{
+	m_generation++;
+	m_listenTag.clear();
+	m_printTag.clear();
+	if( result == QSentence::Fatal )
+		setState(Disconnected);
+	else
+	{
+		setState(Stopped);
+		emit mirrorError(message);
+	}
+}
+
+/**
+ * @brief QTableMirror::onLoginStateChanged
+ * Syncs again after reconnecting.
+ */
+void QTableMirror::onLoginStateChanged(Comm::LoginState s)
+{
+	if( (s == Comm::LogedIn) && (m_state == Disconnected) )
+		sync();
+}
+
+/**
+ * @brief QTableMirror::sameAttributes
+ * @return true if both sentences have the same attributes and values.
+ */
+bool QTableMirror::sameAttributes(const QSentence &a, const QSentence &b)
+{
+	const QBasicAttrib &aa = a.attributes();
+	const QBasicAttrib &ba = b.attributes();
+	if( aa.count() != ba.count() )
+		return false;
+	for( int i = 0; i < aa.count(); i++ )
+	{
+		QLatin1String name = aa.nameLatin1(i);
+		int j = ba.indexOf(name.data(), name.size());
+		if( (j == -1) || (ba.valueLatin1(j) != aa.valueLatin1(i)) )
+			return false;
+	}
+	return true;
+}
+
+/**
+ * @brief QTableMirror::apply
+ * Applies a row received from router: adds it, replaces or merges it
+ * into the existing one or removes it if it has .dead attribute.
+ * rowChanged is only emited if some attribute really changed.
+ * @param s The row.
+ * @param fullRow true if s is the whole row state, as printed rows are.
+ * Attributes missing from it are removed from the cached row. Otherwise,
+ * attributes not sent keep their value.
+ */
+void QTableMirror::apply(const QSentence &s, bool fullRow)
+{
+	const QString &id = s.getID();
+	if( id.isEmpty() )
+		return;
+
+	if( s.attributes().indexOf(".dead", 5) != -1 )
+	{
+		if( m_rows.remove(id) )
+			emit rowRemoved(id);
+		return;
+	}
+
+	QHash<QString, QSentence>::iterator it = m_rows.find(id);
+	QSentence row = s;
+	row.setTag(QString());
+	if( it == m_rows.end() )
+	{
+		m_rows.insert(id, row);
+		emit rowAdded(id);
+		return;
+	}
+
+	const QBasicAttrib &old = it.value().attributes();
+	for( int i = 0; !fullRow && (i < old.count()); i++ )
+	{
+		QLatin1String name = old.nameLatin1(i);
+		if( row.attributes().indexOf(name.data(), name.size()) == -1 )
+		{
+			QLatin1String value = old.valueLatin1(i);
+			row.attributes().addWord(name.data(), name.size(), value.data(), value.size());
+		}
+	}
+	if( sameAttributes(row, it.value()) )
+		return;
+	it.value() = row;
+	emit rowChanged(id);
+}
+
+/**
+ * @brief QTableMirror::find
+ * @return the rows whose attribute name has the value given.
+ */
+QList<QSentence> QTableMirror::find(const QString &name, const QString &value) const
+{
+	QList<QSentence> found;
+	for( QHash<QString, QSentence>::const_iterator it = m_rows.constBegin(); it != m_rows.constEnd(); ++it )
+		if( it.value().attribute(name) == value )
+			found.append(it.value());
+	return found;
+}
+
+/**
+ * @brief QTableMirror::select
+ * @return the rows matching predicate, without asking router.
+ */
+QList<QSentence> QTableMirror::select(const QQueryPredicate &predicate) const
+{
+	QList<QSentence> found;
+	for( QHash<QString, QSentence>::const_iterator it = m_rows.constBegin(); it != m_rows.constEnd(); ++it )
+		if( predicate.matches(it.value()) )
+			found.append(it.value());
+	return found;
+}
@@ -0,0 +1,133 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QTABLEMIRROR_H
+#define QTABLEMIRROR_H
+
+#include <QObject>
+#include <QPointer>
+#include <QHash>
+#include <QSet>
+
+#include "Comm.h"
+#include "QQueryPredicate.h"
+
+namespace ROS
+{
+
+/**
+ * @brief The QTableMirror class
+ * Live local copy of a RouterOS menu (as "/interface").
+ * A /listen is sent first and then a /print. Changes received before
+ * print is finished are kept and applied over its rows, so nothing
+ * changed meanwhile is lost. From there, just changes come from router,
+ * so traffic and router load depend on change rate, not table size.
+ * Rows are keyed by .id. A printed row replaces the cached one, as
+ * router leaves unset attributes out. Changes from listen are merged
+ * into it, as they can be partial, and rows with .dead are removed.
+ * When connection is lost, table is kept and synced again once Comm
+ * is loged in: rows not printed again are removed.
+ * Rows can be saved to a snapshot file and loaded on next run, so they
+ * are available before Comm logs in. Once it does, sync emits signals
+ * just for rows changed since the snapshot was saved.
+ * Mirror must live on Comm thread.
+ */
+class QTableMirror : public QObject
+{
+	Q_OBJECT
+
+public:
+	enum State
+	{
+		Stopped,
+		Syncing,		// Waiting for print to finish.
+		Live,			// Rows are up to date.
+		Disconnected	// Waiting for login to sync again.
+	};
+
+private:
+	QPointer<Comm> m_comm;
+	QString m_path;
+	QStringList m_queries;
+	State m_state;
+	int m_generation;				// Increased on every sync, to ignore old replies.
+	QString m_listenTag;
+	QString m_printTag;
+	QHash<QString, QSentence> m_rows;
+	QSet<QString> m_printed;		// Rows received on current print.
+	QList<QSentence> m_early;		// Changes received before print finished.
+
+	void sync();
+	void cancel();
+	void setState(State s);
+	void apply(const QSentence &s, bool fullRow);
+	void onPrintDone(QSentence::Result result, const QString &message);
+	void onListenDone(QSentence::Result result, const QString &message);
+	static bool sameAttributes(const QSentence &a, const QSentence &b);
+
+private slots:
+	void onLoginStateChanged(ROS::Comm::LoginState s);
+
+signals:
+	void rowAdded(const QString &id);
+	void rowChanged(const QString &id);
+	void rowRemoved(const QString &id);
+	void stateChanged(ROS::QTableMirror::State s);
+	void synced();
+	void mirrorError(const QString &message);
+
+public:
+	QTableMirror(Comm *comm, const QString &path, QObject *papi = NULL);
+	~QTableMirror();
+
+	inline const QString &path() const { return m_path; }
+	/**
+	 * @brief setQueries
+	 * Mirrors just the rows matching queries. Used on next start.
+	 * @param queries Query words, as "?type=ether".
+	 */
+	inline void setQueries(const QStringList &queries) { m_queries = queries; }
+	inline State state() const { return m_state; }
+	inline bool isLive() const { return m_state == Live; }
+
+	void start();
+	void stop();
+
+	bool saveSnapshot(const QString &fileName, const QString &router, QString *error = NULL) const;
+	bool loadSnapshot(const QString &fileName, QString *error = NULL);
+
+	inline int count() const { return m_rows.count(); }
+	inline bool contains(const QString &id) const { return m_rows.contains(id); }
+	inline QSentence row(const QString &id) const { return m_rows.value(id); }
+	inline QList<QString> ids() const { return m_rows.keys(); }
+	inline QList<QSentence> rows() const { return m_rows.values(); }
+	QList<QSentence> find(const QString &name, const QString &value) const;
+	QList<QSentence> select(const QQueryPredicate &predicate) const;
+	/**
+	 * @brief select
+	 * Runs queries locally over the rows.
+	 * @param queries Query words, as they would be sent to router.
+	 * @see QQueryPredicate
+	 */
+	inline QList<QSentence> select(const QStringList &queries) const { return select(QQueryPredicate(queries)); }
+};
+}
+#endif // QTABLEMIRROR_H
@@ -0,0 +1,297 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "QTableSnapshot.h"
+
+#include <QSaveFile>
+#include <QDateTime>
+
+using namespace ROS;
+
+QTableSnapshot::QTableSnapshot()
+ : m_data(NULL), m_size(0), m_rows(0), m_index(0), m_savedAt(0)
+{
+}
+
+QTableSnapshot::~QTableSnapshot()
+{
+	close();
+}
+
+/**
+ * @brief QTableSnapshot::open
+ * Maps a snapshot file and validates it. If file cannot be mapped, it's
+ * read into memory.
+ * @param fileName The file.
+ * @return false if file cannot be read or it's not a valid snapshot.
+ * errorString tells why.
+ */
+bool QTableSnapshot::open(const QString &fileName)
+{
+	close();
+	m_file.setFileName(fileName);
+	if( !m_file.open(QIODevice::ReadOnly) )
+		return fail(m_file.errorString());
+
+	m_size = m_file.size();
+	if( m_size < HeaderSize )
+		return fail(QString("File too short"));
+	if( !(m_data = m_file.map(0, m_size)) )
+	{
+		m_copy = m_file.readAll();
+		m_data = (const uchar*)m_copy.constData();
+		m_size = m_copy.count();
+	}
+	return validate();
+}
+
+/**
+ * @brief QTableSnapshot::close
+ * Unmaps the file.
+ */
+void QTableSnapshot::close()
+{
+	if( m_data && m_copy.isEmpty() )
+		m_file.unmap(const_cast<uchar*>(m_data));
+	m_file.close();
+	m_copy.clear();
+	m_data = NULL;
+	m_size = 0;
+	m_rows = 0;
+	m_index = 0;
+	m_router.clear();
+	m_path.clear();
+	m_savedAt = 0;
+}
+
+/**
+ * @brief QTableSnapshot::fail
+ * Closes snapshot and keeps error.
+ * @return false.
+ */
+bool QTableSnapshot::fail(const QString &error)
+{
+	close();
+	m_error = error;
+	return false;
+}
+
+/**
+ * @brief QTableSnapshot::validate
+ * Checks that every length and offset on file is inside it, so rows can
+ * be read later without checking anything.
+ */
+bool QTableSnapshot::validate()
+{
+	if( memcmp(m_data, "QMTS", 4) || (u32(4) != Version) )
+		return fail(QString("Not a table snapshot or unknown version"));
+
+	qint64 rows = u32(8);
+	qint64 routerLen = u32(12);
+	qint64 pathLen = u32(16);
+	m_savedAt = qFromLittleEndian<qint64>(m_data + 20);
+	m_index = HeaderSize + routerLen + pathLen;
+	if( m_index + rows * 4 > m_size )
+		return fail(QString("File truncated"));
+
+	for( qint64 r = 0; r < rows; r++ )
+	{
+		qint64 pos = u32(m_index + r * 4);
+		if( pos + 8 > m_size )
+			return fail(QString("File corrupted"));
+		qint64 attribs = u32(pos);
+		pos += 8 + u32(pos + 4);
+		for( qint64 i = 0; (i < attribs * 2) && (pos <= m_size); i++ )
+		{
+			if( pos + 4 > m_size )
+				return fail(QString("File corrupted"));
+			pos += 4 + u32(pos);
+		}
+		if( pos > m_size )
+			return fail(QString("File corrupted"));
+	}
+
+	m_router = QString::fromUtf8((const char*)m_data + HeaderSize, int(routerLen));
+	m_path = QString::fromUtf8((const char*)m_data + HeaderSize + routerLen, int(pathLen));
+	m_rows = int(rows);
+	m_error.clear();
+	return true;
+}
+
+/**
+ * @brief QTableSnapshot::id
+ * @return the row .id, pointing into file data.
+ */
+QLatin1String QTableSnapshot::id(int row) const
+{
+	qint64 pos = rowOffset(row);
+	return QLatin1String((const char*)m_data + pos + 8, int(u32(pos + 4)));
+}
+
+/**
+ * @brief QTableSnapshot::attributeCount
+ * @return the amount of attributes of row.
+ */
+int QTableSnapshot::attributeCount(int row) const
+{
+	return int(u32(rowOffset(row)));
+}
+
+/**
+ * @brief QTableSnapshot::row
+ * Creates the sentence of a row. Names and values are copied straight
+ * into the attributes arena.
+ */
+QSentence QTableSnapshot::row(int row) const
+{
+	qint64 pos = rowOffset(row);
+	int attribs = int(u32(pos));
+	QLatin1String rowID = id(row);
+	pos += 8 + rowID.size();
+
+	QSentence s;
+	s.setResultType(QSentence::Reply);
+	s.setID(QString(rowID));
+	s.attributes().reserve(attribs, 0);
+	for( int i = 0; i < attribs; i++ )
+	{
+		int nameLen = int(u32(pos));
+		const char *name = (const char*)m_data + pos + 4;
+		pos += 4 + nameLen;
+		int valueLen = int(u32(pos));
+		const char *value = (const char*)m_data + pos + 4;
+		pos += 4 + valueLen;
+		s.attributes().addWord(name, nameLen, value, valueLen);
+	}
+	return s;
+}
+
+/**
+ * @brief appendU32
+ * Appends a little endian 32 bits integer.
+ */
+static inline void appendU32(QByteArray &data, quint32 v)
+{
+	uchar b[4];
+	qToLittleEndian<quint32>(v, b);
+	data.append((const char*)b, 4);
+}
+
+/**
+ * @brief QTableSnapshot::save
+ * Saves rows into a snapshot file. File is replaced atomically, so a
+ * crash while saving leaves the previous snapshot.
+ * @param fileName The file.
+ * @param router The router name, to know whose the rows are.
+ * @param path The menu path.
+ * @param rows The rows.
+ * @param error Optional. Set to the error on failure.
+ * @return false if file cannot be written.
+ */
+bool QTableSnapshot::save(const QString &fileName, const QString &router, const QString &path, const QList<QSentence> &rows, QString *error)
+{
+	QByteArray routerBytes = router.toUtf8();
+	QByteArray pathBytes = path.toUtf8();
+	QByteArray data;
+	data.reserve(HeaderSize + routerBytes.count() + pathBytes.count() + rows.count() * 256);
+
+	data.append("QMTS", 4);
+	appendU32(data, Version);
+	appendU32(data, quint32(rows.count()));
+	appendU32(data, quint32(routerBytes.count()));
+	appendU32(data, quint32(pathBytes.count()));
+	uchar savedAt[8];
+	qToLittleEndian<qint64>(QDateTime::currentMSecsSinceEpoch(), savedAt);
+	data.append((const char*)savedAt, 8);
+	data.append(routerBytes);
+	data.append(pathBytes);
+
+	int index = data.count();
+	data.resize(index + rows.count() * 4);
+	for( int r = 0; r < rows.count(); r++ )
+	{
+		qToLittleEndian<quint32>(quint32(data.count()), data.data() + index + r * 4);
+
+		const QSentence &s = rows.at(r);
+		const QBasicAttrib &attribs = s.attributes();
+		QByteArray rowID = s.getID().toLatin1();
+		appendU32(data, quint32(attribs.count()));
+		appendU32(data, quint32(rowID.count()));
+		data.append(rowID);
+		for( int i = 0; i < attribs.count(); i++ )
+		{
+			QLatin1String name = attribs.nameLatin1(i);
+			QLatin1String value = attribs.valueLatin1(i);
+			appendU32(data, quint32(name.size()));
+			data.append(name.data(), name.size());
+			appendU32(data, quint32(value.size()));
+			data.append(value.data(), value.size());
+		}
+	}
+
+	QSaveFile f(fileName);
+	if( !f.open(QIODevice::WriteOnly) || (f.write(data) != data.count()) || !f.commit() )
+	{
+		if( error )
+			*error = f.errorString();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief escapeName
+ * Appends chars to a file name. Any char but letters, digits, '-', '_'
+ * and '.' is escaped as %XX. A leading '.' is escaped too, so names are
+ * never hidden nor "..".
+ */
+static void escapeName(QString &name, const QString &part)
+{
+	QByteArray key = part.toUtf8();
+	for( int i = 0; i < key.count(); i++ )
+	{
+		uchar c = uchar(key.at(i));
+		if( ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')) ||
+			(c == '-') || (c == '_') || ((c == '.') && i) )
+			name.append(QChar(c));
+		else
+			name.append(QString("%%1").arg(c, 2, 16, QChar('0')));
+	}
+}
+
+/**
+ * @brief QTableSnapshot::fileName
+ * Builds the snapshot file name of a router menu: router and path are
+ * escaped on their own and joined by '+', which escaping never leaves
+ * as is, so different router and path pairs never share a file.
+ * @param dir The snapshots directory.
+ * @param router The router name.
+ * @param path The menu path.
+ * @return the file path.
+ */
+QString QTableSnapshot::fileName(const QString &dir, const QString &router, const QString &path)
+{
+	QString name;
+	escapeName(name, router);
+	name.append('+');
+	escapeName(name, path);
+	return dir + "/" + name + ".snap";
+}
@@ -0,0 +1,99 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef QTABLESNAPSHOT_H
+#define QTABLESNAPSHOT_H
+
+#include <QFile>
+#include <QList>
+#include <QtEndian>
+
+#include "QSentences.h"
+
+namespace ROS
+{
+
+/**
+ * @brief The QTableSnapshot class
+ * Rows of a router menu saved on disk, to have them right away on
+ * startup without printing them again.
+ * File is memory mapped and read in place: no parsing nor copying is
+ * needed until rows are asked for. All data is validated on open, so
+ * a truncated or corrupted file is just refused.
+ * Format (all integers are 32 bits little endian, but savedAt):
+ * - header: "QMTS", version, rows, router length, path length,
+ *   savedAt (64 bits, ms since epoch), router and path (UTF-8);
+ * - an index with the file offset of every row;
+ * - rows: attributes count, id length, id, and then every attribute
+ *   as name length, name, value length, value (latin1).
+ */
+class QTableSnapshot
+{
+	enum
+	{
+		Version = 1,
+		HeaderSize = 28
+	};
+
+	QFile m_file;
+	const uchar *m_data;
+	qint64 m_size;
+	QByteArray m_copy;		// File data, if it cannot be mapped.
+	int m_rows;
+	qint64 m_index;			// Position of rows index.
+	QString m_router;
+	QString m_path;
+	qint64 m_savedAt;
+	QString m_error;
+
+	Q_DISABLE_COPY(QTableSnapshot)
+
+	inline quint32 u32(qint64 pos) const { return qFromLittleEndian<quint32>(m_data + pos); }
+	inline qint64 rowOffset(int row) const { return u32(m_index + qint64(row) * 4); }
+	bool validate();
+	bool fail(const QString &error);
+
+public:
+	QTableSnapshot();
+	~QTableSnapshot();
+
+	bool open(const QString &fileName);
+	void close();
+	inline bool isOpen() const { return m_data != NULL; }
+	inline const QString &errorString() const { return m_error; }
+
+	inline const QString &router() const { return m_router; }
+	inline const QString &path() const { return m_path; }
+	/**
+	 * @brief savedAt
+	 * @return when snapshot was saved, in ms since epoch.
+	 */
+	inline qint64 savedAt() const { return m_savedAt; }
+	inline int rowCount() const { return m_rows; }
+	QLatin1String id(int row) const;
+	int attributeCount(int row) const;
+	QSentence row(int row) const;
+
+	static bool save(const QString &fileName, const QString &router, const QString &path, const QList<QSentence> &rows, QString *error = NULL);
+	static QString fileName(const QString &dir, const QString &router, const QString &path);
+};
+}
+#endif // QTABLESNAPSHOT_H
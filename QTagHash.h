@@ -0,0 +1,116 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef QTAGHASH_H
+#define QTAGHASH_H
+
+#include <QHash>
+#include <QPair>
+#include <QList>
+
+#include "QSentences.h"
+
+namespace ROS
+{
+
+/**
+ * @brief The QTagHash class
+ * A hash table keyed by sentence tag.
+ * Numeric tags (the ones created by Comm) are stored by his integer
+ * value, so looking them up doesn't need any string. Any other tag
+ * is stored by his string.
+ * Functions taking both id and tag use id if it's >= 0 (as returned
+ * by QSentence::tagID()) and tag otherwise.
+ */
+template <class T>
+class QTagHash
+{
+	QHash<int, T> m_byID;		// Numeric tags.
+	QHash<QString, T> m_byName;	// Any other tag.
+
+public:
+	inline bool isEmpty() const { return m_byID.isEmpty() && m_byName.isEmpty(); }
+	inline int count() const { return m_byID.count() + m_byName.count(); }
+	inline void clear() { m_byID.clear(); m_byName.clear(); }
+	inline void swap(QTagHash &other) { m_byID.swap(other.m_byID); m_byName.swap(other.m_byName); }
+
+	inline void insert(int id, const QString &tag, const T &value)
+	{
+		if( id >= 0 )
+			m_byID.insert(id, value);
+		else
+			m_byName.insert(tag, value);
+	}
+	inline void insert(const QString &tag, const T &value) { insert(QSentence::tagToID(tag), tag, value); }
+
+	inline bool contains(int id, const QString &tag) const
+	{
+		return (id >= 0) ? m_byID.contains(id) : m_byName.contains(tag);
+	}
+	inline bool contains(const QString &tag) const { return contains(QSentence::tagToID(tag), tag); }
+
+	inline T value(int id, const QString &tag) const
+	{
+		return (id >= 0) ? m_byID.value(id) : m_byName.value(tag);
+	}
+	inline T value(const QString &tag) const { return value(QSentence::tagToID(tag), tag); }
+
+	/**
+	 * @brief find
+	 * @return a pointer to the value stored or NULL if not found.
+	 * Pointer is valid until table is modified.
+	 */
+	T *find(int id, const QString &tag)
+	{
+		if( id >= 0 )
+		{
+			typename QHash<int, T>::iterator it = m_byID.find(id);
+			return (it == m_byID.end()) ? NULL : &it.value();
+		}
+		typename QHash<QString, T>::iterator it = m_byName.find(tag);
+		return (it == m_byName.end()) ? NULL : &it.value();
+	}
+
+	inline bool remove(int id, const QString &tag)
+	{
+		return ((id >= 0) ? m_byID.remove(id) : m_byName.remove(tag)) > 0;
+	}
+	inline bool remove(const QString &tag) { return remove(QSentence::tagToID(tag), tag); }
+
+	/**
+	 * @brief takeAll
+	 * Empties table.
+	 * @return all pairs tag-value that was stored.
+	 */
+	QList< QPair<QString, T> > takeAll()
+	{
+		QList< QPair<QString, T> > rtn;
+		typename QHash<int, T>::const_iterator i;
+		for( i = m_byID.constBegin(); i != m_byID.constEnd(); ++i )
+			rtn.append(qMakePair(QString::number(i.key()), i.value()));
+		typename QHash<QString, T>::const_iterator n;
+		for( n = m_byName.constBegin(); n != m_byName.constEnd(); ++n )
+			rtn.append(qMakePair(n.key(), n.value()));
+		clear();
+		return rtn;
+	}
+};
+}
+#endif // QTAGHASH_H
@@ -0,0 +1,200 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ThreadedComm.h"
+
+#include <QTimer>
+
+using namespace ROS;
+
+/**
+ * @brief ThreadedComm::ThreadedComm
+ * Creates the Comm and starts his I/O thread.
+ * @param queueSize Sentences that can wait to be delivered on the
+ * lock-free queue. Later ones wait on a slower overflow list.
+ * @param papi Parent object.
+ */
+ThreadedComm::ThreadedComm(int queueSize, QObject *papi)
+ : QObject(papi), m_comm(new Comm), m_loginState(Comm::NoLoged), m_commState(Comm::Unconnected),
+   m_toApp(queueSize), m_returned(queueSize)
+{
+	qRegisterMetaType<ROS::Comm::LoginState>("ROS::Comm::LoginState");
+	qRegisterMetaType<ROS::Comm::CommState>("ROS::Comm::CommState");
+	qRegisterMetaType<ROS::Comm::CommError>("ROS::Comm::CommError");
+	qRegisterMetaType<ROS::QSentence::Result>("ROS::QSentence::Result");
+	qRegisterMetaType<QAbstractSocket::SocketError>("QAbstractSocket::SocketError");
+	qRegisterMetaType<ROS::Comm::Stats>("ROS::Comm::Stats");
+
+	// Called on I/O thread.
+	connect( m_comm, SIGNAL(comReceive(ROS::QSentence&)),
+			 this, SLOT(onIOReceive(ROS::QSentence&)), Qt::DirectConnection );
+
+	connect( m_comm, SIGNAL(loginStateChanged(ROS::Comm::LoginState)),
+			 this, SLOT(onLoginStateChanged(ROS::Comm::LoginState)) );
+	connect( m_comm, SIGNAL(comStateChanged(ROS::Comm::CommState)),
+			 this, SLOT(onComStateChanged(ROS::Comm::CommState)) );
+	connect( m_comm, SIGNAL(comError(ROS::Comm::CommError,QAbstractSocket::SocketError)),
+			 this, SIGNAL(comError(ROS::Comm::CommError,QAbstractSocket::SocketError)) );
+	connect( m_comm, SIGNAL(commandFinished(int,QString,ROS::QSentence::Result)),
+			 this, SIGNAL(commandFinished(int,QString,ROS::QSentence::Result)) );
+	connect( m_comm, SIGNAL(batchFinished(int,int)), this, SIGNAL(batchFinished(int,int)) );
+	connect( m_comm, SIGNAL(statsUpdated(ROS::Comm::Stats)), this, SIGNAL(statsUpdated(ROS::Comm::Stats)) );
+
+	connect( &m_thread, SIGNAL(finished()), m_comm, SLOT(deleteLater()) );
+	m_thread.setObjectName("ThreadedComm I/O");
+	m_comm->moveToThread(&m_thread);
+	m_thread.start();
+}
+
+/**
+ * @brief ThreadedComm::~ThreadedComm
+ * Stops I/O thread. Connection is closed and Comm destroyed from it.
+ */
+ThreadedComm::~ThreadedComm()
+{
+	m_comm->disconnect(this);
+	m_thread.quit();
+	m_thread.wait();
+}
+
+/**
+ * @brief ThreadedComm::onIOReceive
+ * Called on I/O thread for every sentence decoded.
+ * Sentence is taken from Comm (not copied) and queued for the owner
+ * thread, with his names copied out of the connection name table.
+ * Sentences already delivered are given back to Comm to reuse their
+ * memory.
+ * @param s The sentence received.
+ */
+void ThreadedComm::onIOReceive(QSentence &s)
+{
+	Q_UNUSED(s);
+	QSentence r;
+	while( m_returned.pop(r) )
+		m_comm->recycleSentence(r);
+
+	QSentence taken = m_comm->takeSentence();
+	// Name table keeps growing on this thread. Owner thread can't read it.
+	taken.externNames();
+	if( !m_overflow.isEmpty() )
+	{
+		m_overflow.enqueue(taken);
+		flushOverflow();
+	}
+	else
+	if( !m_toApp.push(taken) )
+	{
+		m_overflow.enqueue(taken);
+		m_overflowed.storeRelease(1);
+	}
+	notify();
+}
+
+/**
+ * @brief ThreadedComm::flushOverflow
+ * Moves sentences from overflow list to the lock-free queue while
+ * there is room. Called on I/O thread only.
+ */
+void ThreadedComm::flushOverflow()
+{
+	while( !m_overflow.isEmpty() && m_toApp.push(m_overflow.head()) )
+		m_overflow.dequeue();
+	m_overflowed.storeRelease(m_overflow.isEmpty() ? 0 : 1);
+}
+
+/**
+ * @brief ThreadedComm::notify
+ * Posts a drain call to owner thread, unless one is already pending.
+ */
+void ThreadedComm::notify()
+{
+	if( m_notified.testAndSetOrdered(0, 1) )
+		QMetaObject::invokeMethod(this, "drain", Qt::QueuedConnection);
+}
+
+/**
+ * @brief ThreadedComm::drain
+ * Called on owner thread. Emits comReceive for all queued sentences.
+ * Flag is cleared before popping, so a sentence queued meanwhile posts
+ * a new drain call.
+ */
+void ThreadedComm::drain()
+{
+	m_notified.storeRelease(0);
+
+	QSentence s;
+	while( m_toApp.pop(s) )
+	{
+		emit comReceive(s);
+		if( !m_returned.push(s) )
+			s = QSentence();
+	}
+	if( m_overflowed.loadAcquire() )
+		QTimer::singleShot(0, m_comm, [this]() { flushOverflow(); notify(); });
+}
+
+/**
+ * @brief ThreadedComm::onLoginStateChanged
+ * Keeps login state on owner thread and emits loginStateChanged.
+ */
+void ThreadedComm::onLoginStateChanged(Comm::LoginState s)
+{
+	emit loginStateChanged(m_loginState = s);
+}
+
+/**
+ * @brief ThreadedComm::onComStateChanged
+ * Keeps connection state on owner thread and emits comStateChanged.
+ */
+void ThreadedComm::onComStateChanged(Comm::CommState s)
+{
+	emit comStateChanged(m_commState = s);
+}
+
+/**
+ * @brief ThreadedComm::setStatsEnabled
+ * Enables I/O thread counters.
+ * @see Comm::setStatsEnabled
+ */
+void ThreadedComm::setStatsEnabled(bool enabled, int intervalMs)
+{
+	Comm *comm = m_comm;
+	QTimer::singleShot(0, m_comm, [comm, enabled, intervalMs]() { comm->setStatsEnabled(enabled, intervalMs); });
+}
+
+void ThreadedComm::setRemoteHost(const QString &addr, quint16 port)
+{
+	QMetaObject::invokeMethod(m_comm, "setRemoteHost", Qt::QueuedConnection, Q_ARG(QString, addr), Q_ARG(quint16, port));
+}
+
+void ThreadedComm::setUserNamePass(const QString &uname, const QString &upass)
+{
+	QMetaObject::invokeMethod(m_comm, "setUserNamePass", Qt::QueuedConnection, Q_ARG(QString, uname), Q_ARG(QString, upass));
+}
+
+void ThreadedComm::connectToROS()
+{
+	QMetaObject::invokeMethod(m_comm, "connectToROS", Qt::QueuedConnection);
+}
+
+void ThreadedComm::closeCom(bool force)
+{
+	QMetaObject::invokeMethod(m_comm, "closeCom", Qt::QueuedConnection, Q_ARG(bool, force));
+}
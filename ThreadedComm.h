@@ -0,0 +1,124 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREADEDCOMM_H
+#define THREADEDCOMM_H
+
+#include <QObject>
+#include <QThread>
+#include <QQueue>
+#include <QAtomicInt>
+
+#include "Comm.h"
+#include "QSpscQueue.h"
+
+namespace ROS
+{
+
+/**
+ * @brief The ThreadedComm class
+ * Runs a Comm (socket and parser) on his own I/O thread, so big replies
+ * don't block the thread using it (usually, the GUI one).
+ * Decoded sentences are passed to the owner thread through a lock-free
+ * single producer/single consumer queue and emited there with
+ * comReceive. Just one wake up is posted for all sentences queued
+ * before the owner thread handles it. Delivered sentences go back through
+ * another queue to be reused by the I/O thread.
+ * Raw mode is not available, as raw sentences point into the I/O
+ * thread read buffer.
+ * Sentences are delivered without name table, so attribute lookups by
+ * name id are not available on owner thread.
+ */
+class ThreadedComm : public QObject
+{
+	Q_OBJECT
+
+	QThread m_thread;
+	Comm *m_comm;
+	Comm::LoginState m_loginState;
+	Comm::CommState m_commState;
+	QSpscQueue<QSentence> m_toApp;		// Sentences decoded by I/O thread.
+	QSpscQueue<QSentence> m_returned;	// Sentences delivered, to be recycled by I/O thread.
+	QQueue<QSentence> m_overflow;		// Sentences not fitting on m_toApp. Used by I/O thread only.
+	QAtomicInt m_notified;				// drain call is pending on owner thread.
+	QAtomicInt m_overflowed;			// m_overflow is not empty.
+
+	void notify();
+	void flushOverflow();
+
+private slots:
+	void onIOReceive(ROS::QSentence &s);
+	void drain();
+	void onLoginStateChanged(ROS::Comm::LoginState s);
+	void onComStateChanged(ROS::Comm::CommState s);
+
+signals:
+	void comError(ROS::Comm::CommError ce, QAbstractSocket::SocketError se);
+	void comReceive(ROS::QSentence &s);
+	void comStateChanged(ROS::Comm::CommState s);
+	void loginStateChanged(ROS::Comm::LoginState s);
+	void commandFinished(int batch, const QString &tag, ROS::QSentence::Result result);
+	void batchFinished(int batch, int errors);
+	void statsUpdated(const ROS::Comm::Stats &stats);
+
+public:
+	ThreadedComm(int queueSize = 1024, QObject *papi = NULL);
+	~ThreadedComm();
+
+	/**
+	 * @brief comm
+	 * The Comm running on I/O thread. Only his thread safe functions
+	 * (sendSentence, sendWithHandler, nextTagID) can be called from other threads.
+	 */
+	inline Comm *comm() const { return m_comm; }
+
+	inline bool isLoged() const { return m_loginState == Comm::LogedIn; }
+	inline Comm::LoginState loginState() const { return m_loginState; }
+	inline Comm::CommState comState() const { return m_commState; }
+
+	/**
+	 * @brief sendSentence
+	 * Sends a sentence from any thread.
+	 * @see Comm::sendSentence(const QSentence&, bool)
+	 */
+	inline QString sendSentence(const ROS::QSentence &sent, bool sendTag = true) { return m_comm->sendSentence(sent, sendTag); }
+	/**
+	 * @brief sendWithHandler
+	 * Sends a sentence from any thread. Handler is called on I/O thread.
+	 * @see Comm::sendWithHandler
+	 */
+	inline QString sendWithHandler(const ROS::QSentence &sent, const Comm::ReplyHandler &handler) { return m_comm->sendWithHandler(sent, handler); }
+	inline QString sendCancel(const QString &tag) { return m_comm->sendCancel(tag); }
+	/**
+	 * @brief stats
+	 * Snapshot of I/O thread counters.
+	 * @see Comm::stats
+	 */
+	inline Comm::Stats stats() const { return m_comm->stats(); }
+	void setStatsEnabled(bool enabled, int intervalMs = 0);
+
+public slots:
+	void setRemoteHost(const QString &addr, quint16 port);
+	void setUserNamePass(const QString &uname, const QString &upass);
+	void connectToROS();
+	void closeCom(bool force = false);
+};
+}
+#endif // THREADEDCOMM_H
@@ -0,0 +1,277 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Captures.h"
+
+#include <QFile>
+#include <functional>
+
+using namespace ROS;
+
+/**
+ * @brief CaptureWriter::appendLength
+ * Appends a word length using the shortest encoding.
+ * @param data Where to append it.
+ * @param len The word length.
+ */
+void CaptureWriter::appendLength(QByteArray &data, int len)
+{
+	if( len < 0x80 )
+		data.append(char(len));
+	else
+	if( len < 0x4000 )
+	{
+		data.append(char((len >> 8) | 0x80));
+		data.append(char(len));
+	}
+	else
+	if( len < 0x200000 )
+	{
+		data.append(char((len >> 16) | 0xC0));
+		data.append(char(len >> 8));
+		data.append(char(len));
+	}
+	else
+	{
+		data.append(char((len >> 24) | 0xE0));
+		data.append(char(len >> 16));
+		data.append(char(len >> 8));
+		data.append(char(len));
+	}
+}
+
+/**
+ * @brief CaptureWriter::appendWord
+ * Appends an encoded word.
+ * @param data Where to append it.
+ * @param word The word.
+ */
+void CaptureWriter::appendWord(QByteArray &data, const QByteArray &word)
+{
+	appendLength(data, word.count());
+	data.append(word);
+}
+
+void CaptureWriter::addWord(const QByteArray &word)
+{
+	appendWord(m_cap.data, word);
+	m_cap.words++;
+}
+
+void CaptureWriter::endSentence()
+{
+	appendEnd(m_cap.data);
+	m_cap.sentences++;
+}
+
+void CaptureWriter::addSentence(const QList<QByteArray> &words)
+{
+	for( int i = 0; i < words.count(); i++ )
+		addWord(words.at(i));
+	endSentence();
+}
+
+/**
+ * @brief Captures::loginDone
+ * @return the reply to a /login with name and password.
+ */
+Capture Captures::loginDone()
+{
+	CaptureWriter w;
+	w.addSentence(QList<QByteArray>() << "!done");
+	return w.capture();
+}
+
+/**
+ * @brief Captures::smallReplies
+ * Replies to small commands, as /interface/set: just a tagged !done.
+ * @param count Amount of replies.
+ */
+Capture Captures::smallReplies(int count)
+{
+	CaptureWriter w;
+	for( int i = 0; i < count; i++ )
+		w.addSentence(QList<QByteArray>() << "!done" << ".tag=" + QByteArray::number(i));
+	return w.capture();
+}
+
+/**
+ * @brief Captures::printDump
+ * Reply to a /interface/print on a router with a lot of interfaces.
+ * Rows have the attributes RouterOS 6 sends for ethernet ones.
+ * @param rows Amount of !re rows. A !done follows them.
+ */
+Capture Captures::printDump(int rows)
+{
+	CaptureWriter w;
+	for( int i = 0; i < rows; i++ )
+	{
+		QByteArray n = QByteArray::number(i);
+		w.addWord("!re");
+		w.addWord(".tag=1");
+		w.addWord("=.id=*" + QByteArray::number(i + 1, 16).toUpper());
+		w.addWord("=name=ether" + n);
+		w.addWord("=default-name=ether" + n);
+		w.addWord("=type=ether");
+		w.addWord("=mtu=1500");
+		w.addWord("=actual-mtu=1500");
+		w.addWord("=l2mtu=1598");
+		w.addWord("=max-l2mtu=4074");
+		w.addWord("=mac-address=4C:5E:0C:" + QByteArray::number(0x10 + (i >> 16) % 0xE0, 16).toUpper() + ":" +
+				  QByteArray::number(0x10 + (i >> 8) % 0xF0, 16).toUpper() + ":" + QByteArray::number(0x10 + i % 0xF0, 16).toUpper());
+		w.addWord("=last-link-up-time=oct/14/2026 10:" + QByteArray::number(10 + i % 50) + ":00");
+		w.addWord("=link-downs=" + QByteArray::number(i % 7));
+		w.addWord("=rx-byte=" + QByteArray::number(qint64(i) * 1234567));
+		w.addWord("=tx-byte=" + QByteArray::number(qint64(i) * 7654321));
+		w.addWord("=running=" + QByteArray((i % 3) ? "true" : "false"));
+		w.addWord("=disabled=false");
+		w.addWord("=comment=Customer " + n);
+		w.endSentence();
+	}
+	w.addSentence(QList<QByteArray>() << "!done" << ".tag=1");
+	return w.capture();
+}
+
+/**
+ * @brief Captures::listenStream
+ * Events sent for a /ip/firewall/address-list/listen on a busy router:
+ * a short !re for every entry added or removed.
+ * @param events Amount of !re events. No !done follows them.
+ */
+Capture Captures::listenStream(int events)
+{
+	CaptureWriter w;
+	for( int i = 0; i < events; i++ )
+	{
+		w.addWord("!re");
+		w.addWord(".tag=2");
+		w.addWord("=.id=*" + QByteArray::number(0x100000 + i, 16).toUpper());
+		if( i % 2 )
+			w.addWord("=.dead=true");
+		else
+		{
+			w.addWord("=list=blocked");
+			w.addWord("=address=10." + QByteArray::number((i >> 16) & 0xFF) + "." +
+					  QByteArray::number((i >> 8) & 0xFF) + "." + QByteArray::number(i & 0xFF));
+			w.addWord("=timeout=1d");
+			w.addWord("=dynamic=true");
+		}
+		w.endSentence();
+	}
+	return w.capture();
+}
+
+/**
+ * @brief frame
+ * Walks API framed data calling f for every word. Zero length words
+ * (end of sentence) are included.
+ * @return false if data is not API framed.
+ */
+static bool frame(const QByteArray &data, const std::function<void(int pos, int len)> &f)
+{
+	const unsigned char *p = (const unsigned char*)data.constData();
+	int pos = 0;
+	while( pos < data.count() )
+	{
+		unsigned char b = p[pos];
+		int len, size;
+		if( (b & 0xF0) == 0xF0 )
+			return false;
+		if( (b & 0xE0) == 0xE0 )
+		{
+			size = 4;
+			len = b & 0x1F;
+		}
+		else
+		if( (b & 0xC0) == 0xC0 )
+		{
+			size = 3;
+			len = b & 0x3F;
+		}
+		else
+		if( (b & 0x80) == 0x80 )
+		{
+			size = 2;
+			len = b & 0x7F;
+		}
+		else
+		{
+			size = 1;
+			len = b;
+		}
+		if( pos + size > data.count() )
+			return false;
+		for( int i = 1; i < size; i++ )
+			len = (len << 8) | p[pos + i];
+		if( pos + size + len > data.count() )
+			return false;
+		f(pos + size, len);
+		pos += size + len;
+	}
+	return true;
+}
+
+/**
+ * @brief Captures::load
+ * Loads a recorded capture: the API payload bytes sent by a router,
+ * as saved from a packet capture (for example, Wireshark "Follow TCP
+ * stream", raw, server side only), without the login reply.
+ * Sentences and words are counted.
+ * @param fileName The file to load.
+ * @param cap Where to store the capture.
+ * @return false if file cannot be read or is not API framed.
+ */
+bool Captures::load(const QString &fileName, Capture *cap)
+{
+	QFile f(fileName);
+	if( !f.open(QIODevice::ReadOnly) )
+		return false;
+
+	Capture c;
+	c.data = f.readAll();
+	if( !frame(c.data, [&c](int, int len) { if( len ) c.words++; else c.sentences++; }) )
+		return false;
+	*cap = c;
+	return true;
+}
+
+/**
+ * @brief Captures::split
+ * Splits a capture into his sentences words.
+ * @param cap The capture.
+ * @return the words of every sentence.
+ */
+QList<QList<QByteArray> > Captures::split(const Capture &cap)
+{
+	QList<QList<QByteArray> > sentences;
+	QList<QByteArray> words;
+	frame(cap.data, [&](int pos, int len)
+	{
+		if( len )
+			words.append(cap.data.mid(pos, len));
+		else
+		{
+			sentences.append(words);
+			words.clear();
+		}
+	});
+	return sentences;
+}
@@ -0,0 +1,75 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CAPTURES_H
+#define CAPTURES_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+namespace ROS
+{
+
+/**
+ * @brief The Capture struct
+ * Bytes as sent by a router on the API socket, and the sentences and
+ * words they hold.
+ */
+struct Capture
+{
+	QByteArray data;
+	int sentences;
+	int words;
+	Capture() : sentences(0), words(0) { }
+};
+
+/**
+ * @brief The CaptureWriter class
+ * Encodes words and sentences on the RouterOS API wire format.
+ */
+class CaptureWriter
+{
+	Capture m_cap;
+
+	static void appendLength(QByteArray &data, int len);
+
+public:
+	static void appendWord(QByteArray &data, const QByteArray &word);
+	static inline void appendEnd(QByteArray &data) { data.append('\0'); }
+
+	void addWord(const QByteArray &word);
+	void endSentence();
+	void addSentence(const QList<QByteArray> &words);
+	inline const Capture &capture() const { return m_cap; }
+};
+
+namespace Captures
+{
+	Capture loginDone();
+	Capture smallReplies(int count);
+	Capture printDump(int rows);
+	Capture listenStream(int events);
+	bool load(const QString &fileName, Capture *cap);
+	QList<QList<QByteArray> > split(const Capture &cap);
+}
+}
+#endif // CAPTURES_H
@@ -0,0 +1,160 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "Loopback.h"
+
+#include <QTimer>
+#include <QElapsedTimer>
+
+using namespace ROS;
+
+Loopback::Loopback(QObject *papi)
+ : QObject(papi), m_peer(NULL), m_logedIn(false), m_expected(0), m_received(0), m_peerBytes(0)
+{
+	connect( &m_server, SIGNAL(newConnection()), this, SLOT(onNewConnection()) );
+	connect( &m_comm, SIGNAL(comReceive(ROS::QSentence&)), this, SLOT(onReceive(ROS::QSentence&)) );
+	connect( &m_comm, SIGNAL(comReceiveRaw(ROS::QRawSentence)), this, SLOT(onReceiveRaw(ROS::QRawSentence)) );
+	connect( &m_comm, SIGNAL(loginStateChanged(ROS::Comm::LoginState)),
+			 this, SLOT(onLoginStateChanged(ROS::Comm::LoginState)) );
+}
+
+/**
+ * @brief Loopback::wait
+ * Runs event loop until m_loop is quit or timeout.
+ * @return false on timeout.
+ */
+bool Loopback::wait(int ms)
+{
+	QTimer timer;
+	timer.setSingleShot(true);
+	connect( &timer, SIGNAL(timeout()), &m_loop, SLOT(quit()) );
+	timer.start(ms);
+	m_loop.exec();
+	return timer.isActive();
+}
+
+/**
+ * @brief Loopback::open
+ * Starts fake router and connects Comm to it.
+ * @return true once Comm is loged in.
+ */
+bool Loopback::open(int timeoutMs)
+{
+	if( !m_server.listen(QHostAddress::LocalHost) )
+		return false;
+	m_comm.setRemoteHost("127.0.0.1", m_server.serverPort());
+	m_comm.setUserNamePass("bench", "bench");
+	m_comm.connectToROS();
+	if( !m_logedIn )
+		wait(timeoutMs);
+	return m_logedIn;
+}
+
+/**
+ * @brief Loopback::feed
+ * Writes a capture from fake router and waits until Comm delivers all
+ * his sentences.
+ * @return nanoseconds since writing started until last sentence was
+ * delivered, or -1 on timeout.
+ */
+qint64 Loopback::feed(const Capture &cap, int timeoutMs)
+{
+	if( !m_peer || !cap.sentences )
+		return -1;
+	m_expected = cap.sentences;
+	m_received = 0;
+
+	QElapsedTimer t;
+	t.start();
+	m_peer->write(cap.data);
+	if( !wait(timeoutMs) )
+		return -1;
+	return t.nsecsElapsed();
+}
+
+/**
+ * @brief Loopback::waitPeerBytes
+ * Waits until fake router receives the bytes Comm is sending.
+ * @param bytes Bytes expected, counted from last call.
+ * @return false on timeout.
+ */
+bool Loopback::waitPeerBytes(qint64 bytes, int timeoutMs)
+{
+	m_expected = 0;
+	m_peerBytes -= bytes;
+	if( m_peerBytes >= 0 )
+		return true;
+	return wait(timeoutMs);
+}
+
+void Loopback::onNewConnection()
+{
+	QTcpSocket *s = m_server.nextPendingConnection();
+	if( m_peer || !s )
+	{
+		delete s;
+		return;
+	}
+	m_peer = s;
+	connect( m_peer, SIGNAL(readyRead()), this, SLOT(onPeerRead()) );
+}
+
+/**
+ * @brief Loopback::onPeerRead
+ * Fake router side. First data must be the /login sentence: it's
+ * replied with !done. Later data is counted and discarded.
+ */
+void Loopback::onPeerRead()
+{
+	qint64 n = m_peer->readAll().count();
+	if( !m_logedIn )
+	{
+		m_peer->write(Captures::loginDone().data);
+		return;
+	}
+	m_peerBytes += n;
+	if( !m_expected && (m_peerBytes >= 0) )
+		m_loop.quit();
+}
+
+void Loopback::onReceive(QSentence &s)
+{
+	Q_UNUSED(s);
+	if( ++m_received == m_expected )
+		m_loop.quit();
+}
+
+void Loopback::onReceiveRaw(const QRawSentence &s)
+{
+	Q_UNUSED(s);
+	if( ++m_received == m_expected )
+		m_loop.quit();
+}
+
+void Loopback::onLoginStateChanged(Comm::LoginState s)
+{
+	if( s == Comm::LogedIn )
+	{
+		m_logedIn = true;
+		m_peerBytes = 0;
+		m_loop.quit();
+	}
+}
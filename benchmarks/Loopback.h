@@ -0,0 +1,76 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QEventLoop>
+
+#include "Comm.h"
+#include "Captures.h"
+
+namespace ROS
+{
+
+/**
+ * @brief The Loopback class
+ * A Comm connected and loged into a fake router listening on loopback.
+ * Fake router replies to login and then just writes the captures it's
+ * asked for, so Comm framing and parsing paths can be measured with
+ * real sockets but without a router.
+ * Everything runs on the calling thread.
+ */
+class Loopback : public QObject
+{
+	Q_OBJECT
+
+	QTcpServer m_server;
+	QTcpSocket *m_peer;			// Server side of connection.
+	Comm m_comm;
+	QEventLoop m_loop;
+	bool m_logedIn;
+	int m_expected;				// Sentences to receive before quitting loop.
+	int m_received;
+	qint64 m_peerBytes;			// Bytes received by server after login.
+
+	bool wait(int ms);
+
+private slots:
+	void onNewConnection();
+	void onPeerRead();
+	void onReceive(ROS::QSentence &s);
+	void onReceiveRaw(const ROS::QRawSentence &s);
+	void onLoginStateChanged(ROS::Comm::LoginState s);
+
+public:
+	Loopback(QObject *papi = NULL);
+
+	inline Comm &comm() { return m_comm; }
+	bool open(int timeoutMs = 5000);
+	qint64 feed(const Capture &cap, int timeoutMs = 60000);
+	bool waitPeerBytes(qint64 bytes, int timeoutMs = 60000);
+	inline qint64 peerBytes() const { return m_peerBytes; }
+};
+}
+#endif // LOOPBACK_H
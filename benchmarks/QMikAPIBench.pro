@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# Benchmarks for QMikAPI framing, parsing and encoding paths.
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = QMikAPIBench
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+include(../QMikAPI.pri)
+
+SOURCES += main.cpp \
+    Captures.cpp \
+    Loopback.cpp
+
+HEADERS  += \
+    Captures.h \
+    Loopback.h
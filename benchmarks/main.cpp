@@ -0,0 +1,200 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Benchmarks for framing, parsing and encoding paths.
+ * Framing and parsing ones feed RouterOS reply captures to a Comm
+ * through a loopback socket (see Loopback). Parse time is the one
+ * Comm stats measure for every readyRead, so socket noise is left out.
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include "Loopback.h"
+#include "Captures.h"
+
+using namespace ROS;
+
+static QTextStream out(stdout);
+
+/**
+ * @brief report
+ * Prints a benchmark result line.
+ * @param name Benchmark name.
+ * @param ops Operations done: sentences, calls...
+ * @param nsecs Wall time.
+ * @param bytes Bytes processed, or 0 if it makes no sense.
+ * @param parseNsecs Time Comm spent parsing, or 0 if not measured.
+ */
+static void report(const QString &name, qint64 ops, qint64 nsecs, qint64 bytes = 0, qint64 parseNsecs = 0)
+{
+	if( nsecs < 0 )
+	{
+		out << QString("%1 timed out").arg(name, -28) << endl;
+		return;
+	}
+	double secs = double(nsecs) / 1e9;
+	out << QString("%1 %2 %3 ns/op").arg(name, -28).arg(ops, 9).arg(double(nsecs) / double(qMax<qint64>(ops, 1)), 10, 'f', 1);
+	if( bytes )
+		out << QString(" %1 MB/s").arg(double(bytes) / 1048576.0 / secs, 9, 'f', 1);
+	if( parseNsecs )
+		out << QString(" parse %1 ns/op").arg(double(parseNsecs) / double(qMax<qint64>(ops, 1)), 8, 'f', 1);
+	out << endl;
+}
+
+/**
+ * @brief feed
+ * Feeds a capture and reports wall time and parse time per sentence.
+ */
+static void feed(Loopback &lb, const QString &name, const Capture &cap, bool raw)
+{
+	lb.comm().setRawMode(raw);
+	lb.comm().resetStats();
+	qint64 ns = lb.feed(cap);
+	report(name, cap.sentences, ns, cap.data.count(), qint64(lb.comm().stats().parseNsecs));
+}
+
+/**
+ * @brief benchAddWord
+ * Builds sentences from already split words, as Comm does while decoding.
+ */
+static void benchAddWord(const Capture &cap, int rounds)
+{
+	QList<QList<QByteArray> > sentences = Captures::split(cap);
+	QSentence s;
+	s.attributes().reserve(32, 0x400);
+	qint64 ops = 0;
+	QElapsedTimer t;
+	t.start();
+	for( int r = 0; r < rounds; r++ )
+	{
+		for( int i = 0; i < sentences.count(); i++ )
+		{
+			const QList<QByteArray> &words = sentences.at(i);
+			s.clear();
+			for( int w = 0; w < words.count(); w++ )
+				s.addWord(words.at(w).constData(), words.at(w).count());
+			ops += words.count();
+		}
+	}
+	report("QSentence::addWord", ops, t.nsecsElapsed(), cap.data.count() * qint64(rounds));
+}
+
+/**
+ * @brief benchToWords
+ * Converts the attributes of a print row back to API words.
+ */
+static void benchToWords(int calls)
+{
+	QList<QList<QByteArray> > rows = Captures::split(Captures::printDump(1));
+	QSentence row;
+	for( int w = 0; w < rows.first().count(); w++ )
+		row.addWord(rows.first().at(w).constData(), rows.first().at(w).count());
+
+	int words = 0;
+	QElapsedTimer t;
+	t.start();
+	for( int i = 0; i < calls; i++ )
+		words += row.attributes().toWords().count();
+	report("QBasicAttrib::toWords", calls, t.nsecsElapsed());
+	Q_UNUSED(words);
+}
+
+/**
+ * @brief benchSend
+ * Sends small command sentences. Time includes encoding and handing
+ * bytes to socket, but not waiting for them to be sent.
+ */
+static void benchSend(Loopback &lb, int count)
+{
+	QSentence set("/interface/set");
+	set.setID("*1");
+	set.addAttribute("comment", "Customer 1");
+	set.addAttribute("disabled", "false");
+
+	lb.comm().resetStats();
+	QElapsedTimer t;
+	t.start();
+	for( int i = 0; i < count; i++ )
+		lb.comm().sendSentence(set);
+	qint64 ns = t.nsecsElapsed();
+	qint64 bytes = qint64(lb.comm().stats().bytesOut);
+	report("Comm::sendSentence", count, ns, bytes);
+	lb.waitPeerBytes(bytes);
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCommandLineParser args;
+	args.setApplicationDescription("QMikAPI framing, parsing and encoding benchmarks.");
+	args.addHelpOption();
+	QCommandLineOption rowsOpt("rows", "Rows of print dump capture.", "count", "100000");
+	QCommandLineOption smallOpt("small", "Small replies capture sentences.", "count", "10000");
+	QCommandLineOption eventsOpt("events", "Events of listen capture.", "count", "200000");
+	QCommandLineOption threadsOpt("decode-threads", "Comm decoding threads.", "count", "0");
+	QCommandLineOption captureOpt("capture", "Also feed a recorded capture (raw API bytes sent by router).", "file");
+	args.addOption(rowsOpt);
+	args.addOption(smallOpt);
+	args.addOption(eventsOpt);
+	args.addOption(threadsOpt);
+	args.addOption(captureOpt);
+	args.process(app);
+
+	Loopback lb;
+	if( !lb.open() )
+	{
+		out << "Cannot connect to loopback router" << endl;
+		return 1;
+	}
+	lb.comm().setStatsEnabled(true);
+	lb.comm().setDecodeThreads(args.value(threadsOpt).toInt());
+
+	Capture small = Captures::smallReplies(args.value(smallOpt).toInt());
+	Capture dump = Captures::printDump(args.value(rowsOpt).toInt());
+	Capture listen = Captures::listenStream(args.value(eventsOpt).toInt());
+	Capture recorded;
+	if( args.isSet(captureOpt) && !Captures::load(args.value(captureOpt), &recorded) )
+	{
+		out << "Cannot load capture " << args.value(captureOpt) << endl;
+		return 1;
+	}
+
+	feed(lb, "frame/small", small, true);
+	feed(lb, "frame/print-dump", dump, true);
+	feed(lb, "frame/listen", listen, true);
+	if( recorded.sentences )
+		feed(lb, "frame/capture", recorded, true);
+
+	feed(lb, "parse/small", small, false);
+	feed(lb, "parse/print-dump", dump, false);
+	feed(lb, "parse/listen", listen, false);
+	if( recorded.sentences )
+		feed(lb, "parse/capture", recorded, false);
+
+	benchAddWord(Captures::printDump(10000), 10);
+	benchToWords(100000);
+	benchSend(lb, args.value(smallOpt).toInt());
+	return 0;
+}
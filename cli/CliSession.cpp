@@ -0,0 +1,460 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "CliSession.h"
+
+#include <QCoreApplication>
+#include <QSocketNotifier>
+#include <QFile>
+
+#include <stdio.h>
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+using namespace ROS;
+
+// Output is written when it reaches this size, or when event loop is idle.
+#define FLUSH_SIZE	0x10000
+
+/**
+ * @brief appendEscaped
+ * Appends bytes as the body of a JSON string.
+ * Words are Latin-1 (as Comm decodes them), so bytes above 0x7F are
+ * converted to their two bytes UTF-8 form.
+ */
+static void appendEscaped(QByteArray &out, const char *data, int len)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	for( int i = 0; i < len; i++ )
+	{
+		uchar c = uchar(data[i]);
+		switch( c )
+		{
+		case '"':	out.append("\\\"", 2);	break;
+		case '\\':	out.append("\\\\", 2);	break;
+		case '\n':	out.append("\\n", 2);	break;
+		case '\r':	out.append("\\r", 2);	break;
+		case '\t':	out.append("\\t", 2);	break;
+		default:
+			if( c < 0x20 )
+			{
+				out.append("\\u00", 4);
+				out.append(hex[c >> 4]);
+				out.append(hex[c & 0xF]);
+			}
+			else
+			if( c >= 0x80 )
+			{
+				out.append(char(0xC0 | (c >> 6)));
+				out.append(char(0x80 | (c & 0x3F)));
+			}
+			else
+				out.append(char(c));
+			break;
+		}
+	}
+}
+
+static inline void appendEscaped(QByteArray &out, const QLatin1String &s)
+{
+	appendEscaped(out, s.data(), s.size());
+}
+
+/**
+ * @brief appendPair
+ * Appends a "name":"value" member, preceded by a comma if it's not the first one.
+ */
+static inline void appendPair(QByteArray &out, const QLatin1String &name, const QLatin1String &value, bool first = false)
+{
+	out.append(first ? "{\"" : ",\"");
+	appendEscaped(out, name);
+	out.append("\":\"", 3);
+	appendEscaped(out, value);
+	out.append('"');
+}
+
+/**
+ * @brief appendWord
+ * Appends raw word bytes for text output. Tabs, line breaks and
+ * backslashes are escaped, so every reply stays on a single line.
+ */
+static void appendWord(QByteArray &out, const char *data, int len)
+{
+	for( int i = 0; i < len; i++ )
+	{
+		switch( data[i] )
+		{
+		case '\\':	out.append("\\\\", 2);	break;
+		case '\n':	out.append("\\n", 2);	break;
+		case '\r':	out.append("\\r", 2);	break;
+		case '\t':	out.append("\\t", 2);	break;
+		default:	out.append(data[i]);	break;
+		}
+	}
+}
+
+/**
+ * @brief CliSession::CliSession
+ * @param cfg The options to run with.
+ * @param papi Parent object.
+ */
+CliSession::CliSession(const CliConfig &cfg, QObject *papi)
+ : QObject(papi), m_cfg(cfg), m_stdin(NULL), m_pending(0), m_stdinEOF(!cfg.readStdin), m_finished(false),
+   m_exitCode(ExitOk)
+{
+	m_out.reserve(FLUSH_SIZE * 2);
+	m_flushTimer.setSingleShot(true);
+	m_flushTimer.setInterval(0);
+	connect( &m_flushTimer, SIGNAL(timeout()), this, SLOT(flush()) );
+
+	connect( &m_comm, SIGNAL(comReceive(ROS::QSentence&)), this, SLOT(onReply(ROS::QSentence&)) );
+	connect( &m_comm, SIGNAL(commandFinished(int,QString,ROS::QSentence::Result)),
+			 this, SLOT(onCommandFinished(int,QString,ROS::QSentence::Result)) );
+	connect( &m_comm, SIGNAL(comError(ROS::Comm::CommError,QAbstractSocket::SocketError)),
+			 this, SLOT(onComError(ROS::Comm::CommError,QAbstractSocket::SocketError)) );
+}
+
+/**
+ * @brief CliSession::~CliSession
+ * Writes any output still buffered.
+ */
+CliSession::~CliSession()
+{
+	flush();
+}
+
+/**
+ * @brief CliSession::start
+ * Configures connection, sends command line command and starts
+ * connecting. Commands are queued by Comm until login succeeds.
+ * @return false if options are not valid. Error is already printed.
+ */
+bool CliSession::start()
+{
+	if( m_cfg.ssl && !m_comm.setTransport(Comm::SslTransport) )
+	{
+		error(QString("SSL is not supported by this build"));
+		return false;
+	}
+	m_comm.setIgnoreSslErrors(m_cfg.insecure);
+	m_comm.setDefaultTimeout(m_cfg.timeoutMs);
+	if( m_cfg.daemon )
+	{
+		m_comm.setAutoReconnect(true);
+		m_comm.setReplayInFlight(true);
+	}
+	m_comm.setRemoteHost(m_cfg.host, m_cfg.port ? m_cfg.port : quint16(m_cfg.ssl ? 8729 : 8728));
+	m_comm.setUserNamePass(m_cfg.user, m_cfg.password);
+
+	if( !m_cfg.command.isEmpty() && !addCommand(m_cfg.command) )
+		return false;
+
+	if( m_cfg.readStdin )
+	{
+#ifdef Q_OS_UNIX
+		m_stdin = new QSocketNotifier(STDIN_FILENO, QSocketNotifier::Read, this);
+		connect( m_stdin, SIGNAL(activated(int)), this, SLOT(onStdinReady()) );
+#else
+		// No notifier for console handles. Commands are read at once.
+		QFile in;
+		if( in.open(stdin, QIODevice::ReadOnly) )
+			while( !in.atEnd() )
+				addLine(in.readLine());
+		m_stdinEOF = true;
+#endif
+	}
+	m_comm.connectToROS();
+	// Event loop must be running to exit it.
+	QMetaObject::invokeMethod(this, "checkFinished", Qt::QueuedConnection);
+	return true;
+}
+
+/**
+ * @brief CliSession::addCommand
+ * Sends a command.
+ * @param words The command words: path, attributes and queries.
+ * @return false if a word is not valid. Error is printed.
+ */
+bool CliSession::addCommand(const QStringList &words)
+{
+	m_sent.clear();
+	for( int i = 0; i < words.count(); i++ )
+		if( m_sent.addWord(words.at(i)) == QSentence::InvalidWord )
+		{
+			error(QString("Invalid word '%1'").arg(words.at(i)));
+			return false;
+		}
+	if( m_sent.command().isEmpty() )
+	{
+		error(QString("No command path in '%1'").arg(words.join(" ")));
+		return false;
+	}
+	if( !m_cfg.proplist.isEmpty() && m_sent.proplist().isEmpty() )
+		m_sent.setProplist(m_cfg.proplist);
+
+	if( m_comm.sendSentence(m_sent, true).isEmpty() )
+	{
+		error(QString("Cannot send '%1'").arg(m_sent.command()));
+		return false;
+	}
+	m_pending++;
+	return true;
+}
+
+/**
+ * @brief CliSession::addLine
+ * Sends the command of a stdin line. Words are separated by tabs if
+ * there is any on line, by spaces otherwise. Empty lines and lines
+ * starting by # are skipped. A bad line sets exit code but doesn't stop
+ * reading.
+ */
+bool CliSession::addLine(const QByteArray &line)
+{
+	QString s = QString::fromUtf8(line).trimmed();
+	if( s.isEmpty() || s.startsWith('#') )
+		return true;
+
+	QStringList words = s.contains('\t') ? s.split('\t', QString::SkipEmptyParts)
+										 : s.split(' ', QString::SkipEmptyParts);
+	if( addCommand(words) )
+		return true;
+	m_exitCode = qMax<int>(m_exitCode, ExitTrap);
+	return false;
+}
+
+/**
+ * @brief CliSession::onStdinReady
+ * Reads commands available on stdin. Reading is paused while window
+ * commands are in flight and resumed as they finish.
+ */
+void CliSession::onStdinReady()
+{
+#ifdef Q_OS_UNIX
+	char buf[FLUSH_SIZE];
+	ssize_t n = ::read(STDIN_FILENO, buf, sizeof(buf));
+	if( (n < 0) && ((errno == EINTR) || (errno == EAGAIN)) )
+		return;
+	if( n <= 0 )
+	{
+		m_stdin->setEnabled(false);
+		m_stdinEOF = true;
+		if( !m_stdinBuf.isEmpty() )
+			addLine(m_stdinBuf);
+		m_stdinBuf.clear();
+		checkFinished();
+		return;
+	}
+	m_stdinBuf.append(buf, int(n));
+	int start = 0;
+	int eol;
+	while( (eol = m_stdinBuf.indexOf('\n', start)) != -1 )
+	{
+		addLine(m_stdinBuf.mid(start, eol - start));
+		start = eol + 1;
+	}
+	m_stdinBuf.remove(0, start);
+	if( m_pending >= m_cfg.window )
+		m_stdin->setEnabled(false);
+#endif
+}
+
+/**
+ * @brief CliSession::onReply
+ * Writes a reply received.
+ */
+void CliSession::onReply(QSentence &s)
+{
+	if( m_cfg.json )
+		writeJson(s);
+	else
+		writeText(s);
+
+	if( m_out.size() >= FLUSH_SIZE )
+		flush();
+	else
+	if( !m_flushTimer.isActive() )
+		m_flushTimer.start();
+}
+
+/**
+ * @brief CliSession::writeJson
+ * Writes a reply as a JSON object on a single line, with .type, .tag and
+ * .id members followed by the attributes.
+ * {".type":"re",".tag":"1",".id":"*1","name":"ether1"}
+ */
+void CliSession::writeJson(const QSentence &s)
+{
+	QByteArray type = s.resultString().toLatin1();
+	appendPair(m_out, QLatin1String(".type"), QLatin1String(type.constData() + 1, qMax(0, type.size() - 1)), true);
+	if( !s.tag().isEmpty() )
+	{
+		QByteArray tag = s.tag().toLatin1();
+		appendPair(m_out, QLatin1String(".tag"), QLatin1String(tag.constData(), tag.size()));
+	}
+	if( !s.getID().isEmpty() )
+	{
+		QByteArray id = s.getID().toLatin1();
+		appendPair(m_out, QLatin1String(".id"), QLatin1String(id.constData(), id.size()));
+	}
+	const QBasicAttrib &attrs = s.attributes();
+	for( int i = 0; i < attrs.count(); i++ )
+		appendPair(m_out, attrs.nameLatin1(i), attrs.valueLatin1(i));
+	m_out.append("}\n", 2);
+}
+
+/**
+ * @brief CliSession::writeText
+ * Writes a reply as his API words separated by tabs, on a single line.
+ * !re	.tag=1	=.id=*1	=name=ether1
+ */
+void CliSession::writeText(const QSentence &s)
+{
+	m_out.append(s.resultString().toLatin1());
+	if( !s.tag().isEmpty() )
+	{
+		m_out.append("\t.tag=", 6);
+		m_out.append(s.tag().toLatin1());
+	}
+	if( !s.getID().isEmpty() )
+	{
+		QByteArray id = s.getID().toLatin1();
+		m_out.append("\t=.id=", 6);
+		appendWord(m_out, id.constData(), id.size());
+	}
+	const QBasicAttrib &attrs = s.attributes();
+	for( int i = 0; i < attrs.count(); i++ )
+	{
+		QLatin1String name = attrs.nameLatin1(i);
+		QLatin1String value = attrs.valueLatin1(i);
+		m_out.append("\t=", 2);
+		appendWord(m_out, name.data(), name.size());
+		m_out.append('=');
+		appendWord(m_out, value.data(), value.size());
+	}
+	m_out.append('\n');
+}
+
+/**
+ * @brief CliSession::flush
+ * Writes buffered output. Blocks while stdout reader is slow, so Comm
+ * stops reading from router meanwhile and router buffers the rest.
+ */
+void CliSession::flush()
+{
+	m_flushTimer.stop();
+	if( m_out.isEmpty() )
+		return;
+	fwrite(m_out.constData(), 1, size_t(m_out.size()), stdout);
+	fflush(stdout);
+	// Keeps the memory reserved.
+	m_out.resize(0);
+}
+
+/**
+ * @brief CliSession::error
+ * Prints an error on stderr, after any reply already buffered.
+ */
+void CliSession::error(const QString &msg)
+{
+	flush();
+	fprintf(stderr, "qmikcli: %s\n", msg.toLocal8Bit().constData());
+	fflush(stderr);
+}
+
+/**
+ * @brief CliSession::onCommandFinished
+ * Keeps exit code and resumes stdin reading when window has room.
+ */
+void CliSession::onCommandFinished(int batch, const QString &tag, QSentence::Result result)
+{
+	Q_UNUSED(batch);
+	Q_UNUSED(tag);
+
+	m_pending--;
+	if( result == QSentence::Fatal )
+		m_exitCode = qMax<int>(m_exitCode, ExitConnection);
+	else
+	if( result != QSentence::Done )
+		m_exitCode = qMax<int>(m_exitCode, ExitTrap);
+
+	if( m_stdin && !m_stdinEOF && (m_pending < m_cfg.window) )
+		m_stdin->setEnabled(true);
+	checkFinished();
+}
+
+/**
+ * @brief CliSession::onComError
+ * Connection and login errors end the session, unless running as
+ * daemon. Daemon keeps reconnecting, except if login is refused.
+ */
+void CliSession::onComError(Comm::CommError ce, QAbstractSocket::SocketError se)
+{
+	Q_UNUSED(se);
+
+	error(m_comm.errorString());
+	if( ce == Comm::LoginRefused )
+		finish(ExitLogin);
+	else
+	if( !m_cfg.daemon )
+		finish(ExitConnection);
+}
+
+/**
+ * @brief CliSession::checkFinished
+ * Ends the session when all commands are done and stdin is exhausted.
+ * Daemon only ends on stop().
+ */
+void CliSession::checkFinished()
+{
+	if( !m_cfg.daemon && m_stdinEOF && (m_pending <= 0) )
+		finish(m_exitCode);
+}
+
+/**
+ * @brief CliSession::finish
+ * Writes pending output, closes connection and exits event loop.
+ * Commands aborted by closing are not counted on exit code.
+ * @param code The process exit code.
+ */
+void CliSession::finish(int code)
+{
+	if( m_finished )
+		return;
+	m_finished = true;
+	m_comm.disconnect(this);
+	flush();
+	if( m_stdin )
+		m_stdin->setEnabled(false);
+	m_comm.closeCom(true);
+	QCoreApplication::exit(qMax(m_exitCode, code));
+}
+
+/**
+ * @brief CliSession::stop
+ * Ends the session now, as on SIGTERM. Commands in flight are dropped.
+ */
+void CliSession::stop()
+{
+	finish(m_exitCode);
+}
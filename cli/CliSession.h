@@ -0,0 +1,126 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef CLISESSION_H
+#define CLISESSION_H
+
+#include <QObject>
+#include <QTimer>
+#include <QByteArray>
+#include <QStringList>
+
+#include "Comm.h"
+
+class QSocketNotifier;
+
+namespace ROS
+{
+
+/**
+ * @brief The CliConfig struct
+ * Options given on command line.
+ */
+struct CliConfig
+{
+	QString host;
+	quint16 port;
+	QString user;
+	QString password;
+	bool ssl;
+	bool insecure;
+	bool json;
+	bool daemon;		// Reconnects and never exits on its own.
+	bool readStdin;		// Reads commands from stdin, one per line.
+	int timeoutMs;
+	int window;			// Max commands in flight while reading stdin.
+	QStringList proplist;
+	QStringList command;	// Words of the command given on command line.
+
+	CliConfig() : port(0), ssl(false), insecure(false), json(true), daemon(false),
+		readStdin(false), timeoutMs(0), window(64)
+	{ }
+};
+
+/**
+ * @brief The CliSession class
+ * Runs commands on a router without any GUI, writing every reply to
+ * stdout as a line: JSON objects (NDJSON) or API words separated by tabs.
+ * Output is buffered and written when buffer is big or event loop is
+ * idle, so a big print costs a few writes. Writes block when the reader
+ * is slow, and stdin is not read while too many commands are in flight,
+ * so memory stays bounded however much is piped in or out.
+ * Exit code is 0 if all commands succeed, 1 if any fails, 2 on
+ * connection errors and 3 if login is refused.
+ */
+class CliSession : public QObject
+{
+	Q_OBJECT
+
+public:
+	enum ExitCode
+	{
+		ExitOk = 0,
+		ExitTrap = 1,
+		ExitConnection = 2,
+		ExitLogin = 3
+	};
+
+private:
+	CliConfig m_cfg;
+	Comm m_comm;
+	QByteArray m_out;				// Output not written yet.
+	QTimer m_flushTimer;
+	QSocketNotifier *m_stdin;
+	QByteArray m_stdinBuf;			// Partial line read from stdin.
+	QSentence m_sent;				// Reused for every command sent.
+	int m_pending;					// Commands sent and not finished.
+	bool m_stdinEOF;
+	bool m_finished;
+	int m_exitCode;
+
+	bool addCommand(const QStringList &words);
+	bool addLine(const QByteArray &line);
+	void writeReply(const QSentence &s);
+	void writeJson(const QSentence &s);
+	void writeText(const QSentence &s);
+	void write(const QByteArray &data);
+	void error(const QString &msg);
+	void finish(int code);
+
+private slots:
+	void checkFinished();
+	void onReply(ROS::QSentence &s);
+	void onCommandFinished(int batch, const QString &tag, ROS::QSentence::Result result);
+	void onComError(ROS::Comm::CommError ce, QAbstractSocket::SocketError se);
+	void onStdinReady();
+
+public:
+	explicit CliSession(const CliConfig &cfg, QObject *papi = NULL);
+	~CliSession();
+
+	bool start();
+
+public slots:
+	void flush();
+	void stop();
+};
+}
+#endif // CLISESSION_H
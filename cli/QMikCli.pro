@@ -0,0 +1,25 @@
+#-------------------------------------------------
+#
+# Headless RouterOS API client, for scripts and services.
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = qmikcli
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+include(../QMikAPI.pri)
+
+SOURCES += main.cpp \
+    CliSession.cpp
+
+HEADERS  += \
+    CliSession.h
+
+DISTFILES += \
+    qmikcli.service
@@ -0,0 +1,168 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+/*
+ * Headless RouterOS API client.
+ * Runs a command given on command line, or commands read from stdin,
+ * and writes replies to stdout, one per line. See CliSession.
+ *
+ *   qmikcli -H 192.168.1.1 -u admin /interface/print =.proplist=name,type
+ *   qmikcli -H 192.168.1.1 --stdin < commands.txt
+ *   qmikcli -H 192.168.1.1 --reconnect /log/listen
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QSocketNotifier>
+#include <QFile>
+
+#include <stdio.h>
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
+
+#include "CliSession.h"
+
+using namespace ROS;
+
+#ifdef Q_OS_UNIX
+// Signals are turned into a read on this socket pair, so the session is
+// stopped from event loop instead of from the signal handler.
+static int signalFd[2];
+
+static void onSignal(int)
+{
+	char c = 1;
+	ssize_t n = ::write(signalFd[0], &c, 1);
+	Q_UNUSED(n);
+}
+
+/**
+ * @brief watchSignals
+ * Stops session on SIGTERM, SIGINT and SIGHUP, writing any output
+ * buffered and closing connection gracefully.
+ */
+static bool watchSignals(CliSession *session)
+{
+	if( ::socketpair(AF_UNIX, SOCK_STREAM, 0, signalFd) )
+		return false;
+	QSocketNotifier *sn = new QSocketNotifier(signalFd[1], QSocketNotifier::Read, session);
+	QObject::connect( sn, SIGNAL(activated(int)), session, SLOT(stop()) );
+
+	struct sigaction sa;
+	sa.sa_handler = onSignal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+	// A closed stdout pipe ends writes with EPIPE instead of killing us.
+	signal(SIGPIPE, SIG_IGN);
+	return true;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCoreApplication::setApplicationName("qmikcli");
+	QCommandLineParser args;
+	args.setApplicationDescription("Runs RouterOS API commands and writes replies to stdout, one per line.");
+	args.addHelpOption();
+	args.addPositionalArgument("words", "Command to run: path, attributes and queries as API words.", "[/path =attr=value ?query]");
+	QCommandLineOption hostOpt(QStringList() << "H" << "host", "Router address.", "address");
+	QCommandLineOption portOpt(QStringList() << "p" << "port", "API port. Defaults to 8728, or 8729 with --ssl.", "port", "0");
+	QCommandLineOption userOpt(QStringList() << "u" << "user", "User name.", "name", "admin");
+	QCommandLineOption passOpt("password", "Password. Visible to other users; prefer --password-file or QMIKAPI_PASSWORD.", "password");
+	QCommandLineOption passFileOpt("password-file", "Reads password from first line of file.", "file");
+	QCommandLineOption sslOpt("ssl", "Connects to api-ssl service.");
+	QCommandLineOption insecureOpt("insecure", "Accepts any router certificate.");
+	QCommandLineOption formatOpt("format", "Output format: json (one object per line) or text (API words, tab separated).", "format", "json");
+	QCommandLineOption proplistOpt("proplist", "Attributes wanted on replies, comma separated.", "names");
+	QCommandLineOption timeoutOpt("timeout", "Fails commands without reply in time. Listen commands never time out.", "ms", "0");
+	QCommandLineOption stdinOpt("stdin", "Reads commands from stdin, one per line. Words separated by tabs or spaces.");
+	QCommandLineOption windowOpt("window", "Max stdin commands in flight.", "count", "64");
+	QCommandLineOption reconnectOpt("reconnect", "Runs until stopped: reconnects and resends commands when connection is lost.");
+	args.addOption(hostOpt);
+	args.addOption(portOpt);
+	args.addOption(userOpt);
+	args.addOption(passOpt);
+	args.addOption(passFileOpt);
+	args.addOption(sslOpt);
+	args.addOption(insecureOpt);
+	args.addOption(formatOpt);
+	args.addOption(proplistOpt);
+	args.addOption(timeoutOpt);
+	args.addOption(stdinOpt);
+	args.addOption(windowOpt);
+	args.addOption(reconnectOpt);
+	args.process(app);
+
+	CliConfig cfg;
+	cfg.host = args.value(hostOpt);
+	cfg.port = quint16(args.value(portOpt).toUInt());
+	cfg.user = args.value(userOpt);
+	cfg.ssl = args.isSet(sslOpt);
+	cfg.insecure = args.isSet(insecureOpt);
+	cfg.json = args.value(formatOpt) != "text";
+	cfg.daemon = args.isSet(reconnectOpt);
+	cfg.readStdin = args.isSet(stdinOpt);
+	cfg.timeoutMs = args.value(timeoutOpt).toInt();
+	cfg.window = qMax(1, args.value(windowOpt).toInt());
+	if( args.isSet(proplistOpt) )
+		cfg.proplist = args.value(proplistOpt).split(',', QString::SkipEmptyParts);
+	cfg.command = args.positionalArguments();
+
+	if( args.isSet(passOpt) )
+		cfg.password = args.value(passOpt);
+	else
+	if( args.isSet(passFileOpt) )
+	{
+		QFile f(args.value(passFileOpt));
+		if( !f.open(QIODevice::ReadOnly) )
+		{
+			fprintf(stderr, "qmikcli: Cannot read %s\n", args.value(passFileOpt).toLocal8Bit().constData());
+			return CliSession::ExitConnection;
+		}
+		cfg.password = QString::fromUtf8(f.readLine()).remove('\n').remove('\r');
+	}
+	else
+		cfg.password = QString::fromLocal8Bit(qgetenv("QMIKAPI_PASSWORD"));
+
+	if( (args.value(formatOpt) != "json") && (args.value(formatOpt) != "text") )
+	{
+		fprintf(stderr, "qmikcli: Unknown format %s\n", args.value(formatOpt).toLocal8Bit().constData());
+		return CliSession::ExitTrap;
+	}
+	if( cfg.host.isEmpty() || (cfg.command.isEmpty() && !cfg.readStdin) )
+		args.showHelp(CliSession::ExitTrap);
+
+	CliSession session(cfg);
+#ifdef Q_OS_UNIX
+	watchSignals(&session);
+#endif
+	if( !session.start() )
+		return CliSession::ExitTrap;
+	return app.exec();
+}
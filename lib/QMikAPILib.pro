@@ -0,0 +1,18 @@
+#-------------------------------------------------
+#
+# QMikAPI as a static library, without widgets.
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = QMikAPI
+TEMPLATE = lib
+
+CONFIG += c++11 staticlib
+
+# No debug/release subdirs, so QMikAPI.pri finds it.
+DESTDIR = $$OUT_PWD
+
+include(../QMikAPILib.pri)
@@ -0,0 +1,451 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "MockServer.h"
+#include "QMD5.h"
+
+#include <QRandomGenerator>
+
+using namespace ROS;
+
+/**
+ * @brief MockReply::fromCapture
+ * Creates a reply from a capture. Capture tags are removed, as the
+ * command ones are used. If capture doesn't end with !done, !trap or
+ * !fatal, it's a stream.
+ * @param cap The capture.
+ */
+QSharedPointer<MockReply> MockReply::fromCapture(const Capture &cap)
+{
+	QSharedPointer<MockReply> reply(new MockReply);
+	QList<QList<QByteArray> > sentences = Captures::split(cap);
+	for( int i = 0; i < sentences.count(); i++ )
+	{
+		const QList<QByteArray> &words = sentences.at(i);
+		QByteArray body;
+		for( int w = 0; w < words.count(); w++ )
+			if( !words.at(w).startsWith(".tag=") )
+				CaptureWriter::appendWord(body, words.at(w));
+		reply->bodies.append(body);
+	}
+	reply->stream = !sentences.isEmpty() && !sentences.last().isEmpty() && (sentences.last().first() == "!re");
+	return reply;
+}
+
+/**
+ * @brief MockReply::done
+ * @return the reply for commands that just return !done.
+ */
+QSharedPointer<MockReply> MockReply::done()
+{
+	QSharedPointer<MockReply> reply(new MockReply);
+	QByteArray body;
+	CaptureWriter::appendWord(body, "!done");
+	reply->bodies.append(body);
+	return reply;
+}
+
+MockSession::MockSession(MockServer *server, QTcpSocket *sock)
+ : QObject(server), m_server(server), m_sock(sock), m_inPos(0), m_logedIn(false), m_lastTick(server->now())
+{
+	m_sock->setParent(this);
+	connect( m_sock, SIGNAL(readyRead()), this, SLOT(onReadyRead()) );
+	connect( m_sock, SIGNAL(disconnected()), this, SLOT(onDisconnected()) );
+}
+
+MockSession::~MockSession()
+{
+	m_server->m_active.remove(this);
+}
+
+void MockSession::onDisconnected()
+{
+	m_jobs.clear();
+	deleteLater();
+}
+
+/**
+ * @brief MockSession::onReadyRead
+ * Handles every full sentence received. Replies ready to be sent (no
+ * latency) are sent right away instead of waiting for next tick.
+ */
+void MockSession::onReadyRead()
+{
+	m_in.append(m_sock->readAll());
+
+	QList<QByteArray> words;
+	while( takeSentence(&words) )
+	{
+		if( !words.isEmpty() )
+			handle(words);
+		words.clear();
+	}
+	m_in.remove(0, m_inPos);
+	m_inPos = 0;
+
+	if( !m_jobs.isEmpty() )
+		m_server->activate(this);
+	if( !tick(m_server->now()) )
+		m_server->m_active.remove(this);
+}
+
+/**
+ * @brief MockSession::takeSentence
+ * Decodes a full sentence from m_in.
+ * @param words Where to store his words.
+ * @return false if there is no full sentence on m_in.
+ */
+bool MockSession::takeSentence(QList<QByteArray> *words)
+{
+	const unsigned char *p = (const unsigned char*)m_in.constData();
+	int pos = m_inPos;
+	while( pos < m_in.count() )
+	{
+		unsigned char b = p[pos];
+		int len, size;
+		if( (b & 0xE0) == 0xE0 )
+		{
+			size = 4;
+			len = b & 0x1F;
+		}
+		else
+		if( (b & 0xC0) == 0xC0 )
+		{
+			size = 3;
+			len = b & 0x3F;
+		}
+		else
+		if( (b & 0x80) == 0x80 )
+		{
+			size = 2;
+			len = b & 0x7F;
+		}
+		else
+		{
+			size = 1;
+			len = b;
+		}
+		if( pos + size > m_in.count() )
+			return false;
+		for( int i = 1; i < size; i++ )
+			len = (len << 8) | p[pos + i];
+		if( pos + size + len > m_in.count() )
+			return false;
+		if( !len )
+		{
+			m_inPos = pos + size;
+			return true;
+		}
+		words->append(m_in.mid(pos + size, len));
+		pos += size + len;
+	}
+	return false;
+}
+
+/**
+ * @brief MockSession::handle
+ * Handles a client sentence.
+ * @param words The sentence words. First one is the command.
+ */
+void MockSession::handle(const QList<QByteArray> &words)
+{
+	const QByteArray &cmd = words.first();
+	QByteArray tag;
+	QHash<QByteArray, QByteArray> attribs;
+	for( int i = 1; i < words.count(); i++ )
+	{
+		const QByteArray &w = words.at(i);
+		if( w.startsWith(".tag=") )
+			tag = w.mid(5);
+		else
+		if( w.startsWith('=') )
+		{
+			int eq = w.indexOf('=', 1);
+			if( eq == -1 )
+				attribs.insert(w.mid(1), QByteArray());
+			else
+				attribs.insert(w.mid(1, eq - 1), w.mid(eq + 1));
+		}
+	}
+	m_server->m_commands++;
+
+	if( cmd == "/login" )
+		handleLogin(attribs, tag);
+	else
+	if( !m_logedIn )
+	{
+		appendSentence(QList<QByteArray>() << "!trap" << "=message=not logged in", tag);
+		appendSentence(QList<QByteArray>() << "!done", tag);
+	}
+	else
+	if( cmd == "/cancel" )
+		handleCancel(attribs.value("tag"), tag);
+	else
+	if( cmd == "/quit" )
+	{
+		appendSentence(QList<QByteArray>() << "!fatal" << "session terminated on request", tag);
+		flush();
+		m_sock->disconnectFromHost();
+	}
+	else
+	{
+		QSharedPointer<MockReply> reply = m_server->m_cfg.replies.value(QString::fromLatin1(cmd));
+		if( reply.isNull() )
+		{
+			if( cmd.endsWith("/print") || cmd.endsWith("/getall") )
+				reply = m_server->m_cfg.printReply;
+			else
+			if( cmd.endsWith("/listen") )
+				reply = m_server->m_cfg.listenReply;
+		}
+		queueJob(tag, reply.isNull() ? MockReply::done() : reply);
+	}
+	flush();
+}
+
+/**
+ * @brief MockSession::handleLogin
+ * /login with name and password logs in right away (RouterOS 6.43+),
+ * unless legacyLogin is set: then a challenge is replied, as older
+ * routers do. /login alone replies a challenge, and /login with name
+ * and response checks the MD5 response to it.
+ */
+void MockSession::handleLogin(const QHash<QByteArray, QByteArray> &attribs, const QByteArray &tag)
+{
+	const MockConfig &cfg = m_server->m_cfg;
+	bool ok = false;
+
+	if( attribs.contains("password") && !cfg.legacyLogin )
+		ok = (attribs.value("name") == cfg.user.toLatin1()) && (attribs.value("password") == cfg.password.toLatin1());
+	else
+	if( attribs.contains("response") && !m_challenge.isEmpty() )
+	{
+		QByteArray expected = "00" + QMD5::encode(cfg.password.toLatin1(), m_challenge.constData(), m_challenge.count());
+		ok = (attribs.value("name") == cfg.user.toLatin1()) && (attribs.value("response").toUpper() == expected.toUpper());
+	}
+	else
+	{
+		QByteArray seed(16, '\0');
+		for( int i = 0; i < seed.count(); i++ )
+			seed[i] = char(QRandomGenerator::global()->bounded(256));
+		m_challenge = seed.toHex();
+		appendSentence(QList<QByteArray>() << "!done" << "=ret=" + m_challenge, tag);
+		return;
+	}
+
+	if( ok )
+	{
+		m_logedIn = true;
+		m_server->m_logins++;
+		appendSentence(QList<QByteArray>() << "!done", tag);
+	}
+	else
+	{
+		appendSentence(QList<QByteArray>() << "!trap" << "=message=invalid user name or password (6)", tag);
+		appendSentence(QList<QByteArray>() << "!done", tag);
+	}
+}
+
+/**
+ * @brief MockSession::handleCancel
+ * Stops the reply being sent for a command.
+ * @param target Tag of command to cancel.
+ * @param tag The /cancel tag.
+ */
+void MockSession::handleCancel(const QByteArray &target, const QByteArray &tag)
+{
+	bool found = false;
+	for( int i = m_jobs.count() - 1; i >= 0; i-- )
+		if( m_jobs.at(i).tag == target )
+		{
+			m_jobs.removeAt(i);
+			found = true;
+		}
+
+	if( found )
+	{
+		appendSentence(QList<QByteArray>() << "!trap" << "=category=2" << "=message=interrupted", target);
+		appendSentence(QList<QByteArray>() << "!done", target);
+		appendSentence(QList<QByteArray>() << "!done", tag);
+	}
+	else
+	{
+		appendSentence(QList<QByteArray>() << "!trap" << "=message=no such command", tag);
+		appendSentence(QList<QByteArray>() << "!done", tag);
+	}
+}
+
+/**
+ * @brief MockSession::queueJob
+ * Queues a reply to be sent once latency is elapsed.
+ */
+void MockSession::queueJob(const QByteArray &tag, const QSharedPointer<MockReply> &reply)
+{
+	const MockConfig &cfg = m_server->m_cfg;
+	Job job;
+	job.tag = tag;
+	job.reply = reply;
+	job.next = 0;
+	job.startAt = m_server->now() + cfg.latencyMs;
+	if( cfg.jitterMs > 0 )
+		job.startAt += QRandomGenerator::global()->bounded(cfg.jitterMs + 1);
+	job.credit = 0;
+	m_jobs.append(job);
+}
+
+void MockSession::appendSentence(const QByteArray &body, const QByteArray &tag)
+{
+	m_out.append(body);
+	if( !tag.isEmpty() )
+		CaptureWriter::appendWord(m_out, ".tag=" + tag);
+	CaptureWriter::appendEnd(m_out);
+	m_server->m_sentences++;
+}
+
+void MockSession::appendSentence(const QList<QByteArray> &words, const QByteArray &tag)
+{
+	QByteArray body;
+	for( int i = 0; i < words.count(); i++ )
+		CaptureWriter::appendWord(body, words.at(i));
+	appendSentence(body, tag);
+}
+
+void MockSession::flush()
+{
+	if( m_out.count() )
+	{
+		m_sock->write(m_out);
+		m_out.resize(0);
+	}
+}
+
+/**
+ * @brief MockSession::tick
+ * Sends replies whose latency is elapsed, limited by rate.
+ * Nothing is sent while more than 1MB is waiting on socket, as a router
+ * does when client doesn't read, so client side backpressure can be
+ * tested.
+ * @param now Server clock msecs.
+ * @return true while there are replies pending.
+ */
+bool MockSession::tick(qint64 now)
+{
+	qint64 dt = now - m_lastTick;
+	m_lastTick = now;
+	if( m_sock->bytesToWrite() > 0x100000 )
+		return !m_jobs.isEmpty();
+
+	int rate = m_server->m_cfg.rate;
+	for( int i = 0; (i < m_jobs.count()) && (m_out.count() < 0x100000); )
+	{
+		Job &job = m_jobs[i];
+		if( now < job.startAt )
+		{
+			i++;
+			continue;
+		}
+
+		int budget = 4096;
+		if( rate > 0 )
+		{
+			job.credit += double(rate) * double(qMin(dt, now - job.startAt + 10)) / 1000.0;
+			budget = int(job.credit);
+			job.credit -= budget;
+		}
+		const QList<QByteArray> &bodies = job.reply->bodies;
+		while( (budget-- > 0) && (job.next < bodies.count()) )
+		{
+			appendSentence(bodies.at(job.next++), job.tag);
+			if( (job.next == bodies.count()) && job.reply->stream )
+				job.next = 0;
+		}
+		if( job.next >= bodies.count() )
+			m_jobs.removeAt(i);
+		else
+			i++;
+	}
+	flush();
+	return !m_jobs.isEmpty();
+}
+
+MockServer::MockServer(const MockConfig &cfg, QObject *papi)
+ : QObject(papi), m_cfg(cfg), m_connections(0), m_logins(0), m_commands(0), m_sentences(0)
+{
+	m_clock.start();
+	m_ticker.setInterval(10);
+	connect( &m_ticker, SIGNAL(timeout()), this, SLOT(onTick()) );
+}
+
+/**
+ * @brief MockServer::listen
+ * Starts simulated routers.
+ * @param addr The address to listen on.
+ * @param basePort Port of first router. Every router uses next port.
+ * @param routers Amount of routers.
+ * @return false if any port cannot be listened.
+ */
+bool MockServer::listen(const QHostAddress &addr, quint16 basePort, int routers)
+{
+	for( int i = 0; i < routers; i++ )
+	{
+		QTcpServer *srv = new QTcpServer(this);
+		if( !srv->listen(addr, quint16(basePort + i)) )
+		{
+			delete srv;
+			return false;
+		}
+		connect( srv, SIGNAL(newConnection()), this, SLOT(onNewConnection()) );
+		m_listeners.append(srv);
+	}
+	return true;
+}
+
+void MockServer::onNewConnection()
+{
+	QTcpServer *srv = qobject_cast<QTcpServer*>(sender());
+	while( srv && srv->hasPendingConnections() )
+	{
+		new MockSession(this, srv->nextPendingConnection());
+		m_connections++;
+	}
+}
+
+void MockServer::activate(MockSession *s)
+{
+	m_active.insert(s);
+	if( !m_ticker.isActive() )
+		m_ticker.start();
+}
+
+/**
+ * @brief MockServer::onTick
+ * Lets every session with pending replies send them.
+ */
+void MockServer::onTick()
+{
+	qint64 t = now();
+	QList<MockSession*> active = m_active.values();
+	for( int i = 0; i < active.count(); i++ )
+		if( !active.at(i)->tick(t) )
+			m_active.remove(active.at(i));
+	if( m_active.isEmpty() )
+		m_ticker.stop();
+}
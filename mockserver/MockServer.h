@@ -0,0 +1,170 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MOCKSERVER_H
+#define MOCKSERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QSharedPointer>
+#include <QHash>
+#include <QSet>
+
+#include "Captures.h"
+
+namespace ROS
+{
+
+/**
+ * @brief The MockReply struct
+ * Sentences sent for a command, already encoded but without his tag
+ * and end of sentence, so they can be tagged for every command.
+ * Stream replies are sent again and again until command is cancelled.
+ */
+struct MockReply
+{
+	QList<QByteArray> bodies;
+	bool stream;
+	MockReply() : stream(false) { }
+
+	static QSharedPointer<MockReply> fromCapture(const Capture &cap);
+	static QSharedPointer<MockReply> done();
+};
+
+/**
+ * @brief The MockConfig struct
+ * How simulated routers behave.
+ */
+struct MockConfig
+{
+	QString user;
+	QString password;
+	bool legacyLogin;		// Reply to plain logins with MD5 challenge, as pre 6.43 routers.
+	int latencyMs;			// Delay before replying to every command.
+	int jitterMs;			// Random delay added to latency.
+	int rate;				// Sentences per second for every reply. 0 for as fast as possible.
+	QHash<QString, QSharedPointer<MockReply> > replies;		// Replies by command path.
+	QSharedPointer<MockReply> printReply;	// For print and getall commands without reply.
+	QSharedPointer<MockReply> listenReply;	// For listen commands without reply.
+	MockConfig() : legacyLogin(false), latencyMs(0), jitterMs(0), rate(0) { }
+};
+
+class MockServer;
+
+/**
+ * @brief The MockSession class
+ * A client connected to a simulated router.
+ * Decodes client sentences, handles /login (plain and MD5 challenge
+ * flavours), /cancel and /quit, and replies to any other command with
+ * the configured reply.
+ */
+class MockSession : public QObject
+{
+	Q_OBJECT
+
+	/**
+	 * @brief The Job struct
+	 * A reply being sent.
+	 */
+	struct Job
+	{
+		QByteArray tag;
+		QSharedPointer<MockReply> reply;
+		int next;			// Next sentence to send.
+		qint64 startAt;		// When to start sending. Server clock msecs.
+		double credit;		// Sentences that can be sent now, for rate limiting.
+	};
+
+	MockServer *m_server;
+	QTcpSocket *m_sock;
+	QByteArray m_in;
+	int m_inPos;			// First byte on m_in not decoded yet.
+	QByteArray m_out;
+	bool m_logedIn;
+	QByteArray m_challenge;
+	QList<Job> m_jobs;
+	qint64 m_lastTick;
+
+	bool takeSentence(QList<QByteArray> *words);
+	void handle(const QList<QByteArray> &words);
+	void handleLogin(const QHash<QByteArray, QByteArray> &attribs, const QByteArray &tag);
+	void handleCancel(const QByteArray &target, const QByteArray &tag);
+	void queueJob(const QByteArray &tag, const QSharedPointer<MockReply> &reply);
+	void appendSentence(const QByteArray &body, const QByteArray &tag);
+	void appendSentence(const QList<QByteArray> &words, const QByteArray &tag);
+	void flush();
+
+private slots:
+	void onReadyRead();
+	void onDisconnected();
+
+public:
+	MockSession(MockServer *server, QTcpSocket *sock);
+	~MockSession();
+
+	bool tick(qint64 now);
+};
+
+/**
+ * @brief The MockServer class
+ * Simulates a fleet of routers, one per listening port, so thousands of
+ * Comm can be load tested against a single host.
+ * All routers share config and a single timer sending replies.
+ */
+class MockServer : public QObject
+{
+	Q_OBJECT
+
+	friend class MockSession;
+
+	MockConfig m_cfg;
+	QList<QTcpServer*> m_listeners;
+	QSet<MockSession*> m_active;		// Sessions with replies pending.
+	QTimer m_ticker;
+	QElapsedTimer m_clock;
+	quint64 m_connections;
+	quint64 m_logins;
+	quint64 m_commands;
+	quint64 m_sentences;
+
+	void activate(MockSession *s);
+	inline qint64 now() const { return m_clock.elapsed(); }
+
+private slots:
+	void onNewConnection();
+	void onTick();
+
+public:
+	MockServer(const MockConfig &cfg, QObject *papi = NULL);
+
+	bool listen(const QHostAddress &addr, quint16 basePort, int routers);
+	inline int routers() const { return m_listeners.count(); }
+	inline const MockConfig &config() const { return m_cfg; }
+	inline quint64 connections() const { return m_connections; }
+	inline quint64 logins() const { return m_logins; }
+	inline quint64 commands() const { return m_commands; }
+	inline quint64 sentences() const { return m_sentences; }
+};
+}
+#endif // MOCKSERVER_H
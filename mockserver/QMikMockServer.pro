@@ -0,0 +1,26 @@
+#-------------------------------------------------
+#
+# Mock RouterOS API server for load testing clients.
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+TARGET = QMikMockServer
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+INCLUDEPATH += .. ../benchmarks
+
+SOURCES += main.cpp \
+    MockServer.cpp \
+    ../benchmarks/Captures.cpp \
+    ../QMD5.cpp
+
+HEADERS  += \
+    MockServer.h \
+    ../benchmarks/Captures.h \
+    ../QMD5.h
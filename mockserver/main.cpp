@@ -0,0 +1,116 @@
+/*
+	Copyright 2015 Rafael Dellà Bort. silderan (at) gmail (dot) com
+
+	This file is part of QMikAPI.
+
+	QMikAPI is free software: you can redistribute it and/or modify
+	it under the terms of the GNU Lesser General Public License as
+	published by the Free Software Foundation, either version 3 of
+	the License, or (at your option) any later version.
+
+	QMikAPI is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	and GNU Lesser General Public License. along with QMikAPI.  If not,
+	see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Mock RouterOS API server.
+ * Simulates a fleet of routers speaking the API word framing, to load
+ * test clients without real routers. See MockServer.
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QTimer>
+
+#include "MockServer.h"
+
+using namespace ROS;
+
+static QTextStream out(stdout);
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QCommandLineParser args;
+	args.setApplicationDescription("Simulates RouterOS API routers for load testing.");
+	args.addHelpOption();
+	QCommandLineOption addrOpt("address", "Address to listen on.", "address", "127.0.0.1");
+	QCommandLineOption portOpt("port", "Port of first router.", "port", "8728");
+	QCommandLineOption routersOpt("routers", "Routers to simulate, on consecutive ports.", "count", "1");
+	QCommandLineOption userOpt("user", "User name to accept.", "name", "admin");
+	QCommandLineOption passOpt("password", "Password to accept.", "password", "");
+	QCommandLineOption legacyOpt("legacy-login", "Reply to plain logins with MD5 challenge, as pre 6.43 routers.");
+	QCommandLineOption latencyOpt("latency", "Delay before replying to every command.", "ms", "0");
+	QCommandLineOption jitterOpt("jitter", "Random delay added to latency.", "ms", "0");
+	QCommandLineOption rateOpt("rate", "Sentences per second for every reply. 0 for as fast as possible.", "count", "0");
+	QCommandLineOption rowsOpt("rows", "Rows replied to print commands without reply.", "count", "100");
+	QCommandLineOption replyOpt("reply", "Replies a recorded capture (raw API bytes sent by router) to a command.", "path=file");
+	QCommandLineOption statsOpt("stats", "Prints counters every interval.", "seconds", "0");
+	args.addOption(addrOpt);
+	args.addOption(portOpt);
+	args.addOption(routersOpt);
+	args.addOption(userOpt);
+	args.addOption(passOpt);
+	args.addOption(legacyOpt);
+	args.addOption(latencyOpt);
+	args.addOption(jitterOpt);
+	args.addOption(rateOpt);
+	args.addOption(rowsOpt);
+	args.addOption(replyOpt);
+	args.addOption(statsOpt);
+	args.process(app);
+
+	MockConfig cfg;
+	cfg.user = args.value(userOpt);
+	cfg.password = args.value(passOpt);
+	cfg.legacyLogin = args.isSet(legacyOpt);
+	cfg.latencyMs = args.value(latencyOpt).toInt();
+	cfg.jitterMs = args.value(jitterOpt).toInt();
+	cfg.rate = args.value(rateOpt).toInt();
+	cfg.printReply = MockReply::fromCapture(Captures::printDump(args.value(rowsOpt).toInt()));
+	cfg.listenReply = MockReply::fromCapture(Captures::listenStream(1000));
+
+	QStringList replies = args.values(replyOpt);
+	for( int i = 0; i < replies.count(); i++ )
+	{
+		int eq = replies.at(i).indexOf('=');
+		Capture cap;
+		if( (eq <= 0) || !Captures::load(replies.at(i).mid(eq + 1), &cap) )
+		{
+			out << "Cannot load reply " << replies.at(i) << endl;
+			return 1;
+		}
+		cfg.replies.insert(replies.at(i).left(eq), MockReply::fromCapture(cap));
+	}
+
+	MockServer server(cfg);
+	int routers = args.value(routersOpt).toInt();
+	quint16 port = quint16(args.value(portOpt).toUInt());
+	if( !server.listen(QHostAddress(args.value(addrOpt)), port, routers) )
+	{
+		out << "Cannot listen on ports " << port << "-" << (port + routers - 1) << endl;
+		return 1;
+	}
+	out << "Simulating " << routers << " routers on ports " << port << "-" << (port + routers - 1) << endl;
+
+	QTimer stats;
+	int statsSecs = args.value(statsOpt).toInt();
+	if( statsSecs > 0 )
+	{
+		QObject::connect( &stats, &QTimer::timeout, [&server]()
+		{
+			out << "connections " << server.connections() << " logins " << server.logins()
+				<< " commands " << server.commands() << " sentences " << server.sentences() << endl;
+		});
+		stats.start(statsSecs * 1000);
+	}
+	return app.exec();
+}